@@ -27,12 +27,12 @@ struct order_by_frame {
 };
 
 void ActionCurve::refresh() {
-    if (mKeyframes.empty()) return;
+    mIndexed = true;
     if (mKeyframes.size() < 2) return;
 
     std::sort(mKeyframes.begin(), mKeyframes.end(), order_by_frame());
     int maxFrame = (int) mKeyframes[mKeyframes.size() - 1].x;
-    mLUT.resize(maxFrame, 0);
+    mLUT.resize(std::max(maxFrame, 0));
 
     float minY = mKeyframes[0].y;
     float maxY = minY;
@@ -45,37 +45,62 @@ void ActionCurve::refresh() {
     mMinY = minY;
     mMaxY = maxY;
 
-    for (int i = 0; i < mLUT.size(); i++) {
-        for (int j = (i > 0 ? mLUT[i - 1] : 0);
-             j < mKeyframes.size() - 1; j++) {
-            if (i >= (int) mKeyframes[j].x &&
-                i < (int) mKeyframes[j + 1].x) {
-                mLUT[i] = j;
-            }
+    // Frames before the first key start from it too.
+    size_t key = 0;
+    for (int i = 0; i < (int) mLUT.size(); i++) {
+        while (key + 2 < mKeyframes.size() && i >= (int) mKeyframes[key + 1].x) {
+            key++;
         }
+        mLUT[i] = key;
     }
 }
 
-// TODO: get the real parameterization
 float ActionCurve::evalAtFrame(int frame, bool normalized) {
-    const Keyframe &a = mKeyframes[mLUT[frame]];
-    const Keyframe &b = mKeyframes[mLUT[frame] + 1];
+    if (!mIndexed) refresh();
+    return evalIndexed(frame, normalized);
+}
+
+void ActionCurve::evalAtFrame(const int *frames, size_t count, bool normalized, float *out) {
+    if (!mIndexed) refresh();
+    for (size_t i = 0; i < count; i++) {
+        out[i] = evalIndexed(frames[i], normalized);
+    }
+}
+
+// TODO: get the real parameterization
+float ActionCurve::evalIndexed(int frame, bool normalized) const {
+    if (mKeyframes.size() < 2) {
+        return mKeyframes.empty() || normalized ? 0.0f : mKeyframes[0].y;
+    }
+
+    // Frames outside the keys hold the first or last one.
+    size_t key = frame < 0 ? 0 :
+                 (size_t) frame < mLUT.size() ? mLUT[frame] : mKeyframes.size() - 2;
+    const Keyframe &a = mKeyframes[key];
+    const Keyframe &b = mKeyframes[key + 1];
 
     float df = frame - a.x;
     float total = b.x - a.x;
 
-    float t = df / total;
-    float tm = 1.0f - t;
+    float yres;
+    if (total <= 0.0f) {
+        // Keys sharing a frame jump to the later one.
+        yres = b.y;
+    } else {
+        float t = std::min(std::max(df / total, 0.0f), 1.0f);
+        float tm = 1.0f - t;
 
-    float c0 = tm * tm * tm;
-    float c1 = t * tm * tm;
-    float c2 = t * t * tm;
-    float c3 = t * t * t;
+        float c0 = tm * tm * tm;
+        float c1 = t * tm * tm;
+        float c2 = t * t * tm;
+        float c3 = t * t * t;
 
-    float yres = c0 * a.y + c1 * a.hry + c2 * b.hly + c3 * b.y;
+        yres = c0 * a.y + c1 * a.hry + c2 * b.hly + c3 * b.y;
+    }
 
     if (normalized) {
-        yres = (yres - mMinY) / (mMaxY - mMinY);
+        // A flat curve is at its minimum throughout.
+        yres = mMaxY > mMinY ? (yres - mMinY) / (mMaxY - mMinY) : 0.0f;
     }
 
     return yres;
@@ -57,6 +57,8 @@ public:
         return KeyHandleType::AutoClamped;
     }
 
+    // Keys can come in any order. They are sorted and indexed once, on
+    // the first evaluation after them.
     void addKey(CurveType curveType,
                 KeyHandleType leftType,
                 KeyHandleType rightType,
@@ -76,22 +78,29 @@ public:
         kf.y = y;
 
         mKeyframes.push_back(kf);
-        refresh();
+        mIndexed = false;
     }
 
     float evalAtFrame(int frame, bool normalized);
 
+    // evalAtFrame for |count| frames at once.
+    void evalAtFrame(const int *frames, size_t count, bool normalized, float *out);
+
 private:
 
     void refresh();
 
+    float evalIndexed(int frame, bool normalized) const;
+
     // float getYValAt(int keyframeIndex, float offset);
 
-    float mMinY;
-    float mMaxY;
+    float mMinY = 0.0f;
+    float mMaxY = 0.0f;
 
     std::vector<Keyframe> mKeyframes;
+    // The key each frame starts from, up to the last key.
     std::vector<size_t> mLUT;
+    bool mIndexed = false;
 };
 
 
@@ -0,0 +1,668 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "AnimationTracks.h"
+
+#include "log.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Error budgets for playback against the raw samples. Positions are in
+// scene units (the authored scenes are a few tens of units across).
+// Orientation error is held to the same displacement at unit distance
+// from the origin of the scaled model, so large models get a tighter
+// angle. Keyframe reduction gets what quantization leaves of these.
+static const float kPosTolerance = 1e-3f;
+static const float kScaleTolerance = 1e-3f;
+
+// Bounds the cost of the greedy reduction on long static stretches.
+static const uint32_t kMaxKeySpan = 240;
+
+// Finest position quantization step; coarser power of two multiples
+// are used for tracks whose frames move further than int16 deltas can
+// reach at this step. The rest of the int16 range is headroom for the
+// rounding carried from the previous key.
+static const float kMinPosStep = 1.0f / 8192.0f;
+static const float kMaxPosDelta = 32000.0f;
+
+static const float kOrientationScale = 32767.0f;
+// Rounding each component to kOrientationScale moves a unit quaternion
+// by at most 1 / kOrientationScale, which turns it by twice that angle.
+static const float kOrientationError = 2.0f / kOrientationScale;
+
+// When streaming, keys for this many frames past the playhead are kept
+// paged in, refreshed every kPrefetchStepFrames.
+static const float kStreamWindowFrames = 240.0f;
+static const float kPrefetchStepFrames = 60.0f;
+
+// Raw samples are compressed whenever this many have piled up, so load
+// memory doesn't grow with the length of the scene. 56 bytes each.
+static const size_t kMaxPendingSamples = 16384;
+
+static const char kStreamMagic[4] = {'A', 'N', 'I', 'M'};
+static const uint32_t kStreamVersion = 2;
+
+struct StreamHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t keyCount;
+    uint32_t keySize;
+};
+
+static float sLerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+static int16_t sQuantize(float v, float scale) {
+    float q = roundf(v * scale);
+    q = std::max(-32767.0f, std::min(32767.0f, q));
+    return (int16_t) q;
+}
+
+// Whether interpolating samples |a| and |b| reproduces |mid| to within
+// |posTolerance|, and the orientation to within what quantizing it
+// leaves of the budget.
+static bool sInterpolates(const AnimationTracks::Sample &a,
+                          const AnimationTracks::Sample &b,
+                          const AnimationTracks::Sample &mid,
+                          float posTolerance) {
+    float t = (float) (mid.frame - a.frame) / (float) (b.frame - a.frame);
+
+    float dx = sLerp(a.pos.x, b.pos.x, t) - mid.pos.x;
+    float dy = sLerp(a.pos.y, b.pos.y, t) - mid.pos.y;
+    float dz = sLerp(a.pos.z, b.pos.z, t) - mid.pos.z;
+    if (dx * dx + dy * dy + dz * dz > posTolerance * posTolerance) return false;
+
+    quaternion q = qslerp(a.orientation, b.orientation, t);
+    float maxScale = std::max(fabsf(mid.scale.x), std::max(fabsf(mid.scale.y), fabsf(mid.scale.z)));
+    float maxAngle = std::max(0.0f, kPosTolerance / std::max(1.0f, maxScale) - kOrientationError);
+    // Compare the chord between the quaternions, which turns by about
+    // twice its length; 1 - qdot() is lost in float rounding at these
+    // angles.
+    float sign = qdot(q, mid.orientation) < 0.0f ? -1.0f : 1.0f;
+    float cx = q.x - sign * mid.orientation.x;
+    float cy = q.y - sign * mid.orientation.y;
+    float cz = q.z - sign * mid.orientation.z;
+    float cw = q.w - sign * mid.orientation.w;
+    if (cx * cx + cy * cy + cz * cz + cw * cw > maxAngle * maxAngle / 4.0f) return false;
+
+    float sx = sLerp(a.scale.x, b.scale.x, t) - mid.scale.x;
+    float sy = sLerp(a.scale.y, b.scale.y, t) - mid.scale.y;
+    float sz = sLerp(a.scale.z, b.scale.z, t) - mid.scale.z;
+    float scaleTol = kScaleTolerance * std::max(1.0f, maxScale);
+    return fabsf(sx) <= scaleTol && fabsf(sy) <= scaleTol && fabsf(sz) <= scaleTol;
+}
+
+static float sPosStep(int16_t posShift) {
+    return ldexpf(kMinPosStep, posShift);
+}
+
+static float sMaxAxisDelta(const AnimationTracks::Sample &a, const AnimationTracks::Sample &b) {
+    return std::max(fabsf(b.pos.x - a.pos.x),
+                    std::max(fabsf(b.pos.y - a.pos.y), fabsf(b.pos.z - a.pos.z)));
+}
+
+// static
+AnimationTracks::Sample AnimationTracks::makeSample(uint32_t frame, entity_handle_t eid,
+                                                    const vector4 &pos, const vector4 &fwd,
+                                                    const vector4 &up, const vector4 &scale) {
+    Sample res;
+    res.frame = frame;
+    res.eid = eid;
+    res.pos = pos;
+    res.orientation = qfromframe(fwd, up);
+    res.scale = scale;
+    return res;
+}
+
+void AnimationTracks::addSample(const Sample &sample) {
+    if (sample.eid >= mBuilders.size())
+        mBuilders.resize(sample.eid + 1);
+    TrackBuilder &builder = mBuilders[sample.eid];
+    // Frames of an entity are expected in order; this one's already been
+    // compressed.
+    if (!builder.keys.empty() && sample.frame <= builder.lastKey.frame) {
+        mDroppedSamples++;
+        return;
+    }
+    builder.samples.push_back(sample);
+    mFrameCount = std::max(mFrameCount, sample.frame + 1);
+    mSampleCount++;
+    if (++mPendingSamples - mPendingKept >= kMaxPendingSamples) {
+        compressPending(false);
+    }
+}
+
+void AnimationTracks::addSamples(const std::vector<Sample> &samples) {
+    for (const auto &sample : samples) {
+        addSample(sample);
+    }
+}
+
+AnimationTracks::~AnimationTracks() {
+    stopStreaming();
+}
+
+size_t AnimationTracks::compressedBytes() const {
+    return mTracks.size() * sizeof(Track) + mKeyCount * sizeof(Key);
+}
+
+void AnimationTracks::build() {
+    compressPending(true);
+
+    size_t keyCount = 0;
+    for (const auto &builder : mBuilders) {
+        keyCount += builder.keys.size();
+    }
+    mKeyStorage.reserve(keyCount);
+    for (entity_handle_t eid = 0; eid < mBuilders.size(); eid++) {
+        TrackBuilder &builder = mBuilders[eid];
+        if (builder.keys.empty()) continue;
+
+        Track track;
+        track.eid = eid;
+        track.firstKey = (uint32_t) mKeyStorage.size();
+        track.keyCount = (uint32_t) builder.keys.size();
+        for (int c = 0; c < 3; c++) {
+            track.basePos[c] = builder.basePos[c];
+        }
+        track.cursor = 0;
+        mTracks.push_back(track);
+
+        mKeyStorage.insert(mKeyStorage.end(), builder.keys.begin(), builder.keys.end());
+        std::vector<Key>().swap(builder.keys);
+    }
+    std::vector<TrackBuilder>().swap(mBuilders);
+    mKeys = mKeyStorage.data();
+    mKeyCount = mKeyStorage.size();
+
+    for (int c = 0; c < kChannels; c++) {
+        mSegmentA[c].resize(mTracks.size());
+        mSegmentB[c].resize(mTracks.size());
+        mOut[c].resize(mTracks.size());
+    }
+    mT.resize(mTracks.size());
+    mSlerpA.resize(mTracks.size());
+    mSlerpB.resize(mTracks.size());
+    mActive.resize(mTracks.size());
+    mHeld.resize(mTracks.size());
+    mSettled.resize(mTracks.size());
+
+    for (size_t i = 0; i < mTracks.size(); i++) {
+        resetCursor(i);
+    }
+
+    if (mDroppedSamples) {
+        LOGE("%s: dropped %zu samples that came after later frames of their entity", __func__,
+             mDroppedSamples);
+    }
+    // Raw poses were an entity handle plus four vector4s per sample.
+    LOGD("%s: %zu samples -> %zu tracks, %zu keys, %zu bytes (raw poses: %zu bytes)", __func__,
+         mSampleCount, mTracks.size(), mKeyCount, compressedBytes(),
+         mSampleCount * (sizeof(entity_handle_t) + 4 * sizeof(vector4)));
+}
+
+std::vector<entity_handle_t> AnimationTracks::animatedEntities() const {
+    std::vector<entity_handle_t> res;
+    for (const auto &track : mTracks) {
+        res.push_back(track.eid);
+    }
+    return res;
+}
+
+// Compresses the pending samples of every track. Unless |all|, each
+// track keeps the samples of its latest frame, which a later sample may
+// still replace.
+void AnimationTracks::compressPending(bool all) {
+    std::vector<Sample> chunk;
+    mPendingSamples = 0;
+    for (auto &builder : mBuilders) {
+        std::vector<Sample> &samples = builder.samples;
+        if (samples.empty()) continue;
+        std::stable_sort(samples.begin(), samples.end(),
+                         [](const Sample &a, const Sample &b) { return a.frame < b.frame; });
+
+        size_t count = samples.size();
+        while (!all && count && samples[count - 1].frame == samples.back().frame) {
+            count--;
+        }
+        if (count) {
+            chunk.assign(samples.begin(), samples.begin() + count);
+            std::vector<Sample>(samples.begin() + count, samples.end()).swap(samples);
+            compressChunk(builder, chunk);
+        }
+        mPendingSamples += samples.size();
+    }
+    mPendingKept = mPendingSamples;
+}
+
+// Appends keys for |samples|, which are sorted by frame and all later
+// than the last key of |builder|.
+void AnimationTracks::compressChunk(TrackBuilder &builder, const std::vector<Sample> &samples) {
+    bool started = !builder.keys.empty();
+
+    // Resample to one sample per frame, continuing from the last key.
+    // A later sample for the same frame wins, and frames without one
+    // hold the previous pose, which is what applying raw frames one
+    // after another used to do.
+    std::vector<Sample> dense;
+    dense.reserve(samples.back().frame - samples.front().frame + 2);
+    if (started) dense.push_back(builder.lastKey);
+    for (const auto &sample : samples) {
+        if (!dense.empty() && dense.back().frame == sample.frame) {
+            dense.back() = sample;
+            continue;
+        }
+        while (!dense.empty() && dense.back().frame + 1 < sample.frame) {
+            Sample held = dense.back();
+            held.frame++;
+            dense.push_back(held);
+        }
+        dense.push_back(sample);
+    }
+
+    // Keep neighboring quaternions in the same hemisphere so that
+    // interpolating between keys takes the short way around.
+    for (size_t i = 1; i < dense.size(); i++) {
+        if (qdot(dense[i - 1].orientation, dense[i].orientation) < 0.0f) {
+            quaternion &q = dense[i].orientation;
+            q = makequaternion(-q.x, -q.y, -q.z, -q.w);
+        }
+    }
+
+    // The position step is settled before reduction, so that its error
+    // can come out of the budget: the finest step whose deltas reach
+    // from one frame to the next. It never shrinks along a track, so
+    // the rounding carried from the last key is within half of it. Keys
+    // are then kept close enough together for their deltas to fit.
+    float maxFrameDelta = 0.0f;
+    for (size_t i = 1; i < dense.size(); i++) {
+        maxFrameDelta = std::max(maxFrameDelta, sMaxAxisDelta(dense[i - 1], dense[i]));
+    }
+    int16_t posShift = builder.posShift;
+    while (sPosStep(posShift) * kMaxPosDelta < maxFrameDelta) {
+        posShift++;
+    }
+    float posStep = sPosStep(posShift);
+    float maxKeyDelta = kMaxPosDelta * posStep;
+    // Each axis rounds to within half a step.
+    float posTolerance = std::max(0.0f, kPosTolerance - posStep * sqrtf(3.0f) / 2.0f);
+
+    // Greedy keyframe reduction: extend each segment for as long as
+    // linear interpolation across it stays within tolerance.
+    std::vector<size_t> keys;
+    keys.push_back(0);
+    size_t start = 0;
+    while (start + 1 < dense.size()) {
+        size_t end = start + 1;
+        while (end + 1 < dense.size() && end + 1 - start <= kMaxKeySpan &&
+               sMaxAxisDelta(dense[start], dense[end + 1]) <= maxKeyDelta) {
+            bool ok = true;
+            for (size_t i = start + 1; i <= end && ok; i++) {
+                ok = sInterpolates(dense[start], dense[end + 1], dense[i], posTolerance);
+            }
+            if (!ok) break;
+            end++;
+        }
+        keys.push_back(end);
+        start = end;
+    }
+
+    if (!started) {
+        builder.basePos[0] = builder.recon[0] = dense[0].pos.x;
+        builder.basePos[1] = builder.recon[1] = dense[0].pos.y;
+        builder.basePos[2] = builder.recon[2] = dense[0].pos.z;
+    }
+
+    // Deltas are taken from the reconstructed previous key, so
+    // quantization error does not build up along the track. The first
+    // dense sample of a continued track is its last key already.
+    float invStep = 1.0f / posStep;
+    for (size_t i = started ? 1 : 0; i < keys.size(); i++) {
+        const Sample &s = dense[keys[i]];
+        const float target[3] = {s.pos.x, s.pos.y, s.pos.z};
+
+        Key k;
+        k.frame = s.frame;
+        for (int c = 0; c < 3; c++) {
+            k.posDelta[c] = sQuantize(target[c] - builder.recon[c], invStep);
+            builder.recon[c] += k.posDelta[c] * posStep;
+        }
+        k.posShift = posShift;
+
+        k.orientation[0] = sQuantize(s.orientation.x, kOrientationScale);
+        k.orientation[1] = sQuantize(s.orientation.y, kOrientationScale);
+        k.orientation[2] = sQuantize(s.orientation.z, kOrientationScale);
+        k.orientation[3] = sQuantize(s.orientation.w, kOrientationScale);
+
+        k.scale[0] = s.scale.x;
+        k.scale[1] = s.scale.y;
+        k.scale[2] = s.scale.z;
+        builder.keys.push_back(k);
+    }
+
+    builder.lastKey = dense.back();
+    builder.posShift = posShift;
+}
+
+void AnimationTracks::resetCursor(size_t trackIndex) {
+    Track &track = mTracks[trackIndex];
+    track.cursor = 0;
+    const Key &key = mKeys[track.firstKey];
+    float posStep = sPosStep(key.posShift);
+    for (int c = 0; c < 3; c++) {
+        track.cursorPos[c] = track.basePos[c] + key.posDelta[c] * posStep;
+    }
+    loadSegment(trackIndex);
+}
+
+void AnimationTracks::advanceCursor(size_t trackIndex) {
+    Track &track = mTracks[trackIndex];
+    track.cursor++;
+    const Key &key = mKeys[track.firstKey + track.cursor];
+    float posStep = sPosStep(key.posShift);
+    for (int c = 0; c < 3; c++) {
+        track.cursorPos[c] += key.posDelta[c] * posStep;
+    }
+    loadSegment(trackIndex);
+}
+
+void AnimationTracks::loadSegment(size_t trackIndex) {
+    const Track &track = mTracks[trackIndex];
+    const Key &keyA = mKeys[track.firstKey + track.cursor];
+    bool last = track.cursor + 1 == track.keyCount;
+    const Key &keyB = last ? keyA : mKeys[track.firstKey + track.cursor + 1];
+
+    float posStepB = sPosStep(keyB.posShift);
+    for (int c = 0; c < 3; c++) {
+        mSegmentA[kPosX + c][trackIndex] = track.cursorPos[c];
+        mSegmentB[kPosX + c][trackIndex] =
+                last ? track.cursorPos[c] : track.cursorPos[c] + keyB.posDelta[c] * posStepB;
+    }
+
+    for (int c = 0; c < 4; c++) {
+        mSegmentA[kRotX + c][trackIndex] = keyA.orientation[c] / kOrientationScale;
+        mSegmentB[kRotX + c][trackIndex] = keyB.orientation[c] / kOrientationScale;
+    }
+
+    for (int c = 0; c < 3; c++) {
+        mSegmentA[kScaleX + c][trackIndex] = keyA.scale[c];
+        mSegmentB[kScaleX + c][trackIndex] = keyB.scale[c];
+    }
+
+    bool held = true;
+    for (int c = 0; c < kChannels; c++) {
+        held = held && mSegmentA[c][trackIndex] == mSegmentB[c][trackIndex];
+    }
+    mHeld[trackIndex] = held;
+    mSettled[trackIndex] = 0;
+}
+
+bool AnimationTracks::streamFromFile(const std::string &path) {
+    if (streaming() || !mKeyCount) return false;
+
+    StreamHeader header;
+    memcpy(header.magic, kStreamMagic, sizeof(kStreamMagic));
+    header.version = kStreamVersion;
+    header.keyCount = (uint32_t) mKeyCount;
+    header.keySize = (uint32_t) sizeof(Key);
+
+    FILE *fh = fopen(path.c_str(), "wb");
+    if (!fh) {
+        LOGE("%s: can't create %s", __func__, path.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, fh) == 1 &&
+                   fwrite(mKeys, sizeof(Key), mKeyCount, fh) == mKeyCount;
+    written = !fclose(fh) && written;
+    if (!written) {
+        LOGE("%s: can't write %s", __func__, path.c_str());
+        unlink(path.c_str());
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    // The mapping keeps the data alive; don't leave files behind.
+    unlink(path.c_str());
+    if (fd < 0) {
+        LOGE("%s: can't open %s", __func__, path.c_str());
+        return false;
+    }
+    size_t bytes = sizeof(header) + mKeyCount * sizeof(Key);
+    void *mapping = mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        LOGE("%s: can't map %s", __func__, path.c_str());
+        return false;
+    }
+
+    const StreamHeader *mapped = (const StreamHeader *) mapping;
+    if (memcmp(mapped->magic, kStreamMagic, sizeof(kStreamMagic)) ||
+        mapped->version != kStreamVersion ||
+        mapped->keyCount != mKeyCount ||
+        mapped->keySize != sizeof(Key)) {
+        LOGE("%s: %s doesn't read back", __func__, path.c_str());
+        munmap(mapping, bytes);
+        return false;
+    }
+
+    // Paging is driven by the prefetch thread; don't read ahead blindly.
+    madvise(mapping, bytes, MADV_RANDOM);
+
+    mMapping = mapping;
+    mMappingBytes = bytes;
+    mKeys = (const Key *) (mapped + 1);
+    std::vector<Key>().swap(mKeyStorage);
+
+    prefetchWindow(0.0f);
+    mLastPrefetchRequest = 0.0f;
+    mPrefetchStop = false;
+    mPrefetchThread = std::thread(&AnimationTracks::prefetchLoop, this);
+
+    LOGD("%s: %zu keys, %zu bytes mapped from %s", __func__,
+         mKeyCount, bytes, path.c_str());
+    return true;
+}
+
+void AnimationTracks::stopStreaming() {
+    if (!streaming()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mPrefetchLock);
+        mPrefetchStop = true;
+    }
+    mPrefetchCond.notify_one();
+    mPrefetchThread.join();
+
+    munmap(mMapping, mMappingBytes);
+    mMapping = nullptr;
+    mMappingBytes = 0;
+    mKeys = nullptr;
+    mKeyCount = 0;
+}
+
+void AnimationTracks::requestPrefetch(float frame) {
+    if (frame >= mLastPrefetchRequest &&
+        frame < mLastPrefetchRequest + kPrefetchStepFrames) {
+        return;
+    }
+    mLastPrefetchRequest = frame;
+
+    {
+        std::lock_guard<std::mutex> lock(mPrefetchLock);
+        mPrefetchFrame = frame;
+        mPrefetchPending = true;
+    }
+    mPrefetchCond.notify_one();
+}
+
+void AnimationTracks::prefetchLoop() {
+    std::unique_lock<std::mutex> lock(mPrefetchLock);
+    while (true) {
+        mPrefetchCond.wait(lock, [this] { return mPrefetchStop || mPrefetchPending; });
+        if (mPrefetchStop) return;
+
+        float frame = mPrefetchFrame;
+        mPrefetchPending = false;
+        lock.unlock();
+        prefetchWindow(frame);
+        lock.lock();
+    }
+}
+
+// Pages in the keys each track needs from |frame| to the end of the
+// window and drops whole pages of keys before the one playing at |frame|.
+void AnimationTracks::prefetchWindow(float frame) {
+    const uintptr_t pageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t mappingBegin = (uintptr_t) mMapping;
+    const uintptr_t mappingEnd = mappingBegin + mMappingBytes;
+    volatile uint8_t sink = 0;
+
+    for (const auto &track : mTracks) {
+        const Key *keys = mKeys + track.firstKey;
+        const Key *keysEnd = keys + track.keyCount;
+
+        const Key *current = std::upper_bound(
+                keys, keysEnd, frame,
+                [](float f, const Key &k) { return f < (float) k.frame; });
+        if (current != keys) current--;
+        const Key *windowEnd = std::lower_bound(
+                current, keysEnd, frame + kStreamWindowFrames,
+                [](const Key &k, float f) { return (float) k.frame < f; });
+        if (windowEnd != keysEnd) windowEnd++;
+
+        uintptr_t begin = (uintptr_t) current & ~(pageSize - 1);
+        uintptr_t end = std::min(mappingEnd,
+                                 ((uintptr_t) windowEnd + pageSize - 1) & ~(pageSize - 1));
+        madvise((void *) begin, end - begin, MADV_WILLNEED);
+        for (uintptr_t page = begin; page < end; page += pageSize) {
+            sink += *(const uint8_t *) page;
+        }
+
+        // Only pages that hold nothing but this track's played keys.
+        uintptr_t releaseBegin = ((uintptr_t) keys + pageSize - 1) & ~(pageSize - 1);
+        uintptr_t releaseEnd = (uintptr_t) current & ~(pageSize - 1);
+        if (releaseBegin < releaseEnd) {
+            madvise((void *) releaseBegin, releaseEnd - releaseBegin, MADV_DONTNEED);
+        }
+    }
+    (void) sink;
+}
+
+void AnimationTracks::applyAt(float frame, EntityStore &entities) {
+    size_t trackCount = mTracks.size();
+
+    if (streaming()) requestPrefetch(frame);
+
+    // Move cursors. Playing forward this is usually a no-op per track.
+    for (size_t i = 0; i < trackCount; i++) {
+        Track &track = mTracks[i];
+        const Key *keys = &mKeys[track.firstKey];
+
+        if (frame < (float) keys[0].frame) {
+            mActive[i] = 0;
+            mSettled[i] = 0;
+            mT[i] = 0.0f;
+            continue;
+        }
+
+        if (frame < (float) keys[track.cursor].frame) {
+            resetCursor(i);
+        }
+        while (track.cursor + 1 < track.keyCount &&
+               (float) keys[track.cursor + 1].frame <= frame) {
+            advanceCursor(i);
+        }
+
+        mActive[i] = 1;
+        if (track.cursor + 1 < track.keyCount) {
+            float a = (float) keys[track.cursor].frame;
+            float b = (float) keys[track.cursor + 1].frame;
+            mT[i] = (frame - a) / (b - a);
+        } else {
+            mT[i] = 0.0f;
+        }
+    }
+
+    // Lerp position and scale of all tracks.
+    const float *t = mT.data();
+    static const int kLerpChannels[] = {
+            kPosX, kPosY, kPosZ, kScaleX, kScaleY, kScaleZ,
+    };
+    for (int c : kLerpChannels) {
+        const float *a = mSegmentA[c].data();
+        const float *b = mSegmentB[c].data();
+        float *out = mOut[c].data();
+        for (size_t i = 0; i < trackCount; i++) {
+            out[i] = a[i] + (b[i] - a[i]) * t[i];
+        }
+    }
+
+    // Slerp orientation. Keys of a track are in the same hemisphere, so
+    // the angle between segment endpoints is never the long way around.
+    float *wa = mSlerpA.data();
+    float *wb = mSlerpB.data();
+    for (size_t i = 0; i < trackCount; i++) {
+        float cosAngle = 0.0f;
+        for (int c = kRotX; c <= kRotW; c++) {
+            cosAngle += mSegmentA[c][i] * mSegmentB[c][i];
+        }
+        qslerpweights(cosAngle, t[i], &wa[i], &wb[i]);
+    }
+    for (int c = kRotX; c <= kRotW; c++) {
+        const float *a = mSegmentA[c].data();
+        const float *b = mSegmentB[c].data();
+        float *out = mOut[c].data();
+        for (size_t i = 0; i < trackCount; i++) {
+            out[i] = wa[i] * a[i] + wb[i] * b[i];
+        }
+    }
+
+    // Keys are quantized, so renormalize.
+    float *qx = mOut[kRotX].data();
+    float *qy = mOut[kRotY].data();
+    float *qz = mOut[kRotZ].data();
+    float *qw = mOut[kRotW].data();
+    for (size_t i = 0; i < trackCount; i++) {
+        float invLen = 1.0f / sqrtf(qx[i] * qx[i] + qy[i] * qy[i] + qz[i] * qz[i] + qw[i] * qw[i]);
+        qx[i] *= invLen;
+        qy[i] *= invLen;
+        qz[i] *= invLen;
+        qw[i] *= invLen;
+    }
+
+    for (size_t i = 0; i < trackCount; i++) {
+        if (!mActive[i] || mSettled[i]) continue;
+        entity_handle_t eid = mTracks[i].eid;
+        if (!entities.valid(eid)) continue;
+        mSettled[i] = mHeld[i];
+
+        entities.setFrame(eid,
+                          makevector4(mOut[kPosX][i], mOut[kPosY][i], mOut[kPosZ][i], 1.0f),
+                          makequaternion(qx[i], qy[i], qz[i], qw[i]));
+        size_t index = entities.indexOf(eid);
+        entities.scaleX[index] = mOut[kScaleX][i];
+        entities.scaleY[index] = mOut[kScaleY][i];
+        entities.scaleZ[index] = mOut[kScaleZ][i];
+    }
+}
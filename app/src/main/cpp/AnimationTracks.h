@@ -0,0 +1,199 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_ANIMATIONTRACKS_H
+#define GPU_EMULATION_STRESS_TEST_ANIMATIONTRACKS_H
+
+#include "EntityStore.h"
+#include "matrix.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef uint32_t entity_handle_t;
+
+// Per-entity animation tracks in a compact form. Samples are collected
+// at load time with addSample(), compressed a bounded chunk at a time
+// as they come in, and finished by build():
+// - keyframes are dropped wherever interpolating their neighbors stays
+//   within tolerance,
+// - orientation is a quantized quaternion instead of fwd/up vectors,
+// - positions are quantized deltas from the previous keyframe.
+// Decoding keeps a cursor per track, so playing forward only touches
+// the few keys around the current frame.
+class AnimationTracks {
+public:
+    struct Sample {
+        uint32_t frame;
+        entity_handle_t eid;
+        vector4 pos;
+        quaternion orientation;
+        vector4 scale;
+    };
+
+    AnimationTracks() = default;
+
+    ~AnimationTracks();
+
+    static Sample makeSample(uint32_t frame, entity_handle_t eid,
+                             const vector4 &pos, const vector4 &fwd,
+                             const vector4 &up, const vector4 &scale);
+
+    void addSample(const Sample &sample);
+
+    void addSamples(const std::vector<Sample> &samples);
+
+    // Compresses whatever is still pending and lays out the tracks.
+    // Samples of an entity are expected in frame order; one for a frame
+    // that's already been compressed is dropped.
+    void build();
+
+    // One past the last frame that has a sample.
+    uint32_t frameCount() const { return mFrameCount; }
+
+    size_t trackCount() const { return mTracks.size(); }
+
+    // Entities with a track.
+    std::vector<entity_handle_t> animatedEntities() const;
+
+    size_t keyCount() const { return mKeyCount; }
+
+    size_t compressedBytes() const;
+
+    // Moves the built keys out to a file at |path| and maps it back, so
+    // that only the keys around the playhead stay resident. A background
+    // thread pages in keys a window ahead of applyAt() and drops the
+    // ones already played. Keeps the keys in memory and returns false
+    // if the file can't be written or mapped.
+    bool streamFromFile(const std::string &path);
+
+    bool streaming() const { return mMapping != nullptr; }
+
+    // Sets the pose of every entity with a track that has started
+    // by |frame|. |frame| may fall between keys and between authored
+    // frames; position and scale are lerped, orientation slerped.
+    // Entities holding a pose they already have are left untouched.
+    void applyAt(float frame, EntityStore &entities);
+
+private:
+    struct Key {
+        uint32_t frame;
+        // In steps of kMinPosStep << |posShift|.
+        int16_t posDelta[3];
+        int16_t posShift;
+        int16_t orientation[4];
+        float scale[3];
+    };
+
+    struct Track {
+        entity_handle_t eid;
+        uint32_t firstKey;
+        uint32_t keyCount;
+        float basePos[3];
+
+        // Decode cursor: |cursor| and |cursor| + 1 are the keys decoded
+        // into the segment arrays below.
+        uint32_t cursor;
+        float cursorPos[3];
+    };
+
+    // A track still taking samples.
+    struct TrackBuilder {
+        std::vector<Sample> samples;
+        std::vector<Key> keys;
+        // The last key as sampled, which the next chunk continues from,
+        // and its position as decoding will reconstruct it.
+        Sample lastKey;
+        float recon[3];
+        float basePos[3];
+        int16_t posShift = 0;
+    };
+
+    void compressPending(bool all);
+
+    void compressChunk(TrackBuilder &builder, const std::vector<Sample> &samples);
+
+    void resetCursor(size_t trackIndex);
+
+    void advanceCursor(size_t trackIndex);
+
+    void loadSegment(size_t trackIndex);
+
+    void requestPrefetch(float frame);
+
+    void prefetchLoop();
+
+    void prefetchWindow(float frame);
+
+    void stopStreaming();
+
+    uint32_t mFrameCount = 0;
+
+    // Indexed by entity, until build().
+    std::vector<TrackBuilder> mBuilders;
+    size_t mPendingSamples = 0;
+    // What compressPending() left behind.
+    size_t mPendingKept = 0;
+    size_t mSampleCount = 0;
+    size_t mDroppedSamples = 0;
+
+    std::vector<Track> mTracks;
+
+    // Keyframes of all tracks, each track's keys contiguous. |mKeys|
+    // points into |mKeyStorage| or, when streaming, into the mapping.
+    const Key *mKeys = nullptr;
+    size_t mKeyCount = 0;
+    std::vector<Key> mKeyStorage;
+
+    // Streaming. The prefetch thread only reads the key mapping and the
+    // immutable parts of |mTracks|.
+    void *mMapping = nullptr;
+    size_t mMappingBytes = 0;
+    std::thread mPrefetchThread;
+    std::mutex mPrefetchLock;
+    std::condition_variable mPrefetchCond;
+    bool mPrefetchStop = false;
+    bool mPrefetchPending = false;
+    float mPrefetchFrame = 0.0f;
+    float mLastPrefetchRequest = 0.0f;
+
+    // Decoded segment endpoints per track, structure of arrays so that
+    // interpolating every track is a straight vectorizable loop.
+    enum {
+        kPosX, kPosY, kPosZ,
+        kRotX, kRotY, kRotZ, kRotW,
+        kScaleX, kScaleY, kScaleZ,
+        kChannels,
+    };
+    std::vector<float> mSegmentA[kChannels];
+    std::vector<float> mSegmentB[kChannels];
+    std::vector<float> mT;
+    std::vector<float> mSlerpA;
+    std::vector<float> mSlerpB;
+    std::vector<uint8_t> mActive;
+    // The segment holds one pose, and |mSettled| once that pose has
+    // been written; settled tracks are skipped so their entities stay
+    // clean.
+    std::vector<uint8_t> mHeld;
+    std::vector<uint8_t> mSettled;
+    std::vector<float> mOut[kChannels];
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_ANIMATIONTRACKS_H
@@ -0,0 +1,154 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "AssetPack.h"
+
+#include "log.h"
+
+#include <string.h>
+
+static const char kPackMagic[4] = {'G', 'S', 'A', 'P'};
+static const uint32_t kPackVersion = 1;
+
+static const size_t kLz4MinMatch = 4;
+
+bool AssetPack::open(const void *data, size_t size) {
+    mData = nullptr;
+    mSize = 0;
+    mEntries.clear();
+
+    Header header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, kPackMagic, sizeof(kPackMagic)) ||
+        header.version != kPackVersion) {
+        LOGE("%s: not an asset pack", __func__);
+        return false;
+    }
+
+    // Sizes are checked against what is left, so that corrupt ones can't
+    // wrap around.
+    const unsigned char *bytes = (const unsigned char *) data;
+    if (header.entryCount > (size - sizeof(header)) / sizeof(Entry)) {
+        LOGE("%s: truncated table of contents", __func__);
+        return false;
+    }
+    size_t entriesEnd = sizeof(header) + (size_t) header.entryCount * sizeof(Entry);
+    if (header.namesSize > size - entriesEnd) {
+        LOGE("%s: truncated table of contents", __func__);
+        return false;
+    }
+    const char *names = (const char *) bytes + entriesEnd;
+
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        Entry entry;
+        memcpy(&entry, bytes + sizeof(header) + i * sizeof(Entry), sizeof(entry));
+        if (entry.offset > size || entry.storedSize > size - entry.offset ||
+            entry.nameOffset > header.namesSize ||
+            entry.nameLength > header.namesSize - entry.nameOffset) {
+            LOGE("%s: entry %u out of bounds", __func__, i);
+            mEntries.clear();
+            return false;
+        }
+        mEntries[std::string(names + entry.nameOffset, entry.nameLength)] = entry;
+    }
+
+    mData = bytes;
+    mSize = size;
+    return true;
+}
+
+bool AssetPack::read(const std::string &name, std::vector<unsigned char> &out) const {
+    auto it = mEntries.find(name);
+    if (it == mEntries.end()) return false;
+
+    const Entry &entry = it->second;
+    const unsigned char *stored = mData + entry.offset;
+
+    out.resize((size_t) entry.size + 1);
+    if (entry.flags & kEntryLz4) {
+        if (!lz4Decompress(stored, entry.storedSize, out.data(), entry.size)) {
+            LOGE("%s: %s doesn't decompress", __func__, name.c_str());
+            out.clear();
+            return false;
+        }
+    } else {
+        if (entry.storedSize != entry.size) return false;
+        memcpy(out.data(), stored, entry.size);
+    }
+    out[entry.size] = 0;
+    return true;
+}
+
+// LZ4 block format: sequences of a token (literal length, match length),
+// literals, a 16-bit match offset and optional length extension bytes.
+// The last sequence has literals only. Everything is bounds checked.
+// static
+bool AssetPack::lz4Decompress(const unsigned char *src, size_t srcSize,
+                              unsigned char *dst, size_t dstSize) {
+    const unsigned char *ip = src;
+    const unsigned char *const ipEnd = src + srcSize;
+    unsigned char *op = dst;
+    unsigned char *const opEnd = dst + dstSize;
+
+    while (ip < ipEnd) {
+        unsigned token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            unsigned char b;
+            do {
+                if (ip >= ipEnd) return false;
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if ((size_t) (ipEnd - ip) < literals || (size_t) (opEnd - op) < literals) return false;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == ipEnd) break;
+
+        if (ipEnd - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t) (op - dst)) return false;
+
+        size_t match = token & 15;
+        if (match == 15) {
+            unsigned char b;
+            do {
+                if (ip >= ipEnd) return false;
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+        match += kLz4MinMatch;
+        if ((size_t) (opEnd - op) < match) return false;
+
+        // Matches may overlap their own output, so copy forwards.
+        const unsigned char *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            for (size_t i = 0; i < match; i++) *op++ = *ref++;
+        }
+    }
+
+    return op == opEnd;
+}
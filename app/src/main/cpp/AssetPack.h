@@ -0,0 +1,78 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_ASSETPACK_H
+#define GPU_EMULATION_STRESS_TEST_ASSETPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Read side of the archive written by tools/make_asset_pack.py: a
+// header, a table of entries, a name table, then the blobs, each at a
+// multiple of the pack alignment. Entries are stored raw or as LZ4
+// blocks. The pack is used in place, so it can be a mapping of the APK.
+class AssetPack {
+public:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entryCount;
+        uint32_t namesSize;
+        uint32_t alignment;
+        uint32_t reserved[3];
+    };
+
+    struct Entry {
+        uint64_t offset;
+        uint32_t storedSize;
+        uint32_t size;
+        uint32_t flags;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint32_t reserved;
+    };
+
+    enum {
+        kEntryLz4 = 1 << 0,
+    };
+
+    AssetPack() = default;
+
+    // |data| must stay valid while the pack is in use.
+    bool open(const void *data, size_t size);
+
+    bool isOpen() const { return mData != nullptr; }
+
+    size_t entryCount() const { return mEntries.size(); }
+
+    // Returns false if there is no such entry or it doesn't decode. On
+    // success |out| holds the contents followed by a NUL, the same as
+    // FileLoader::loadFileFromAssets.
+    bool read(const std::string &name, std::vector<unsigned char> &out) const;
+
+    static bool lz4Decompress(const unsigned char *src, size_t srcSize,
+                              unsigned char *dst, size_t dstSize);
+
+private:
+    const unsigned char *mData = nullptr;
+    size_t mSize = 0;
+    std::unordered_map<std::string, Entry> mEntries;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_ASSETPACK_H
@@ -0,0 +1,134 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "AssetRegistry.h"
+
+#include "FileLoader.h"
+#include "MeshSimplifier.h"
+#include "TextureLoader.h"
+#include "log.h"
+
+#include <cstring>
+
+static AssetRegistry *sAssetRegistry = nullptr;
+
+// static
+AssetRegistry *AssetRegistry::get() {
+    if (!sAssetRegistry) sAssetRegistry = new AssetRegistry;
+    return sAssetRegistry;
+}
+
+// 64-bit FNV-1a over the bytes, with the length folded in.
+// static
+uint64_t AssetRegistry::contentHash(const std::vector<unsigned char> &contents) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : contents) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= (uint64_t) contents.size();
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+// Ids start at the hash. Contents compare equal when the sizes do and
+// the bytes of the file the id was first handed out for, read again,
+// do; files never change, so the same file always matches.
+uint64_t AssetRegistry::contentId(uint64_t hash, const std::string &source, bool isFile,
+                                  const std::vector<unsigned char> *contents) {
+    size_t size = contents ? contents->size() : 0;
+    for (uint64_t id = hash;; id++) {
+        auto it = mContents.find(id);
+        if (it == mContents.end()) {
+            mContents[id] = Content{source, isFile, size};
+            return id;
+        }
+
+        const Content &content = it->second;
+        if (content.isFile == isFile && content.size == size) {
+            if (content.source == source) return id;
+            if (isFile && FileLoader::get()->loadFileFromAssets(content.source) == *contents) {
+                return id;
+            }
+        }
+        LOGD("%s: %s has the same hash as %s", __func__, source.c_str(),
+             content.source.c_str());
+    }
+}
+
+std::shared_ptr<const OBJParse> AssetRegistry::loadMesh(const std::string &filename,
+                                                        uint64_t &hash) {
+    std::vector<unsigned char> contents = FileLoader::get()->loadFileFromAssets(filename);
+    hash = contentId(contentHash(contents), filename, true, &contents);
+
+    std::shared_ptr<const OBJParse> res = mMeshes[hash].lock();
+    if (res) {
+        LOGV("%s: %s shares an already loaded mesh", __func__, filename.c_str());
+        return res;
+    }
+
+    std::shared_ptr<OBJParse> mesh = std::make_shared<OBJParse>(contents);
+    mesh->releaseParseData();
+    mMeshes[hash] = mesh;
+    return mesh;
+}
+
+std::shared_ptr<const OBJParse> AssetRegistry::loadSimplifiedMesh(const std::string &filename,
+                                                                  float ratio, uint64_t &hash) {
+    uint64_t sourceHash;
+    std::shared_ptr<const OBJParse> source = loadMesh(filename, sourceHash);
+
+    // Continues the FNV-1a of the source with the bytes of |ratio|.
+    uint32_t ratioBits;
+    memcpy(&ratioBits, &ratio, sizeof(ratioBits));
+    hash = sourceHash;
+    for (int i = 0; i < 4; i++) {
+        hash ^= (ratioBits >> (8 * i)) & 0xff;
+        hash *= 1099511628211ULL;
+    }
+    // The source's id is unique, so it and the ratio tell what this is.
+    hash = contentId(hash, std::to_string(sourceHash) + "@" + std::to_string(ratioBits), false,
+                     nullptr);
+
+    std::shared_ptr<const OBJParse> res = mMeshes[hash].lock();
+    if (res) return res;
+
+    MeshSimplifier simplifier(*source);
+    simplifier.simplify((size_t) (ratio * (source->indexData.size() / 3)));
+    std::shared_ptr<OBJParse> mesh = std::make_shared<OBJParse>();
+    simplifier.write(*mesh);
+    mMeshes[hash] = mesh;
+    return mesh;
+}
+
+std::shared_ptr<const AssetRegistry::Texture> AssetRegistry::loadTexture(
+        const std::string &filename, uint64_t &hash) {
+    std::vector<unsigned char> contents = FileLoader::get()->loadFileFromAssets(filename);
+    hash = contentId(contentHash(contents), filename, true, &contents);
+
+    std::shared_ptr<const Texture> res = mTextures[hash].lock();
+    if (res) {
+        LOGV("%s: %s shares an already decoded texture", __func__, filename.c_str());
+        return res;
+    }
+
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>();
+    texture->rgba8 = TextureLoader::get()->decodePNGAsRGBA8(contents,
+                                                            texture->width,
+                                                            texture->height);
+    mTextures[hash] = texture;
+    return texture;
+}
@@ -0,0 +1,75 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_ASSETREGISTRY_H
+#define GPU_EMULATION_STRESS_TEST_ASSETREGISTRY_H
+
+#include "OBJParse.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Meshes and textures keyed by a hash of their file contents. Assets
+// with identical bytes are parsed or decoded once and shared, whatever
+// file they came from. Entries live as long as some model holds them.
+// A hash only counts as a match once the bytes compare equal; contents
+// that collide with others get the next free id instead.
+class AssetRegistry {
+public:
+    struct Texture {
+        unsigned int width = 0;
+        unsigned int height = 0;
+        std::vector<unsigned char> rgba8;
+    };
+
+    AssetRegistry() = default;
+
+    static AssetRegistry *get();
+
+    static uint64_t contentHash(const std::vector<unsigned char> &contents);
+
+    // |hash| identifies the content, so renderers can share GL objects
+    // too. It is unique to the content for as long as the registry lives.
+    std::shared_ptr<const OBJParse> loadMesh(const std::string &filename, uint64_t &hash);
+
+    // The mesh in |filename| simplified to about |ratio| of its
+    // triangles, cached like the meshes themselves.
+    std::shared_ptr<const OBJParse> loadSimplifiedMesh(const std::string &filename, float ratio,
+                                                       uint64_t &hash);
+
+    std::shared_ptr<const Texture> loadTexture(const std::string &filename, uint64_t &hash);
+
+private:
+    // What an id was handed out for: the bytes of the file |source|, or
+    // for derived assets, the description in |source|.
+    struct Content {
+        std::string source;
+        bool isFile;
+        size_t size;
+    };
+
+    uint64_t contentId(uint64_t hash, const std::string &source, bool isFile,
+                       const std::vector<unsigned char> *contents);
+
+    std::unordered_map<uint64_t, Content> mContents;
+    std::unordered_map<uint64_t, std::weak_ptr<const OBJParse> > mMeshes;
+    std::unordered_map<uint64_t, std::weak_ptr<const Texture> > mTextures;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_ASSETREGISTRY_H
@@ -18,227 +18,304 @@
 
 #include "log.h"
 #include "math.h"
+#include "simd.h"
 
 #include <algorithm>
 #include <assert.h>
 
-void BezierCurve::evalSimple(float t, float *x_out, float *y_out, float *z_out) {
-    size_t pt = (size_t) (t * (mPoints.size() - 1));
-
-    assert(pt < mPoints.size());
-
-    float ts = t * (mPoints.size() - 1);
-    ts = ts - int(ts);
+// Parameters are looked up and evaluated in chunks of this many.
+static const size_t kBatchSize = 64;
 
-
-    evalElement(pt, ts, x_out, y_out, z_out);
+static inline float sEvalCoord(const BezierSegment &segment, int c, float t) {
+    const float *k = segment.coeffs[c];
+    return ((k[3] * t + k[2]) * t + k[1]) * t + k[0];
 }
 
-void BezierCurve::evalArclen(float t, float *x_out, float *y_out, float *z_out) {
-    evalSimple(arcLengthIndexed(t), x_out, y_out, z_out);
+// Coordinate |c| of four segments, each at its own lane of |t|.
+static inline float4 sEvalCoord4(const BezierSegment *const segments[4], int c, float4 t) {
+    float4 k0 = f4load(segments[0]->coeffs[c]);
+    float4 k1 = f4load(segments[1]->coeffs[c]);
+    float4 k2 = f4load(segments[2]->coeffs[c]);
+    float4 k3 = f4load(segments[3]->coeffs[c]);
+    // From one segment per vector to one power of t per vector.
+    f4transpose(k0, k1, k2, k3);
+    return ((k3 * t + k2) * t + k1) * t + k0;
 }
 
-void BezierCurve::evalElement(size_t pt, float t, float *x_out, float *y_out, float *z_out) {
-    const BezierPoint &a = mPoints[pt];
-    const BezierPoint &b = mPoints[pt + 1];
-
-    float TA = 1.0f - t;
-    float TA2 = TA * TA;
-    float TA3 = TA2 * TA;
-
-    float TB = t;
-    float TB2 = TB * TB;
-    float TB3 = TB2 * TB;
+size_t BezierCurve::segmentAt(float t, float *local) const {
+    assert(!mSegments.empty());
 
-    float c0 = TA3;
-    float c1 = 3.0f * TA2 * TB;
-    float c2 = 3.0f * TA * TB2;
-    float c3 = TB3;
-
-    *x_out = c0 * a.coord[0] +
-             c1 * a.right[0] +
-             c2 * b.left[0] +
-             c3 * b.coord[0];
-
-    *y_out = c0 * a.coord[1] +
-             c1 * a.right[1] +
-             c2 * b.left[1] +
-             c3 * b.coord[1];
-
-    *z_out = c0 * a.coord[2] +
-             c1 * a.right[2] +
-             c2 * b.left[2] +
-             c3 * b.coord[2];
+    float ts = t * (float) mSegments.size();
+    // t = 1 is the end of the last segment.
+    size_t pt = std::min((size_t) ts, mSegments.size() - 1);
+    *local = ts - (float) pt;
+    return pt;
 }
 
-static float segLength(float x1, float y1, float z1,
-                       float x2, float y2, float z2) {
-    float dx = x2 - x1;
-    float dy = y2 - y1;
-    float dz = z2 - z1;
-
-    float dx2 = dx * dx;
-    float dy2 = dy * dy;
-    float dz2 = dz * dz;
-
-    return sqrtf(dx2 + dy2 + dz2);
+void BezierCurve::evalSimple(float t, float *x_out, float *y_out, float *z_out) {
+    float local;
+    size_t pt = segmentAt(t, &local);
+    evalElement(pt, local, x_out, y_out, z_out);
 }
 
-static bool aboutEq(float x, float y) {
-    return fabs(x - y) < 0.1 * x;
+void BezierCurve::evalSimple(const float *t, size_t count,
+                             float *x_out, float *y_out, float *z_out) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float local[4];
+        const BezierSegment *segments[4];
+        for (int k = 0; k < 4; k++) {
+            segments[k] = &mSegments[segmentAt(t[i + k], &local[k])];
+        }
+        float4 t4 = f4load(local);
+        f4store(&x_out[i], sEvalCoord4(segments, 0, t4));
+        f4store(&y_out[i], sEvalCoord4(segments, 1, t4));
+        f4store(&z_out[i], sEvalCoord4(segments, 2, t4));
+    }
+    for (; i < count; i++) {
+        evalSimple(t[i], &x_out[i], &y_out[i], &z_out[i]);
+    }
 }
 
-void BezierCurve::precalcArclengths(int power) {
-    mPower = power;
-
-    int count = 1 << power;
-
-    float lastx, lasty, lastz;
-    float x, y, z;
-    float totalArc = 0.0f;
-
-    std::vector<float> rawLengths;
-    for (int i = 0; i < count; i++) {
-        if (i == 0) {
-            rawLengths.push_back(0.0f);
-            evalSimple(0.0f, &lastx, &lasty, &lastz);
-        } else {
-            evalSimple((float) i / ((float) count), &x, &y, &z);
-            float len = segLength(lastx, lasty, lastz,
-                                  x, y, z);
-            lastx = x;
-            lasty = y;
-            lastz = z;
+void BezierCurve::evalArclen(float t, float *x_out, float *y_out, float *z_out) {
+    evalSimple(arcLengthIndexed(t), x_out, y_out, z_out);
+}
 
-            totalArc += len;
-            float nextLen = len + rawLengths[i - 1];
-            if (i % 1000 == 0) {
-                LOGV("%s: nextLen %f", __func__, nextLen);
-            }
-            rawLengths.push_back(nextLen);
+void BezierCurve::evalArclen(const float *t, size_t count,
+                             float *x_out, float *y_out, float *z_out) {
+    float simple[kBatchSize];
+    for (size_t first = 0; first < count; first += kBatchSize) {
+        size_t n = std::min(count - first, kBatchSize);
+        for (size_t i = 0; i < n; i++) {
+            simple[i] = arcLengthIndexed(t[first + i]);
         }
+        evalSimple(simple, n, &x_out[first], &y_out[first], &z_out[first]);
     }
+}
 
-    LOGV("%s: total arc length %f", __func__, totalArc);
+void BezierCurve::evalElement(size_t pt, float t, float *x_out, float *y_out, float *z_out) {
+    const BezierSegment &segment = mSegments[pt];
+    *x_out = sEvalCoord(segment, 0, t);
+    *y_out = sEvalCoord(segment, 1, t);
+    *z_out = sEvalCoord(segment, 2, t);
+}
 
-    for (int i = 0; i < count; i++) {
-        rawLengths[i] /= totalArc;
+// The Bernstein form of a segment, expanded in powers of t.
+void BezierCurve::updateSegments() {
+    mSegments.resize(mPoints.size() > 1 ? mPoints.size() - 1 : 0);
+    for (size_t i = 0; i < mSegments.size(); i++) {
+        const BezierPoint &a = mPoints[i];
+        const BezierPoint &b = mPoints[i + 1];
+        for (int c = 0; c < 3; c++) {
+            float p0 = a.coord[c];
+            float p1 = a.right[c];
+            float p2 = b.left[c];
+            float p3 = b.coord[c];
+            float *k = mSegments[i].coeffs[c];
+            k[0] = p0;
+            k[1] = 3.0f * (p1 - p0);
+            k[2] = 3.0f * (p0 - 2.0f * p1 + p2);
+            k[3] = p3 - p0 + 3.0f * (p1 - p2);
+        }
     }
+}
 
-    mPrecalcArclengthLUT.resize(count, 0.0f);
-    for (int i = 0; i < count; i++) {
-        int bucket1 = int(rawLengths[i] * (count - 1));
-        mPrecalcArclengthLUT[bucket1] = (float) i / (float) count;
+// Largest error of the arclength to parameter mapping that is left
+// alone, in curve parameter.
+static const double kArcTolerance = 1e-5;
+
+// Pieces are split at most this many times within a segment.
+static const int kMaxArcDepth = 16;
+
+// 5-point Gauss-Legendre quadrature on [-1, 1].
+static const int kGaussPoints = 5;
+static const double kGaussNodes[kGaussPoints] = {
+        -0.9061798459386640, -0.5384693101056831, 0.0,
+        0.5384693101056831, 0.9061798459386640};
+static const double kGaussWeights[kGaussPoints] = {
+        0.2369268850561891, 0.4786286704993665, 0.5688888888888889,
+        0.4786286704993665, 0.2369268850561891};
+
+// Length of the derivative of |segment| at |u|.
+static double sSpeed(const BezierSegment &segment, double u) {
+    double sq = 0.0;
+    for (int c = 0; c < 3; c++) {
+        const float *k = segment.coeffs[c];
+        double d = (3.0 * k[3] * u + 2.0 * k[2]) * u + k[1];
+        sq += d * d;
     }
+    return sqrt(sq);
+}
 
-    for (int i = 0; i < count; i++) {
-        if (i == 0) continue;
-
-        float candidate = mPrecalcArclengthLUT[i];
-
-        if (candidate) continue;
-
-        int left = i - 1;
-        int right = i + 1;
-        while (left >= 0 && !mPrecalcArclengthLUT[left]) {
-            left--;
-        }
-        while (right && right < count && !mPrecalcArclengthLUT[right]) {
-            right++;
-        }
-
-        float newLeft = mPrecalcArclengthLUT[left];
-        float newRight = mPrecalcArclengthLUT[right];
-        if (!newRight) newRight = 1.0f;
-
-        float leftWeight = (i - left);
-        float rightWeight = (right - i);
-        float lrTotal = leftWeight + rightWeight;
-        leftWeight /= lrTotal;
-        rightWeight /= lrTotal;
-
-        mPrecalcArclengthLUT[i] = leftWeight * newLeft + rightWeight * newRight;
+static double sArcLength(const BezierSegment &segment, double start, double end) {
+    double mid = 0.5 * (start + end);
+    double half = 0.5 * (end - start);
+    double sum = 0.0;
+    for (int i = 0; i < kGaussPoints; i++) {
+        sum += kGaussWeights[i] * sSpeed(segment, mid + half * kGaussNodes[i]);
     }
+    return half * sum;
 }
 
-float BezierCurve::arcLengthIndexed(float s) {
-    if (!s) return 0.0f;
-
-    int count = 1 << mPower;
-
-    float rawIndex = s * (float) count;
-
-    int index = int(rawIndex);
-
-    float offset = rawIndex - (float) index;
-
-    // int leftTap1 = (index - 1) > 0 ? (index - 1) : 0;
-    int rightTap0 = (index + 1) < count ? (index + 1) : (count - 1);
-
-    return (1.0f - offset) * mPrecalcArclengthLUT[index] + offset * mPrecalcArclengthLUT[rightTap0];
-
-    // int rightTap1 = (index + 2) < count ? (index + 2) : (count - 1);
-
-    // float t = 0.33333333f + offset / 3.0f;
-
-    // float tm = 1.0f - t;
+// dt/ds where ds/dt is |speed|, limited to three times the |secant|
+// slope of the piece: that keeps a cubic Hermite piece monotone
+// (Fritsch and Carlson), and finite where the curve comes to a stop.
+static double sMonotoneSlope(double speed, double secant) {
+    return speed * 3.0 * secant > 1.0 ? 1.0 / speed : 3.0 * secant;
+}
 
-    // float k0 = tm * tm * tm;
-    // float k1 = t * tm * tm;
-    // float k2 = t * t * tm;
-    // float k3 = t * t * t;
+// Interpolates between |t0| and |t1| at |x| in [0, 1] along a piece |h|
+// long in s.
+static double sHermite(double x, double h, double t0, double slope0, double t1, double slope1) {
+    double x2 = x * x;
+    double x3 = x2 * x;
+    return (2.0 * x3 - 3.0 * x2 + 1.0) * t0 + (x3 - 2.0 * x2 + x) * h * slope0 +
+           (3.0 * x2 - 2.0 * x3) * t1 + (x3 - x2) * h * slope1;
+}
 
-    // float a = mPrecalcArclengthLUT[leftTap1];
-    // float b = mPrecalcArclengthLUT[index];
-    // float c = mPrecalcArclengthLUT[rightTap0];
-    // float d = mPrecalcArclengthLUT[rightTap1];
+// Splits |segment| from |start| to |end|, |length| long, until both the
+// quadrature and the interpolated inverse are within |tolerance| in
+// parameter, then appends the ends and lengths of the pieces. The
+// inverse is checked at the quarters, since a piece symmetric about its
+// middle is always right there.
+static void sSubdivideArc(const BezierSegment &segment, double start, double end, double length,
+                          double tolerance, int depth,
+                          std::vector<double> &ends, std::vector<double> &lengths) {
+    double at[5], parts[4];
+    for (int i = 0; i < 5; i++) {
+        at[i] = start + 0.25 * (double) i * (end - start);
+    }
+    double split = 0.0;
+    for (int i = 0; i < 4; i++) {
+        parts[i] = sArcLength(segment, at[i], at[i + 1]);
+        split += parts[i];
+    }
 
-    // float res = k0 * a + k1 * b + k2 * c + k3 * d;
+    bool accurate = true;
+    if (split > 0.0) {
+        double secant = (end - start) / split;
+        double startSlope = sMonotoneSlope(sSpeed(segment, start), secant);
+        double endSlope = sMonotoneSlope(sSpeed(segment, end), secant);
+        accurate = fabs(split - length) * secant <= tolerance;
+        double partial = 0.0;
+        for (int i = 1; i < 4 && accurate; i++) {
+            partial += parts[i - 1];
+            double t = sHermite(partial / split, split, start, startSlope, end, endSlope);
+            accurate = fabs(t - at[i]) <= tolerance;
+        }
+    }
 
-    // return res;
+    if (accurate || depth >= kMaxArcDepth) {
+        ends.push_back(end);
+        lengths.push_back(split);
+        return;
+    }
+    sSubdivideArc(segment, start, at[2], parts[0] + parts[1], tolerance, depth + 1,
+                  ends, lengths);
+    sSubdivideArc(segment, at[2], end, parts[2] + parts[3], tolerance, depth + 1,
+                  ends, lengths);
 }
 
-// Look up table taking control point parameterization to
-// arc length parameterization
-// subdivide curve into line segments that all attempt to be close to segWidth
-void BezierCurve::precalcWithResolution(float resolution) {
-
-    float currBestTstep = 0.1f;
-
-    size_t currPt = 0;
-    float currT = 0.0f;
-    float lastx, lasty, lastz;
-    evalElement(currPt, currT, &lastx, &lasty, &lastz);
-    float x, y, z;
-    float resCurrent = 0.0f;
+// Each segment is split where its speed varies, so smooth stretches get
+// few pieces.
+void BezierCurve::precalcArclengths() {
+    updateSegments();
+
+    size_t segmentCount = mSegments.size();
+    // Per segment, in its own parameter.
+    double tolerance = kArcTolerance * (double) segmentCount;
+
+    // Pieces by segment, where in it they end and how long they are.
+    std::vector<size_t> pieceSegments;
+    std::vector<double> pieceEnds, pieceLengths;
+    for (size_t pt = 0; pt < segmentCount; pt++) {
+        sSubdivideArc(mSegments[pt], 0.0, 1.0, sArcLength(mSegments[pt], 0.0, 1.0),
+                      tolerance, 0, pieceEnds, pieceLengths);
+        pieceSegments.resize(pieceEnds.size(), pt);
+    }
 
-    float lastT = 0.0f;
-    float delta = 0.1f;
-    currT = 0.1f;
-    while (true) {
-        redo:
-        evalElement(currPt, currT, &x, &y, &z);
-        resCurrent = segLength(lastx, lasty, lastz, x, y, z);
-        bool needStep = !aboutEq(resolution, resCurrent);
-        if (needStep) {
-            float distDiff = resolution / resCurrent;
-            currT = std::min(1.0f, std::max(lastT + 0.00001f, currT * distDiff));
-            goto redo;
+    double totalArc = 0.0;
+    for (double length : pieceLengths) {
+        totalArc += length;
+    }
+    LOGV("%s: total arc length %f in %zu pieces", __func__, totalArc, pieceEnds.size());
+
+    mArcPieces.clear();
+    if (totalArc <= 0.0) {
+        // Nowhere to go; any parameter will do.
+        mArcPieces.push_back(BezierArcPiece{0.0f, 0.0f, 1.0f, 1.0f});
+        mArcPieces.push_back(BezierArcPiece{1.0f, 1.0f, 0.0f, 0.0f});
+    } else {
+        // Slopes are per piece, as the ends of two segments can meet at a
+        // corner. Speeds are per segment parameter.
+        double segmentScale = totalArc / (double) segmentCount;
+        double length = 0.0;
+        for (size_t i = 0; i < pieceEnds.size(); i++) {
+            size_t pt = pieceSegments[i];
+            double start = i > 0 && pieceSegments[i - 1] == pt ? pieceEnds[i - 1] : 0.0;
+            double end = pieceEnds[i];
+
+            BezierArcPiece piece = {(float) (length / totalArc),
+                                    (float) (((double) pt + start) / (double) segmentCount),
+                                    0.0f, 0.0f};
+            if (pieceLengths[i] > 0.0) {
+                double secant = (end - start) * totalArc /
+                                ((double) segmentCount * pieceLengths[i]);
+                piece.startSlope = (float) sMonotoneSlope(
+                        sSpeed(mSegments[pt], start) / segmentScale, secant);
+                piece.endSlope = (float) sMonotoneSlope(
+                        sSpeed(mSegments[pt], end) / segmentScale, secant);
+            }
+            mArcPieces.push_back(piece);
+            length += pieceLengths[i];
         }
+        mArcPieces.push_back(BezierArcPiece{1.0f, 1.0f, 0.0f, 0.0f});
+    }
 
-        lastx = x;
-        lasty = y;
-        lastz = z;
-        delta = currT - lastT;
-        lastT = currT;
-        currT += delta;
+    // Bucket i spans the pieces from the one where s = i / count falls to
+    // the one where (i + 1) / count does.
+    size_t realPieces = mArcPieces.size() - 1;
+    mArcBuckets.resize(realPieces + 1);
+    size_t piece = 0;
+    for (size_t i = 0; i <= realPieces; i++) {
+        float s = (float) i / (float) realPieces;
+        while (piece + 1 < realPieces && mArcPieces[piece + 1].s <= s) {
+            piece++;
+        }
+        mArcBuckets[i] = (uint32_t) piece;
+    }
 
-        if (currT >= 1.0f) {
-            if (currPt == mPoints.size() - 1) break;
+    // The largest power of two below the most pieces a bucket spans.
+    size_t span = 0;
+    for (size_t i = 0; i < realPieces; i++) {
+        span = std::max(span, (size_t) (mArcBuckets[i + 1] - mArcBuckets[i]));
+    }
+    mArcSearchStep = 0;
+    while (2 * mArcSearchStep <= span) {
+        mArcSearchStep = mArcSearchStep ? 2 * mArcSearchStep : 1;
+    }
+}
 
-            currT -= 1.0f;
-            currPt += 1;
-            LOGV("%s: currPt %zu\n", __func__, currPt);
-        }
+float BezierCurve::arcLengthIndexed(float s) const {
+    // The last piece starting at or before |s|, or the first one: from
+    // those its bucket spans, by a search that takes the same steps
+    // every time, so there's nothing to predict.
+    size_t bucketCount = mArcBuckets.size() - 1;
+    size_t bucket = (size_t) std::min(std::max(s * (float) bucketCount, 0.0f),
+                                      (float) (bucketCount - 1));
+    size_t last = mArcBuckets[bucket + 1];
+    size_t index = mArcBuckets[bucket];
+    for (size_t step = mArcSearchStep; step; step >>= 1) {
+        size_t probe = std::min(index + step, last);
+        index = mArcPieces[probe].s <= s ? probe : index;
     }
+    const BezierArcPiece &piece = mArcPieces[index];
+    const BezierArcPiece &next = mArcPieces[index + 1];
+
+    float h = next.s - piece.s;
+    float x = h > 0.0f ? std::min(std::max((s - piece.s) / h, 0.0f), 1.0f) : 0.0f;
+    float x2 = x * x;
+    float x3 = x2 * x;
+    return (2.0f * x3 - 3.0f * x2 + 1.0f) * piece.t + (x3 - 2.0f * x2 + x) * h * piece.startSlope +
+           (3.0f * x2 - 2.0f * x3) * next.t + (x3 - x2) * h * piece.endSlope;
 }
@@ -24,19 +24,28 @@
 #include <map>
 #include <vector>
 
-struct BezierCoord {
-    float x;
-    float y;
-    float z;
-    float arcLength;
-};
-
 struct BezierPoint {
     float left[3];
     float right[3];
     float coord[3];
 };
 
+// The curve between two points in power basis: coefficients of t^0 to
+// t^3 for x, y and z, evaluated by Horner's rule.
+struct BezierSegment {
+    float coeffs[3][4];
+};
+
+// A piece of the table from arclength, as a fraction of the whole, to
+// curve parameter: where it starts, and dt/ds at both of its ends for
+// cubic Hermite interpolation up to the next piece.
+struct BezierArcPiece {
+    float s;
+    float t;
+    float startSlope;
+    float endSlope;
+};
+
 class BezierCurve {
 public:
     BezierCurve() = default;
@@ -61,14 +70,20 @@ public:
         mPoints[index] = p;
     }
 
-    void precalcArclengths(int power);
-
-    void precalcWithResolution(float segWidth);
+    // Also sets up the segments every evaluation goes through, so it has
+    // to come after the last addPoint.
+    void precalcArclengths();
 
     void evalSimple(float t, float *x_out, float *y_out, float *z_out);
 
+    // evalSimple for |count| parameters at once.
+    void evalSimple(const float *t, size_t count, float *x_out, float *y_out, float *z_out);
+
     void evalArclen(float t, float *x_out, float *y_out, float *z_out);
 
+    // evalArclen for |count| parameters at once.
+    void evalArclen(const float *t, size_t count, float *x_out, float *y_out, float *z_out);
+
     ActionCurve &action() {
         return mAction;
     }
@@ -76,14 +91,23 @@ public:
 private:
     void evalElement(size_t pt, float t, float *x_out, float *y_out, float *z_out);
 
-    std::vector<BezierPoint> mPoints;
-    std::vector<BezierCoord> mPrecalculated;
+    void updateSegments();
+
+    // The segment |t| falls in, and where in it.
+    size_t segmentAt(float t, float *local) const;
 
-    int mPower;
+    std::vector<BezierPoint> mPoints;
+    std::vector<BezierSegment> mSegments;
 
-    float arcLengthIndexed(float t);
+    float arcLengthIndexed(float s) const;
 
-    std::vector<float> mPrecalcArclengthLUT;
+    // Ends with one at s = t = 1.
+    std::vector<BezierArcPiece> mArcPieces;
+    // As many evenly spaced s, plus one at s = 1, each with the piece
+    // it falls in, to narrow searches.
+    std::vector<uint32_t> mArcBuckets;
+    // Where searching the pieces of a bucket starts halving.
+    size_t mArcSearchStep = 0;
 
     ActionCurve mAction;
 };
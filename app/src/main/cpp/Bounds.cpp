@@ -0,0 +1,108 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bounds.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+Aabb Aabb::empty() {
+    return Aabb{{FLT_MAX, FLT_MAX, FLT_MAX}, {-FLT_MAX, -FLT_MAX, -FLT_MAX}};
+}
+
+// The transformed center, and extents from the absolute values of the
+// rotation and scale.
+Aabb Aabb::transformed(const float min[3], const float max[3], const matrix4 &world) {
+    float center[3], extent[3];
+    for (int c = 0; c < 3; c++) {
+        center[c] = 0.5f * (min[c] + max[c]);
+        extent[c] = 0.5f * (max[c] - min[c]);
+    }
+
+    Aabb res;
+    for (int row = 0; row < 3; row++) {
+        float c = world.vals[12 + row];
+        float e = 0.0f;
+        for (int col = 0; col < 3; col++) {
+            float m = world.vals[col * 4 + row];
+            c += m * center[col];
+            e += fabsf(m) * extent[col];
+        }
+        res.min[row] = c - e;
+        res.max[row] = c + e;
+    }
+    return res;
+}
+
+void Aabb::grow(const Aabb &other) {
+    for (int c = 0; c < 3; c++) {
+        min[c] = std::min(min[c], other.min[c]);
+        max[c] = std::max(max[c], other.max[c]);
+    }
+}
+
+float Aabb::surfaceArea() const {
+    if (isEmpty()) return 0.0f;
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+Frustum::Frustum(const matrix4 &viewProj) {
+    // Clip planes -w <= x, y, z <= w as rows of |viewProj|, normalized
+    // so that sphere radii can be compared with plane distances.
+    for (int axis = 0; axis < 3; axis++) {
+        for (int k = 0; k < 4; k++) {
+            float w = viewProj.vals[k * 4 + 3];
+            float v = viewProj.vals[k * 4 + axis];
+            mPlanes[axis * 2][k] = w + v;
+            mPlanes[axis * 2 + 1][k] = w - v;
+        }
+    }
+    for (auto &p : mPlanes) {
+        float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if (len == 0.0f) continue;
+        for (int k = 0; k < 4; k++) p[k] /= len;
+    }
+}
+
+Overlap Frustum::test(const Aabb &box) const {
+    Overlap res = kInside;
+    for (const auto &p : mPlanes) {
+        // Distances of the box corners farthest along and against the
+        // plane normal.
+        float far = p[3], near = p[3];
+        for (int c = 0; c < 3; c++) {
+            far += p[c] * (p[c] >= 0.0f ? box.max[c] : box.min[c]);
+            near += p[c] * (p[c] >= 0.0f ? box.min[c] : box.max[c]);
+        }
+        if (far < 0.0f) return kOutside;
+        if (near < 0.0f) res = kPartial;
+    }
+    return res;
+}
+
+Overlap Frustum::testSphere(const float center[3], float radius) const {
+    Overlap res = kInside;
+    for (const auto &p : mPlanes) {
+        float dist = p[0] * center[0] + p[1] * center[1] + p[2] * center[2] + p[3];
+        if (dist < -radius) return kOutside;
+        if (dist < radius) res = kPartial;
+    }
+    return res;
+}
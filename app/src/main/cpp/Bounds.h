@@ -0,0 +1,58 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_BOUNDS_H
+#define GPU_EMULATION_STRESS_TEST_BOUNDS_H
+
+#include "matrix.h"
+
+struct Aabb {
+    float min[3];
+    float max[3];
+
+    static Aabb empty();
+
+    // Bounds of the box |min|, |max| placed by |world|.
+    static Aabb transformed(const float min[3], const float max[3], const matrix4 &world);
+
+    bool isEmpty() const { return min[0] > max[0]; }
+
+    void grow(const Aabb &other);
+
+    float surfaceArea() const;
+};
+
+// How bounds relate to a query volume.
+enum Overlap {
+    kOutside,
+    kPartial,
+    kInside,
+};
+
+// Clip volume of a view-projection matrix, as six planes facing in.
+class Frustum {
+public:
+    explicit Frustum(const matrix4 &viewProj);
+
+    Overlap test(const Aabb &box) const;
+
+    Overlap testSphere(const float center[3], float radius) const;
+
+private:
+    float mPlanes[6][4];
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_BOUNDS_H
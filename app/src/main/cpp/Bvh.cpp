@@ -0,0 +1,308 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bvh.h"
+
+#include "JobSystem.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+static const uint32_t kLeafSize = 4;
+
+// Rebuild once refits have grown the summed surface area of all nodes,
+// a proxy for the cost of a query, this much past a fresh build.
+static const double kRebuildRatio = 2.0;
+
+void Bvh::build(const EntityStore &entities, const std::vector<RenderModel> &models) {
+    updateSlotBounds(entities, models, true);
+    rebuild((uint32_t) entities.slotCount());
+}
+
+void Bvh::update(const EntityStore &entities, const std::vector<RenderModel> &models) {
+    updateSlotBounds(entities, models, false);
+
+    uint32_t liveSlots = (uint32_t) entities.slotCount();
+    if (liveSlots > mLeafSlots.size()) {
+        rebuild(liveSlots);
+        mRebuildCount++;
+        return;
+    }
+
+    refit();
+    if (mArea > kRebuildRatio * mBuiltArea) {
+        rebuild(liveSlots);
+        mRebuildCount++;
+    }
+}
+
+void Bvh::remove(entity_handle_t handle) {
+    uint32_t slot = EntityStore::slotOf(handle);
+    if (slot >= mSlotHandles.size() || mSlotHandles[slot] != handle) return;
+    mSlotBounds[slot] = Aabb::empty();
+    mSlotHandles[slot] = EntityStore::kInvalidHandle;
+    mSlotChanged[slot] = 1;
+}
+
+void Bvh::updateSlotBounds(const EntityStore &entities, const std::vector<RenderModel> &models,
+                           bool all) {
+    if (entities.slotCount() > mSlotBounds.size()) {
+        mSlotBounds.resize(entities.slotCount(), Aabb::empty());
+        mSlotHandles.resize(entities.slotCount(), EntityStore::kInvalidHandle);
+        mSlotChanged.resize(entities.slotCount(), 0);
+    }
+
+    JobSystem::get()->parallelFor(
+            entities.size(), JobSystem::kEntityChunk,
+            [this, &entities, &models, all](size_t begin, size_t end) {
+                // World matrices are built four at a time, like for
+                // snapshots.
+                for (size_t group = begin; group < end; group += 4) {
+                    size_t groupEnd = std::min(group + 4, end);
+                    bool changed = all;
+                    for (size_t i = group; i < groupEnd; i++) {
+                        changed = changed ||
+                                  (entities.flags[i] & EntityStore::kDirty) ||
+                                  mSlotHandles[EntityStore::slotOf(entities.handles[i])] !=
+                                  entities.handles[i];
+                    }
+                    if (!changed) continue;
+
+                    matrix4 world[4];
+                    entities.buildWorldMatrices(group, groupEnd - group, world, sizeof(matrix4));
+                    for (size_t i = group; i < groupEnd; i++) {
+                        entity_handle_t handle = entities.handles[i];
+                        uint32_t slot = EntityStore::slotOf(handle);
+                        if (entities.flags[i] & EntityStore::kRenderable) {
+                            const RenderModel &model = models[entities.renderModel[i]];
+                            mSlotBounds[slot] = Aabb::transformed(model.boundsMin, model.boundsMax,
+                                                                  world[i - group]);
+                        } else {
+                            mSlotBounds[slot] = Aabb::empty();
+                        }
+                        mSlotHandles[slot] = handle;
+                        mSlotChanged[slot] = 1;
+                    }
+                }
+            });
+}
+
+// |liveSlots| is the entity store's slot count; slots past it are empty.
+void Bvh::rebuild(uint32_t liveSlots) {
+    // Cover some slots beyond those in use, so that a growing number of
+    // entities doesn't mean a rebuild every frame.
+    uint32_t slotCount = liveSlots + liveSlots / 2;
+    mSlotBounds.resize(slotCount, Aabb::empty());
+    mSlotHandles.resize(slotCount, EntityStore::kInvalidHandle);
+    mSlotChanged.resize(slotCount, 0);
+
+    // Empty slots sort past everything else on every axis, so they
+    // end up in subtrees of their own.
+    std::vector<float> centroids(slotCount * 3);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        const Aabb &box = mSlotBounds[slot];
+        for (int c = 0; c < 3; c++) {
+            centroids[slot * 3 + c] =
+                    box.isEmpty() ? FLT_MAX : 0.5f * (box.min[c] + box.max[c]);
+        }
+    }
+
+    mLeafSlots.resize(slotCount);
+    for (uint32_t slot = 0; slot < slotCount; slot++) {
+        mLeafSlots[slot] = slot;
+    }
+
+    mNodes.clear();
+    mNodes.reserve(2 * (slotCount / kLeafSize + 1));
+    if (slotCount) buildNode(0, slotCount, centroids);
+
+    mNodeChanged.assign(mNodes.size(), 0);
+    std::fill(mSlotChanged.begin(), mSlotChanged.end(), 0);
+
+    mArea = 0.0;
+    for (const auto &node : mNodes) {
+        mArea += node.box.surfaceArea();
+    }
+    mBuiltArea = mArea;
+}
+
+// Splits at the median centroid along the longest axis of the
+// centroids' bounds.
+uint32_t Bvh::buildNode(uint32_t begin, uint32_t end, const std::vector<float> &centroids) {
+    uint32_t index = (uint32_t) mNodes.size();
+    mNodes.push_back(Node());
+
+    Aabb box = Aabb::empty();
+    Aabb centroidBox = Aabb::empty();
+    for (uint32_t i = begin; i < end; i++) {
+        uint32_t slot = mLeafSlots[i];
+        box.grow(mSlotBounds[slot]);
+        if (mSlotBounds[slot].isEmpty()) continue;
+        for (int c = 0; c < 3; c++) {
+            float v = centroids[slot * 3 + c];
+            centroidBox.min[c] = std::min(centroidBox.min[c], v);
+            centroidBox.max[c] = std::max(centroidBox.max[c], v);
+        }
+    }
+    mNodes[index].box = box;
+
+    if (end - begin <= kLeafSize) {
+        mNodes[index].first = begin;
+        mNodes[index].count = end - begin;
+        return index;
+    }
+
+    int axis = 0;
+    if (!centroidBox.isEmpty()) {
+        float extent[3];
+        for (int c = 0; c < 3; c++) {
+            extent[c] = centroidBox.max[c] - centroidBox.min[c];
+        }
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+    }
+
+    uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(mLeafSlots.begin() + begin,
+                     mLeafSlots.begin() + mid,
+                     mLeafSlots.begin() + end,
+                     [&centroids, axis](uint32_t a, uint32_t b) {
+                         return centroids[a * 3 + axis] < centroids[b * 3 + axis];
+                     });
+
+    buildNode(begin, mid, centroids);
+    uint32_t right = buildNode(mid, end, centroids);
+    mNodes[index].first = right;
+    mNodes[index].count = 0;
+    return index;
+}
+
+// Children come after their parents, so one backwards pass sees every
+// child before its parent.
+void Bvh::refit() {
+    for (size_t n = mNodes.size(); n-- > 0;) {
+        Node &node = mNodes[n];
+        bool changed = false;
+        Aabb box = Aabb::empty();
+
+        if (node.count) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                uint32_t slot = mLeafSlots[i];
+                changed = changed || mSlotChanged[slot];
+                mSlotChanged[slot] = 0;
+            }
+            if (changed) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    box.grow(mSlotBounds[mLeafSlots[i]]);
+                }
+            }
+        } else {
+            changed = mNodeChanged[n + 1] || mNodeChanged[node.first];
+            if (changed) {
+                box = mNodes[n + 1].box;
+                box.grow(mNodes[node.first].box);
+            }
+        }
+
+        mNodeChanged[n] = changed;
+        if (changed) {
+            mArea += (double) box.surfaceArea() - (double) node.box.surfaceArea();
+            node.box = box;
+        }
+    }
+}
+
+template<typename NodeTest, typename SlotTest>
+void Bvh::query(NodeTest nodeTest, SlotTest slotTest, std::vector<entity_handle_t> &out) const {
+    if (mNodes.empty()) return;
+
+    // Nodes to visit, and whether they are known to be inside.
+    std::vector<std::pair<uint32_t, bool> > stack;
+    stack.push_back(std::make_pair(0u, false));
+    while (!stack.empty()) {
+        uint32_t n = stack.back().first;
+        bool inside = stack.back().second;
+        stack.pop_back();
+
+        const Node &node = mNodes[n];
+        if (node.box.isEmpty()) continue;
+        if (!inside) {
+            Overlap overlap = nodeTest(node.box);
+            if (overlap == kOutside) continue;
+            inside = overlap == kInside;
+        }
+
+        if (node.count) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                uint32_t slot = mLeafSlots[i];
+                const Aabb &box = mSlotBounds[slot];
+                if (box.isEmpty()) continue;
+                if (inside || slotTest(box)) {
+                    out.push_back(mSlotHandles[slot]);
+                }
+            }
+        } else {
+            stack.push_back(std::make_pair(node.first, inside));
+            stack.push_back(std::make_pair(n + 1, inside));
+        }
+    }
+}
+
+void Bvh::queryFrustum(const matrix4 &viewProj, std::vector<entity_handle_t> &out) const {
+    Frustum frustum(viewProj);
+    auto overlap = [&frustum](const Aabb &box) -> Overlap { return frustum.test(box); };
+
+    query(overlap,
+          [&overlap](const Aabb &box) -> bool { return overlap(box) != kOutside; },
+          out);
+}
+
+void Bvh::querySphere(const vector4 &center, float radius,
+                      std::vector<entity_handle_t> &out) const {
+    const float c[3] = {center.x, center.y, center.z};
+    auto touches = [&c, radius](const Aabb &box) -> bool {
+        float distSq = 0.0f;
+        for (int i = 0; i < 3; i++) {
+            float d = std::max(std::max(box.min[i] - c[i], c[i] - box.max[i]), 0.0f);
+            distSq += d * d;
+        }
+        return distSq <= radius * radius;
+    };
+
+    query([&touches](const Aabb &box) -> Overlap { return touches(box) ? kPartial : kOutside; },
+          touches, out);
+}
+
+void Bvh::queryRay(const vector4 &origin, const vector4 &dir, float maxDistance,
+                   std::vector<entity_handle_t> &out) const {
+    const float o[3] = {origin.x, origin.y, origin.z};
+    const float invDir[3] = {1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z};
+    auto hits = [&o, &invDir, maxDistance](const Aabb &box) -> bool {
+        float tmin = 0.0f, tmax = maxDistance;
+        for (int c = 0; c < 3; c++) {
+            float t0 = (box.min[c] - o[c]) * invDir[c];
+            float t1 = (box.max[c] - o[c]) * invDir[c];
+            tmin = std::max(tmin, std::min(t0, t1));
+            tmax = std::min(tmax, std::max(t0, t1));
+        }
+        return tmin <= tmax;
+    };
+
+    query([&hits](const Aabb &box) -> Overlap { return hits(box) ? kPartial : kOutside; },
+          hits, out);
+}
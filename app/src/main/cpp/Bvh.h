@@ -0,0 +1,102 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_BVH_H
+#define GPU_EMULATION_STRESS_TEST_BVH_H
+
+#include "Bounds.h"
+#include "EntityStore.h"
+#include "RenderModel.h"
+#include "matrix.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over the world bounds of renderable
+// entities. Leaves are entity slots, so entities come and go without
+// changing the tree's shape; update() refits the boxes of what moved
+// and rebuilds once refitting has made the tree much looser than it
+// was when built, or once there are slots it doesn't cover.
+class Bvh {
+public:
+    void build(const EntityStore &entities, const std::vector<RenderModel> &models);
+
+    // Call once per frame after entities have moved, spawned and been
+    // destroyed. Entities flagged EntityStore::kDirty are refit.
+    void update(const EntityStore &entities, const std::vector<RenderModel> &models);
+
+    // Drops |handle| before the entity is destroyed.
+    void remove(entity_handle_t handle);
+
+    // Entities whose bounds may be inside the clip volume of
+    // |viewProj|, appended to |out|.
+    void queryFrustum(const matrix4 &viewProj, std::vector<entity_handle_t> &out) const;
+
+    void querySphere(const vector4 &center, float radius,
+                     std::vector<entity_handle_t> &out) const;
+
+    // Entities whose bounds the ray from |origin| along |dir| enters
+    // within |maxDistance| lengths of |dir|.
+    void queryRay(const vector4 &origin, const vector4 &dir, float maxDistance,
+                  std::vector<entity_handle_t> &out) const;
+
+    // World bounds of a live entity as of the last update().
+    const Aabb &bounds(entity_handle_t handle) const {
+        return mSlotBounds[EntityStore::slotOf(handle)];
+    }
+
+    uint32_t rebuildCount() const { return mRebuildCount; }
+
+    // Slots the tree covers, live or not.
+    size_t slotCount() const { return mLeafSlots.size(); }
+
+private:
+    struct Node {
+        Aabb box;
+        // Leaves: first of |count| entries of |mLeafSlots|. Internal
+        // nodes: the right child; the left one follows the node, so
+        // children always come after their parent.
+        uint32_t first;
+        uint32_t count;
+    };
+
+    void updateSlotBounds(const EntityStore &entities, const std::vector<RenderModel> &models,
+                          bool all);
+
+    void rebuild(uint32_t liveSlots);
+
+    uint32_t buildNode(uint32_t begin, uint32_t end, const std::vector<float> &centroids);
+
+    void refit();
+
+    template<typename NodeTest, typename SlotTest>
+    void query(NodeTest nodeTest, SlotTest slotTest, std::vector<entity_handle_t> &out) const;
+
+    std::vector<Node> mNodes;
+    std::vector<uint32_t> mLeafSlots;
+    std::vector<uint8_t> mNodeChanged;
+
+    // By entity slot.
+    std::vector<Aabb> mSlotBounds;
+    std::vector<entity_handle_t> mSlotHandles;
+    std::vector<uint8_t> mSlotChanged;
+
+    double mBuiltArea = 0.0;
+    double mArea = 0.0;
+    uint32_t mRebuildCount = 0;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_BVH_H
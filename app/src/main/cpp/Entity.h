@@ -30,8 +30,7 @@ public:
 
     void updateWorldMatrix(matrix4 &targetWorldMatrix) const {
         targetWorldMatrix =
-                makeFrameChange(pos, v4normed(fwd), v4normed(up)) *
-                scaling(scale.x, scale.y, scale.z);
+                translation(pos) * qrotation(orientation) * scaling(scale.x, scale.y, scale.z);
     }
 
     void updateCameraMatrix(float fov, float aspect, float nearclip, float farclip,
@@ -39,13 +38,13 @@ public:
                             matrix4 &targetCameraMatrix) const {
         matrix4 proj = isOrtho ? makeOrthogonalProj(right, aspect, nearclip, farclip) :
                        makePerspectiveProj(fov, aspect, nearclip, farclip);
-        targetCameraMatrix = proj * makeModelview(pos, fwd, up);
+        targetCameraMatrix = proj * makeModelview(pos, qdir(orientation), qup(orientation));
     }
 
     void updateCameraViewMatrix(float fov, float aspect, float nearclip, float farclip,
                                 float right, bool isOrtho,
                                 matrix4 &targetCameraMatrix) const {
-        targetCameraMatrix = makeModelview(pos, fwd, up);
+        targetCameraMatrix = makeModelview(pos, qdir(orientation), qup(orientation));
     }
 
     void updateCameraProjMatrix(float fov, float aspect, float nearclip, float farclip,
@@ -61,35 +60,15 @@ public:
                                   matrix4 &targetCameraMatrix) const {
         matrix4 proj = isOrtho ? makeOrthogonalProj(right, aspect, nearclip, farclip) :
                        makePerspectiveProj(fov, aspect, nearclip, farclip);
-        targetCameraMatrix = proj * makeModelview(makevector4(0, 0, 0, 1), fwd, up);
-    }
-
-    void update(uint32_t currFrame) {
-        if (!frameKnown) {
-            frameKnown = true;
-            lastFrame = currFrame;
-            if (!framesToLive) {
-                LOGE("Tried to create entity with zero lifetime. No good!");
-                abort();
-            }
-        } else {
-            if (framesToLive > 0) {
-                if (currFrame > lastFrame) {
-                    framesToLive -= currFrame - lastFrame;
-                }
-                lastFrame = currFrame;
-                if (framesToLive <= 0) {
-                    live = false;
-                }
-            }
-        }
+        targetCameraMatrix = proj * makeModelview(makevector4(0, 0, 0, 1),
+                                                  qdir(orientation), qup(orientation));
     }
 
     bool renderable = true;
     render_state_handle_t renderModel = 0;
     vector4 pos;
-    vector4 fwd;
-    vector4 up;
+    // Unit quaternion; see qdir and qup for the forward and up vectors.
+    quaternion orientation;
     vector4 scale;
 
     // Lifetime / GC stuff
@@ -97,20 +76,6 @@ public:
     uint32_t lastFrame = 0;
     int framesToLive = -1;
     bool live = true;
-
-    // all other data that seems to matter
-    vector4 initialOffset;
-    vector4 spinAxis;
-    int spinPeriod;
-
-    void applyRotation(const vector4 &axis, float angle) {
-        matrix4 current =
-                makeFrameChange(pos, v4normed(fwd), v4normed(up));
-        matrix4 rotated =
-                rotation(axis.x, axis.y, axis.z, angle) * current;
-        fwd = -1.0f * v4normed(mcol(rotated, 2));
-        up = v4normed(mcol(rotated, 1));
-    }
 };
 
 #endif //GPU_EMULATION_STRESS_TEST_ENTITY_H
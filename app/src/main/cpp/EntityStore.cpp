@@ -0,0 +1,280 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "EntityStore.h"
+
+#include "log.h"
+#include "simd.h"
+
+#include <cstdlib>
+#include <string.h>
+
+const uint32_t EntityStore::kSlotBits;
+const uint32_t EntityStore::kSlotMask;
+const entity_handle_t EntityStore::kInvalidHandle;
+const uint32_t EntityStore::kNoIndex;
+
+// Input streams of the world matrix kernel, in this order.
+enum {
+    kPosX, kPosY, kPosZ,
+    kRotX, kRotY, kRotZ, kRotW,
+    kScaleX, kScaleY, kScaleZ,
+    kStreamCount,
+};
+
+// translation(pos) * qrotation(rot) * scaling(scale) for four
+// entities. |in| points at four consecutive values of each stream;
+// matrices go to |out|, which needs four entries. Quaternions are
+// scaled back to unit length on the way, so drift doesn't skew them.
+static void sBuildWorldMatrices4(const float *const in[kStreamCount], matrix4 *const out[4]) {
+    float4 x = f4load(in[kRotX]);
+    float4 y = f4load(in[kRotY]);
+    float4 z = f4load(in[kRotZ]);
+    float4 w = f4load(in[kRotW]);
+    float4 s = f4divNonzero(f4splat(2.0f), x * x + y * y + z * z + w * w);
+
+    float4 xs = x * s, ys = y * s, zs = z * s;
+    float4 xx = x * xs, yy = y * ys, zz = z * zs;
+    float4 xy = x * ys, yz = y * zs, xz = x * zs;
+    float4 wx = w * xs, wy = w * ys, wz = w * zs;
+
+    float4 one = f4splat(1.0f);
+    float4 zero = f4splat(0.0f);
+    float4 sx = f4load(in[kScaleX]);
+    float4 sy = f4load(in[kScaleY]);
+    float4 sz = f4load(in[kScaleZ]);
+
+    float4 cols[4][4] = {
+            {(one - yy - zz) * sx, (xy + wz) * sx, (xz - wy) * sx, zero},
+            {(xy - wz) * sy, (one - xx - zz) * sy, (yz + wx) * sy, zero},
+            {(xz + wy) * sz, (yz - wx) * sz, (one - xx - yy) * sz, zero},
+            {f4load(in[kPosX]), f4load(in[kPosY]), f4load(in[kPosZ]), one},
+    };
+
+    // Each column is lanes-by-entity; transposing gives that column for
+    // each of the four entities.
+    for (int c = 0; c < 4; c++) {
+        f4transpose(cols[c][0], cols[c][1], cols[c][2], cols[c][3]);
+        for (int e = 0; e < 4; e++) {
+            f4store(out[e]->vals + 4 * c, cols[c][e]);
+        }
+    }
+}
+
+void EntityStore::resize(size_t count) {
+    posX.resize(count, 0.0f);
+    posY.resize(count, 0.0f);
+    posZ.resize(count, 0.0f);
+    rotX.resize(count, 0.0f);
+    rotY.resize(count, 0.0f);
+    rotZ.resize(count, 0.0f);
+    rotW.resize(count, 1.0f);
+    scaleX.resize(count, 0.0f);
+    scaleY.resize(count, 0.0f);
+    scaleZ.resize(count, 0.0f);
+    renderModel.resize(count, 0);
+    flags.resize(count, kRenderable | kLive | kDirty);
+    lifetimes.resize(count, Lifetime{0, -1});
+    handles.resize(count, kInvalidHandle);
+}
+
+entity_handle_t EntityStore::spawn() {
+    uint32_t slot;
+    entity_handle_t handle;
+    if (!mFreeSlots.empty()) {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        uint32_t generation = (mSlots[slot].handle >> kSlotBits) + 1;
+        handle = (generation << kSlotBits) | slot;
+    } else {
+        slot = mSlots.size();
+        if (slot >= kSlotMask) {
+            LOGE("%s: out of entity slots", __func__);
+            abort();
+        }
+        mSlots.push_back(Slot());
+        handle = slot;
+    }
+
+    size_t index = size();
+    resize(index + 1);
+    handles[index] = handle;
+    mSlots[slot].handle = handle;
+    mSlots[slot].index = index;
+    return handle;
+}
+
+void EntityStore::spawnUpTo(entity_handle_t handle) {
+    while (mSlots.size() <= handle) {
+        spawn();
+    }
+}
+
+void EntityStore::destroy(entity_handle_t handle) {
+    if (!valid(handle)) return;
+
+    Slot &slot = mSlots[slotOf(handle)];
+    size_t index = slot.index;
+    size_t last = size() - 1;
+    if (index != last) {
+        move(last, index);
+        mSlots[slotOf(handles[index])].index = index;
+    }
+    resize(last);
+
+    slot.index = kNoIndex;
+    mFreeSlots.push_back(slotOf(handle));
+}
+
+Entity EntityStore::get(entity_handle_t handle) const {
+    size_t i = indexOf(handle);
+    Entity res;
+    res.renderable = flags[i] & kRenderable;
+    res.renderModel = renderModel[i];
+    res.pos = makevector4(posX[i], posY[i], posZ[i], 1.0f);
+    res.orientation = makequaternion(rotX[i], rotY[i], rotZ[i], rotW[i]);
+    res.scale = makevector4(scaleX[i], scaleY[i], scaleZ[i], 1.0f);
+    res.frameKnown = flags[i] & kFrameKnown;
+    res.lastFrame = lifetimes[i].lastFrame;
+    res.framesToLive = lifetimes[i].framesToLive;
+    res.live = flags[i] & kLive;
+    return res;
+}
+
+void EntityStore::set(entity_handle_t handle, const Entity &entity) {
+    setFrame(handle, entity.pos, entity.orientation);
+    setScale(handle, entity.scale);
+    size_t i = indexOf(handle);
+    renderModel[i] = entity.renderModel;
+    flags[i] = (flags[i] & kBatched) |
+               (entity.renderable ? kRenderable : 0) |
+               (entity.live ? kLive : 0) |
+               (entity.frameKnown ? kFrameKnown : 0) |
+               kDirty;
+    lifetimes[i].lastFrame = entity.lastFrame;
+    lifetimes[i].framesToLive = entity.framesToLive;
+}
+
+void EntityStore::setFrame(entity_handle_t handle, const vector4 &pos,
+                           const quaternion &orientation) {
+    size_t i = indexOf(handle);
+    posX[i] = pos.x;
+    posY[i] = pos.y;
+    posZ[i] = pos.z;
+    rotX[i] = orientation.x;
+    rotY[i] = orientation.y;
+    rotZ[i] = orientation.z;
+    rotW[i] = orientation.w;
+    flags[i] |= kDirty;
+}
+
+void EntityStore::setScale(entity_handle_t handle, const vector4 &scale) {
+    size_t i = indexOf(handle);
+    scaleX[i] = scale.x;
+    scaleY[i] = scale.y;
+    scaleZ[i] = scale.z;
+    flags[i] |= kDirty;
+}
+
+void EntityStore::setRenderable(entity_handle_t handle, bool renderable) {
+    size_t i = indexOf(handle);
+    if (renderable) {
+        flags[i] |= kRenderable;
+    } else {
+        flags[i] &= ~kRenderable;
+    }
+}
+
+bool EntityStore::updateLifetime(size_t index, uint32_t currFrame) {
+    Lifetime &life = lifetimes[index];
+    uint8_t &f = flags[index];
+    if (!(f & kFrameKnown)) {
+        f |= kFrameKnown;
+        life.lastFrame = currFrame;
+        if (!life.framesToLive) {
+            LOGE("Tried to create entity with zero lifetime. No good!");
+            abort();
+        }
+    } else if (life.framesToLive > 0) {
+        if (currFrame > life.lastFrame) {
+            life.framesToLive -= currFrame - life.lastFrame;
+        }
+        life.lastFrame = currFrame;
+        if (life.framesToLive <= 0) {
+            f &= ~kLive;
+        }
+    }
+    return f & kLive;
+}
+
+void EntityStore::move(size_t from, size_t to) {
+    posX[to] = posX[from];
+    posY[to] = posY[from];
+    posZ[to] = posZ[from];
+    rotX[to] = rotX[from];
+    rotY[to] = rotY[from];
+    rotZ[to] = rotZ[from];
+    rotW[to] = rotW[from];
+    scaleX[to] = scaleX[from];
+    scaleY[to] = scaleY[from];
+    scaleZ[to] = scaleZ[from];
+    renderModel[to] = renderModel[from];
+    flags[to] = flags[from];
+    lifetimes[to] = lifetimes[from];
+    handles[to] = handles[from];
+}
+
+void EntityStore::buildWorldMatrices(size_t first, size_t count,
+                                     matrix4 *out, size_t outStride) const {
+    const std::vector<float> *streams[kStreamCount] = {
+            &posX, &posY, &posZ,
+            &rotX, &rotY, &rotZ, &rotW,
+            &scaleX, &scaleY, &scaleZ,
+    };
+
+    const float *in[kStreamCount];
+    matrix4 *dst[4];
+    unsigned char *outBytes = (unsigned char *) out;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int s = 0; s < kStreamCount; s++) {
+            in[s] = streams[s]->data() + first + i;
+        }
+        for (int e = 0; e < 4; e++) {
+            dst[e] = (matrix4 *) (outBytes + (i + e) * outStride);
+        }
+        sBuildWorldMatrices4(in, dst);
+    }
+
+    if (i == count) return;
+
+    // Pad the last few out to a full step.
+    size_t remaining = count - i;
+    float padded[kStreamCount][4] = {};
+    matrix4 scratch[4];
+    for (int s = 0; s < kStreamCount; s++) {
+        memcpy(padded[s], streams[s]->data() + first + i, remaining * sizeof(float));
+        in[s] = padded[s];
+    }
+    for (int e = 0; e < 4; e++) {
+        dst[e] = &scratch[e];
+    }
+    sBuildWorldMatrices4(in, dst);
+    for (size_t e = 0; e < remaining; e++) {
+        *(matrix4 *) (outBytes + (i + e) * outStride) = scratch[e];
+    }
+}
@@ -0,0 +1,144 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_ENTITYSTORE_H
+#define GPU_EMULATION_STRESS_TEST_ENTITYSTORE_H
+
+#include "Entity.h"
+#include "matrix.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t entity_handle_t;
+
+// All entities as parallel arrays, one per component, so that batch
+// passes (animation, lifetimes, world matrices) only stream the fields
+// they use. Entity is the by-value view for code that works on one
+// entity at a time; get() gathers one and set() scatters it back.
+//
+// The arrays are dense: destroying an entity moves the last one into
+// its place. Entities are named by handles, which stay valid until the
+// entity is destroyed. A handle is a slot plus the generation of that
+// slot; slots are reused through a free list and their generation
+// bumped, so a stale handle never names a newer entity. Methods taking
+// |index| are in dense order; handles[index] names that entity.
+//
+// New entities and the setters flag kDirty, so that state derived from
+// the transform or model, like world matrices, only has to be redone
+// for entities that changed. Whoever caches that state clears it.
+class EntityStore {
+public:
+    static const uint32_t kSlotBits = 20;
+    static const uint32_t kSlotMask = (1u << kSlotBits) - 1;
+    static const entity_handle_t kInvalidHandle = ~0u;
+
+    static uint32_t slotOf(entity_handle_t handle) { return handle & kSlotMask; }
+
+    enum Flags : uint8_t {
+        kRenderable = 1 << 0,
+        kLive = 1 << 1,
+        kFrameKnown = 1 << 2,
+        kDirty = 1 << 3,
+        // Drawn as part of a StaticBatches batch, not on its own.
+        kBatched = 1 << 4,
+    };
+
+    struct Lifetime {
+        uint32_t lastFrame;
+        int framesToLive;
+    };
+
+    EntityStore() = default;
+
+    size_t size() const { return flags.size(); }
+
+    // Number of slots ever used; a bound for per-slot side tables.
+    size_t slotCount() const { return mSlots.size(); }
+
+    entity_handle_t spawn();
+
+    // Spawns entities until |handle|, as a generation 0 handle, names
+    // one. Used for the handles authored in the scene file, before
+    // anything has been destroyed.
+    void spawnUpTo(entity_handle_t handle);
+
+    void destroy(entity_handle_t handle);
+
+    bool valid(entity_handle_t handle) const {
+        uint32_t slot = slotOf(handle);
+        return slot < mSlots.size() &&
+               mSlots[slot].handle == handle &&
+               mSlots[slot].index != kNoIndex;
+    }
+
+    size_t indexOf(entity_handle_t handle) const { return mSlots[slotOf(handle)].index; }
+
+    Entity get(entity_handle_t handle) const;
+
+    void set(entity_handle_t handle, const Entity &entity);
+
+    vector4 pos(entity_handle_t handle) const {
+        size_t i = indexOf(handle);
+        return makevector4(posX[i], posY[i], posZ[i], 1.0f);
+    }
+
+    void setFrame(entity_handle_t handle, const vector4 &pos, const quaternion &orientation);
+
+    void setScale(entity_handle_t handle, const vector4 &scale);
+
+    void setRenderable(entity_handle_t handle, bool renderable);
+
+    bool live(entity_handle_t handle) const { return flags[indexOf(handle)] & kLive; }
+
+    // Counts down lifetimes to |currFrame|; returns false for entities
+    // that just died. They stay in the store until destroyed.
+    bool updateLifetime(size_t index, uint32_t currFrame);
+
+    // Writes the world matrices of entities [first, first + count) to
+    // |out|, advancing |outStride| bytes per entity. Works on four
+    // entities per step; same result as Entity::updateWorldMatrix.
+    void buildWorldMatrices(size_t first, size_t count,
+                            matrix4 *out, size_t outStride) const;
+
+    std::vector<float> posX, posY, posZ;
+    // Orientation as a unit quaternion.
+    std::vector<float> rotX, rotY, rotZ, rotW;
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<render_state_handle_t> renderModel;
+    std::vector<uint8_t> flags;
+    std::vector<Lifetime> lifetimes;
+    std::vector<entity_handle_t> handles;
+
+private:
+    static const uint32_t kNoIndex = ~0u;
+
+    struct Slot {
+        // Handle of the current or, once destroyed, last occupant.
+        entity_handle_t handle;
+        uint32_t index;
+    };
+
+    void resize(size_t count);
+
+    void move(size_t from, size_t to);
+
+    std::vector<Slot> mSlots;
+    std::vector<uint32_t> mFreeSlots;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_ENTITYSTORE_H
@@ -23,6 +23,10 @@
 
 static FileLoader *sFileLoader = nullptr;
 
+// Written by tools/make_asset_pack.py. Stored uncompressed in the APK,
+// so the asset buffer is a mapping of the APK itself.
+static const char kAssetPackName[] = "assets.pack";
+
 // static
 FileLoader *FileLoader::get() {
     if (!sFileLoader) sFileLoader = new FileLoader();
@@ -31,6 +35,31 @@ FileLoader *FileLoader::get() {
 
 void FileLoader::initWithAssetManager(AAssetManager *assetManager) {
     mAssetManager = assetManager;
+    openAssetPack();
+}
+
+void FileLoader::openAssetPack() {
+    if (mPackAsset) {
+        AAsset_close(mPackAsset);
+        mPackAsset = nullptr;
+    }
+
+    AAsset *asset = AAssetManager_open(mAssetManager, kAssetPackName, AASSET_MODE_BUFFER);
+    if (!asset) {
+        LOGV("%s: no asset pack, using loose assets", __func__);
+        return;
+    }
+
+    const void *data = AAsset_getBuffer(asset);
+    size_t size = (size_t) AAsset_getLength(asset);
+    if (!data || !mPack.open(data, size)) {
+        LOGE("Error opening asset pack %s", kAssetPackName);
+        AAsset_close(asset);
+        return;
+    }
+
+    mPackAsset = asset;
+    LOGD("%s: %zu entries, %zu bytes", __func__, mPack.entryCount(), size);
 }
 
 std::vector<unsigned char> FileLoader::loadFileFromAssets(const std::string &filename) {
@@ -38,6 +67,11 @@ std::vector<unsigned char> FileLoader::loadFileFromAssets(const std::string &fil
 
     std::vector<unsigned char> empty;
 
+    if (mPack.isOpen()) {
+        std::vector<unsigned char> res;
+        if (mPack.read(filename, res)) return res;
+    }
+
     AAsset *asset = AAssetManager_open(
             mAssetManager, filename.c_str(),
             AASSET_MODE_UNKNOWN);
@@ -17,6 +17,8 @@
 #ifndef GPU_EMULATION_STRESS_TEST_FILELOADER_H
 #define GPU_EMULATION_STRESS_TEST_FILELOADER_H
 
+#include "AssetPack.h"
+
 #include <android/asset_manager.h>
 
 #include <string>
@@ -34,13 +36,21 @@ public:
 
     static FileLoader *get();
 
+    // Also opens the asset pack, if the APK has one. Files in the pack
+    // are then served from it; anything else falls back to the asset
+    // manager.
     void initWithAssetManager(AAssetManager *assetManager);
 
     std::vector<unsigned char> loadFileFromAssets(const std::string &filename);
 
 private:
+    void openAssetPack();
+
     AAssetManager *mAssetManager = nullptr;
     char *buffer = nullptr;
+
+    AAsset *mPackAsset = nullptr;
+    AssetPack mPack;
 };
 
 #endif //GPU_EMULATION_STRESS_TEST_FILELOADER_H
@@ -278,4 +278,122 @@ void main() {
     fragData[1] = vec4(0.5, 0.5, 0.0, 0.0);
 })";
 
+// Particles moved on the GPU. The update pass writes each live
+// particle's world matrix, now and at the last frame, with transform
+// feedback; the draws read them per instance.
+static const char *const sParticleUpdateVShaderSrc = R"(#version 330 core
+uniform sampler2D path;
+uniform float frameTime;
+uniform float lastFrameTime;
+uniform float lifetime;
+uniform float movingFrames;
+
+layout (location = 0) in vec4 spawnFrameOffset;
+layout (location = 1) in vec4 spinAxisPeriod;
+layout (location = 2) in vec4 orientation;
+layout (location = 3) in float scale;
+
+out vec4 world0;
+out vec4 world1;
+out vec4 world2;
+out vec4 world3;
+out vec4 worldPrev0;
+out vec4 worldPrev1;
+out vec4 worldPrev2;
+out vec4 worldPrev3;
+
+// Rotation by b followed by a.
+vec4 qmul(vec4 a, vec4 b) {
+    return vec4(a.w * b.xyz + b.w * a.xyz + cross(a.xyz, b.xyz),
+                a.w * b.w - dot(a.xyz, b.xyz));
+}
+
+// The path is sampled at even steps of arclength up to where
+// particles stop.
+vec3 pathAt(float movedFrames) {
+    int last = textureSize(path, 0).x - 1;
+    float x = movedFrames / movingFrames * float(last);
+    int i = min(int(x), last - 1);
+    return mix(texelFetch(path, ivec2(i, 0), 0).xyz,
+               texelFetch(path, ivec2(i + 1, 0), 0).xyz,
+               x - float(i));
+}
+
+// All zeros, which draws nothing, unless the particle is alive.
+mat4 worldAt(float time) {
+    float age = time - spawnFrameOffset.x;
+    if (age < 0.0 || age >= lifetime) return mat4(0.0);
+
+    float movedFrames = min(age, movingFrames);
+    float halfAngle = 3.14159265 * movedFrames / spinAxisPeriod.w;
+    vec4 q = qmul(vec4(sin(halfAngle) * spinAxisPeriod.xyz, cos(halfAngle)), orientation);
+
+    vec3 q2 = 2.0 * q.xyz;
+    vec3 wq2 = q.w * q2;
+    float xx = q.x * q2.x, yy = q.y * q2.y, zz = q.z * q2.z;
+    float xy = q.x * q2.y, yz = q.y * q2.z, xz = q.x * q2.z;
+    return mat4(vec4(scale * vec3(1.0 - yy - zz, xy + wq2.z, xz - wq2.y), 0.0),
+                vec4(scale * vec3(xy - wq2.z, 1.0 - xx - zz, yz + wq2.x), 0.0),
+                vec4(scale * vec3(xz + wq2.y, yz - wq2.x, 1.0 - xx - yy), 0.0),
+                vec4(pathAt(movedFrames) + spawnFrameOffset.yzw, 1.0));
+}
+
+void main() {
+    mat4 world = worldAt(frameTime);
+    mat4 worldPrev = lastFrameTime < spawnFrameOffset.x ? world : worldAt(lastFrameTime);
+    world0 = world[0];
+    world1 = world[1];
+    world2 = world[2];
+    world3 = world[3];
+    worldPrev0 = worldPrev[0];
+    worldPrev1 = worldPrev[1];
+    worldPrev2 = worldPrev[2];
+    worldPrev3 = worldPrev[3];
+})";
+
+static const char *const sParticleUpdateFShaderSrc = R"(#version 330 core
+void main() {
+})";
+
+static const char *const sParticleDepthMapVShaderSrc = R"(#version 330 core
+uniform mat4 projmatrix;
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 v3NormalIn;
+layout (location = 2) in vec2 v2TexCoordsIn;
+layout (location = 3) in mat4 worldmatrix;
+out vec4 coordVarying;
+void main() {
+    coordVarying = projmatrix * worldmatrix * vec4(position.xyz, 1);
+    gl_Position = coordVarying;
+})";
+
+static const char *const sParticleShadowRenderVShaderSrc = R"(#version 330 core
+uniform mat4 projmatrix;
+uniform mat4 projMatrixLight;
 
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 v3NormalIn;
+layout (location = 2) in vec2 v2TexCoordsIn;
+
+layout (location = 3) in mat4 worldmatrix;
+layout (location = 7) in mat4 worldmatrixPrev;
+
+out vec2 v2TexCoord;
+
+out vec4 prevPos;
+out vec4 fragPos;
+out vec3 fragNorm;
+
+out vec4 depthMapCoord;
+
+void main() {
+    v2TexCoord = v2TexCoordsIn;
+
+    vec4 worldPos = worldmatrix * vec4(position.xyz, 1);
+    prevPos = worldmatrixPrev * vec4(position.xyz, 1);
+    fragPos = worldPos;
+    fragNorm = (worldmatrix * vec4(v3NormalIn, 1)).xyz;
+
+    depthMapCoord = projMatrixLight * worldPos;
+    gl_Position = projmatrix * worldPos;
+})";
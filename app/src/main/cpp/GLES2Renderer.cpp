@@ -19,6 +19,11 @@
 
 #include "log.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
 void GLES2Renderer::reInit(WorldState *worldState, int width, int height) {
 
     windowWidth = width;
@@ -32,11 +37,15 @@ void GLES2Renderer::reInit(WorldState *worldState, int width, int height) {
     glDisable(GL_BLEND);
 
     world = worldState;
+    world->prepareAssetsForUpload();
 
     currentCameraMatrix = identity4();
 
     renderStates.clear();
-    objects.clear();
+    meshBuffersByContent.clear();
+    texturesByContent.clear();
+    staticBatchDraws.clear();
+    snapshot = nullptr;
 
     if (shadowMapsEnabled && world->lights.size() != 0) {
         initShadowRendererState();
@@ -53,6 +62,14 @@ void GLES2Renderer::reInit(WorldState *worldState, int width, int height) {
         initRenderModel(model);
     }
 
+    for (const auto &batch : world->staticBatches.batches) {
+        initStaticBatch(batch);
+    }
+
+    occlusion.setOccluders(world->entities, world->renderModels);
+
+    world->onAssetsUploaded();
+
     // init skybox
 }
 
@@ -344,51 +361,67 @@ void GLES2Renderer::initRenderModel(const RenderModel &model) {
 
     GLuint vbo, ibo;
 
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ibo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    // LOGD("New vbo %u vertex bytes %d", vbo, model.geometry.vertexData.size() * sizeof(OBJParse::VertexAttributes));
-    glBufferData(GL_ARRAY_BUFFER,
-                 model.geometry.vertexData.size() * sizeof(OBJParse::VertexAttributes),
-                 &model.geometry.vertexData[0], GL_STATIC_DRAW);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 model.geometry.indexData.size() * sizeof(uint16_t),
-                 &model.geometry.indexData[0], GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(aPosLoc);
-    glEnableVertexAttribArray(aNormLoc);
-    glEnableVertexAttribArray(aTexcoordLoc);
-    glVertexAttribPointer(aPosLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes), 0);
-    glVertexAttribPointer(aNormLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
-                          (void *) (uintptr_t) (3 * sizeof(GLfloat)));
-    glVertexAttribPointer(aTexcoordLoc, 2, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
-                          (void *) (uintptr_t) (6 * sizeof(GLfloat)));
-
-    glDisableVertexAttribArray(aPosLoc);
-    glDisableVertexAttribArray(aNormLoc);
-    glDisableVertexAttribArray(aTexcoordLoc);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    auto buffers = meshBuffersByContent.find(model.geometryHash);
+    if (buffers != meshBuffersByContent.end()) {
+        vbo = buffers->second.vbo;
+        ibo = buffers->second.ibo;
+    } else {
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ibo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        // LOGD("New vbo %u vertex bytes %d", vbo, model.geometry->vertexData.size() * sizeof(OBJParse::VertexAttributes));
+        glBufferData(GL_ARRAY_BUFFER,
+                     model.geometry->vertexData.size() * sizeof(OBJParse::VertexAttributes),
+                     &model.geometry->vertexData[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                     model.geometry->indexData.size() * sizeof(uint16_t),
+                     &model.geometry->indexData[0], GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(aPosLoc);
+        glEnableVertexAttribArray(aNormLoc);
+        glEnableVertexAttribArray(aTexcoordLoc);
+        glVertexAttribPointer(aPosLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes), 0);
+        glVertexAttribPointer(aNormLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                              (void *) (uintptr_t) (3 * sizeof(GLfloat)));
+        glVertexAttribPointer(aTexcoordLoc, 2, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                              (void *) (uintptr_t) (6 * sizeof(GLfloat)));
+
+        glDisableVertexAttribArray(aPosLoc);
+        glDisableVertexAttribArray(aNormLoc);
+        glDisableVertexAttribArray(aTexcoordLoc);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        meshBuffersByContent[model.geometryHash] = {vbo, ibo, 0};
+    }
 
     // init texture
 
     GLuint texture;
-    glGenTextures(1, &texture);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, model.diffuseTexWidth, model.diffuseTexHeight, 0,
-                 GL_RGBA, GL_UNSIGNED_BYTE, &model.diffuseRGBA8[0]);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    auto sharedTexture = texturesByContent.find(model.diffuseHash);
+    if (sharedTexture != texturesByContent.end()) {
+        texture = sharedTexture->second;
+    } else {
+        glGenTextures(1, &texture);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, model.diffuseTexWidth, model.diffuseTexHeight, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, &model.diffuse->rgba8[0]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        texturesByContent[model.diffuseHash] = texture;
+    }
 
     renderStates.push_back({
                                    shaderProgram,
@@ -405,49 +438,212 @@ void GLES2Renderer::initRenderModel(const RenderModel &model) {
                                    0, 0, 0 /* VAO, prev world and camera matrices */});
 }
 
-void GLES2Renderer::preDrawUpdate() {
-    //ScopedProfiler updateProfile("preDrawUpdateProfile");
-
-    const WorldState::CameraInfo &caminfo =
-            world->cameraInfos[world->currentCamera];
-    world->entities[world->currentCamera].updateCameraMatrix(
-            caminfo.fov, caminfo.aspect,
-            caminfo.near, caminfo.far,
-            caminfo.right, caminfo.isOrtho,
-            currentCameraMatrix);
-
-    if (hasSkybox) {
-        world->entities[world->currentCamera].updateCameraSkyboxMatrix(
-                caminfo.fov, caminfo.aspect,
-                caminfo.near, caminfo.far,
-                caminfo.right, caminfo.isOrtho,
-                currentCameraSkyboxMatrix);
+void GLES2Renderer::initStaticBatch(const StaticBatches::Batch &batch) {
+    GLuint vbo, ibo;
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ibo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ARRAY_BUFFER,
+                 batch.vertexData.size() * sizeof(OBJParse::VertexAttributes),
+                 &batch.vertexData[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 batch.indexData.size() * sizeof(uint16_t),
+                 &batch.indexData[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // Same shader and texture as the model it takes its texture from.
+    RenderState state = renderStates[batch.textureModel];
+    state.vbo = vbo;
+    state.ibo = ibo;
+    renderStates.push_back(state);
+    staticBatchDraws.push_back({(render_state_handle_t) (renderStates.size() - 1),
+                                batch.indexCount, batch.bounds});
+}
+
+void GLES2Renderer::preDrawUpdate(const RenderSnapshot &frame) {
+    snapshot = &frame;
+    currentCameraMatrix = frame.cameraMatrix;
+    currentCameraSkyboxMatrix = frame.cameraSkyboxMatrix;
+    currentLightMatrix = frame.lightMatrix;
+    shadowLightPos_x = frame.lightPos.x;
+    shadowLightPos_y = frame.lightPos.y;
+    shadowLightPos_z = frame.lightPos.z;
+
+    selectLods();
+    cull(currentCameraMatrix, RenderSnapshot::kInCameraView, cameraVisible);
+    if (occlusionCullingEnabled) {
+        occlusionCull(cameraVisible);
+    }
+    if (shadowMapsEnabled && frame.hasLight) {
+        cull(currentLightMatrix, RenderSnapshot::kInLightView, lightVisible);
+    } else {
+        // Nothing casts shadows without a light.
+        lightVisible.objects.clear();
+        lightVisible.batches.clear();
     }
 
-    if (shadowMapsEnabled) {
-        const WorldState::CameraInfo &caminfo =
-                world->cameraInfos[world->currentLight];
-        world->entities[world->currentLight].updateCameraMatrix(
-                caminfo.fov, caminfo.aspect,
-                caminfo.near, caminfo.far,
-                caminfo.right, caminfo.isOrtho,
-                currentLightMatrix);
-        shadowLightPos_x = world->entities[world->currentLight].pos.x;
-        shadowLightPos_y = world->entities[world->currentLight].pos.y;
-        shadowLightPos_z = world->entities[world->currentLight].pos.z;
+    for (uint32_t index : cameraVisible.objects) {
+        uint32_t level = objectDraws[index].lodLevel;
+        if (level >= lodHistogram.size()) lodHistogram.resize(level + 1, 0);
+        lodHistogram[level]++;
     }
+    lodHistogramFrames++;
+}
+
+// World space bounding sphere of |model| placed by |world|.
+static void sWorldSphere(const RenderModel &model, const matrix4 &world, float center[3],
+                         float *radius) {
+    float scaleSq = 0.0f;
+    for (int row = 0; row < 3; row++) {
+        center[row] = world.vals[12 + row];
+        for (int col = 0; col < 3; col++) {
+            center[row] += world.vals[col * 4 + row] * model.boundsCenter[col];
+        }
+        const float *axis = &world.vals[row * 4];
+        scaleSq = std::max(scaleSq, axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    }
+    *radius = model.boundsRadius * sqrtf(scaleSq);
+}
+
+// Projected sphere diameter, as a fraction of the viewport height, from
+// which each level of detail is replaced by the next coarser one.
+static const float kLodScreenSizes[] = {0.08f, 0.03f, 0.01f};
+static const uint32_t kMaxLodLevel = sizeof(kLodScreenSizes) / sizeof(kLodScreenSizes[0]);
+
+// How much bigger than its threshold an object must get to go back to
+// a finer level, so that objects near one don't flicker between two.
+static const float kLodHysteresis = 1.25f;
+
+void GLES2Renderer::selectLods() {
+    const auto &objects = snapshot->objects;
+    objectDraws.resize(objects.size());
+
+    // Clip space units per world space unit along the view's up axis;
+    // the view itself is rigid.
+    const float *vp = currentCameraMatrix.vals;
+    float clipPerUnit = sqrtf(vp[1] * vp[1] + vp[5] * vp[5] + vp[9] * vp[9]);
+
+    for (size_t i = 0; i < objects.size(); i++) {
+        const auto &obj = objects[i];
+        ObjectDraw &draw = objectDraws[i];
+        draw.renderHandle = obj.renderHandle;
+        draw.indexCount = obj.indexCount;
+        draw.lodLevel = 0;
+
+        const RenderModel &model = world->renderModels[obj.renderHandle];
+        if (!lodEnabled || !obj.visible || model.lods.empty()) continue;
+
+        uint32_t slot = EntityStore::slotOf(obj.handle);
+        if (slot >= lodStates.size()) {
+            lodStates.resize(slot + 1, LodState{EntityStore::kInvalidHandle, 0});
+        }
+        LodState &state = lodStates[slot];
+        if (state.handle != obj.handle) {
+            state.handle = obj.handle;
+            state.level = 0;
+        }
+
+        float center[3], radius;
+        sWorldSphere(model, obj.worldMatrix, center, &radius);
+        float w = vp[3] * center[0] + vp[7] * center[1] + vp[11] * center[2] + vp[15];
+        // Behind the camera, the level stays as it was.
+        if (w > 0.0f) {
+            float size = radius * clipPerUnit / w;
+            uint32_t maxLevel = std::min((uint32_t) model.lods.size(), kMaxLodLevel);
+            while (state.level < maxLevel && size < kLodScreenSizes[state.level]) {
+                state.level++;
+            }
+            while (state.level > 0 && size > kLodScreenSizes[state.level - 1] * kLodHysteresis) {
+                state.level--;
+            }
+        }
+
+        draw.lodLevel = state.level;
+        if (state.level > 0) {
+            draw.renderHandle = model.lods[state.level - 1];
+            draw.indexCount = world->renderModels[draw.renderHandle].indexCount;
+        }
+    }
+}
 
-    objects.resize(world->entities.size());
+void GLES2Renderer::logLodHistogram() {
+    if (!lodHistogramFrames) return;
 
-    uint32_t oi = 0;
-    for (const auto &ent : world->entities) {
-        objects[oi].visible = ent.renderable;
-        objects[oi].renderHandle = ent.renderModel;
-        objects[oi].indexCount = (uint32_t) world->renderModels[ent.renderModel].geometry.indexData.size();
-        ent.updateWorldMatrix(objects[oi].worldMatrix);
-        oi++;
+    std::string levels;
+    char level[32];
+    for (size_t i = 0; i < lodHistogram.size(); i++) {
+        snprintf(level, sizeof(level), " %zu: %.1f", i,
+                 (double) lodHistogram[i] / lodHistogramFrames);
+        levels += level;
     }
+    LOGD("LOD objects/frame by level:%s", levels.c_str());
 
+    lodHistogram.clear();
+    lodHistogramFrames = 0;
+}
+
+// Tests the bounding sphere first, as it is cheaper, and the box only
+// when the sphere straddles the frustum.
+static bool sInFrustum(const Frustum &frustum, const RenderModel &model, const matrix4 &world) {
+    float center[3], radius;
+    sWorldSphere(model, world, center, &radius);
+
+    Overlap overlap = frustum.testSphere(center, radius);
+    if (overlap != kPartial) return overlap == kInside;
+    return frustum.test(Aabb::transformed(model.boundsMin, model.boundsMax, world)) != kOutside;
+}
+
+void GLES2Renderer::occlusionCull(GLES2Renderer::VisibleSet &visible) {
+    occlusion.begin(currentCameraMatrix);
+    for (uint32_t index : visible.objects) {
+        render_state_handle_t handle = objectDraws[index].renderHandle;
+        if (occlusion.isOccluder(handle)) {
+            occlusion.addOccluder(handle, snapshot->objects[index].worldMatrix);
+        }
+    }
+    occlusion.finishOccluders();
+
+    // Occluders are kept, rather than tested against their own depth.
+    auto occluded = [this](uint32_t index) -> bool {
+        render_state_handle_t handle = objectDraws[index].renderHandle;
+        if (occlusion.isOccluder(handle)) return false;
+        const RenderModel &model = world->renderModels[handle];
+        return occlusion.isOccluded(Aabb::transformed(model.boundsMin, model.boundsMax,
+                                                      snapshot->objects[index].worldMatrix));
+    };
+    visible.objects.erase(std::remove_if(visible.objects.begin(), visible.objects.end(), occluded),
+                          visible.objects.end());
+
+    visible.batches.erase(
+            std::remove_if(visible.batches.begin(), visible.batches.end(),
+                           [this](uint32_t index) {
+                               return occlusion.isOccluded(staticBatchDraws[index].bounds);
+                           }),
+            visible.batches.end());
+}
+
+void GLES2Renderer::cull(const matrix4 &viewProj, uint8_t view,
+                         GLES2Renderer::VisibleSet &visible) {
+    Frustum frustum(viewProj);
+
+    visible.objects.clear();
+    for (uint32_t i = 0; i < (uint32_t) snapshot->objects.size(); i++) {
+        const auto &obj = snapshot->objects[i];
+        if (!obj.visible || !(obj.inView & view)) continue;
+        if (sInFrustum(frustum, world->renderModels[objectDraws[i].renderHandle],
+                       obj.worldMatrix)) {
+            visible.objects.push_back(i);
+        }
+    }
+
+    visible.batches.clear();
+    for (uint32_t i = 0; i < (uint32_t) staticBatchDraws.size(); i++) {
+        if (frustum.test(staticBatchDraws[i].bounds) != kOutside) {
+            visible.batches.push_back(i);
+        }
+    }
 }
 
 void
@@ -530,6 +726,7 @@ void GLES2Renderer::changeRenderState(render_state_handle_t handle, bool forDept
 
 void GLES2Renderer::draw() {
     render_state_handle_t lastRenderState = -1;
+    const matrix4 identity = identity4();
     setModelVertexAttribs();
 
     if (shadowMapsEnabled) {
@@ -548,12 +745,20 @@ void GLES2Renderer::draw() {
 
         {
             // ScopedProfiler updateProfile("shadowDraw");
-            for (const auto &obj: objects) {
-                if (!(obj.visible)) continue;
-                changeRenderState(obj.renderHandle, true);
+            for (uint32_t index : lightVisible.objects) {
+                const auto &obj = snapshot->objects[index];
+                const ObjectDraw &draw = objectDraws[index];
+                changeRenderState(draw.renderHandle, true);
                 glUniformMatrix4fv(depthMapWorldMatrixLoc,
                                    1, GL_FALSE, (currentLightMatrix * obj.worldMatrix).vals);
-                glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_SHORT, 0);
+                glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_SHORT, 0);
+            }
+            for (uint32_t index : lightVisible.batches) {
+                const auto &batch = staticBatchDraws[index];
+                changeRenderState(batch.renderHandle, true);
+                glUniformMatrix4fv(depthMapWorldMatrixLoc,
+                                   1, GL_FALSE, currentLightMatrix.vals);
+                glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
             }
         }
 
@@ -582,16 +787,28 @@ void GLES2Renderer::draw() {
 
         {
             // ScopedProfiler updateProfile("litDraw");
-            for (const auto &obj: objects) {
-                if (!(obj.visible)) continue;
-                changeRenderState(obj.renderHandle);
+            for (uint32_t index : cameraVisible.objects) {
+                const auto &obj = snapshot->objects[index];
+                const ObjectDraw &draw = objectDraws[index];
+                changeRenderState(draw.renderHandle);
                 glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
                                    1, GL_FALSE, (obj.worldMatrix).vals);
                 glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
                                    1, GL_FALSE, currentCameraMatrix.vals);
                 glUniformMatrix4fv(shadowRenderLightMatrixLoc,
                                    1, GL_FALSE, currentLightMatrix.vals);
-                glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_SHORT, 0);
+                glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_SHORT, 0);
+            }
+            for (uint32_t index : cameraVisible.batches) {
+                const auto &batch = staticBatchDraws[index];
+                changeRenderState(batch.renderHandle);
+                glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
+                                   1, GL_FALSE, identity.vals);
+                glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
+                                   1, GL_FALSE, currentCameraMatrix.vals);
+                glUniformMatrix4fv(shadowRenderLightMatrixLoc,
+                                   1, GL_FALSE, currentLightMatrix.vals);
+                glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
             }
         }
 
@@ -600,14 +817,24 @@ void GLES2Renderer::draw() {
         }
     } else {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        for (const auto &obj: objects) {
-            if (!(obj.visible)) continue;
-            changeRenderState(obj.renderHandle);
+        for (uint32_t index : cameraVisible.objects) {
+            const auto &obj = snapshot->objects[index];
+            const ObjectDraw &draw = objectDraws[index];
+            changeRenderState(draw.renderHandle);
             glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
                                1, GL_FALSE, (obj.worldMatrix).vals);
             glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
                                1, GL_FALSE, currentCameraMatrix.vals);
-            glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_SHORT, 0);
+            glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_SHORT, 0);
+        }
+        for (uint32_t index : cameraVisible.batches) {
+            const auto &batch = staticBatchDraws[index];
+            changeRenderState(batch.renderHandle);
+            glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
+                               1, GL_FALSE, identity.vals);
+            glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
+                               1, GL_FALSE, currentCameraMatrix.vals);
+            glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
         }
     }
 
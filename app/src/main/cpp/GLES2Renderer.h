@@ -17,6 +17,8 @@
 #ifndef GPU_EMULATION_STRESS_TEST_GLES2RENDERER_H
 #define GPU_EMULATION_STRESS_TEST_GLES2RENDERER_H
 
+#include "OcclusionCuller.h"
+#include "RenderSnapshot.h"
 #include "WorldState.h"
 
 #ifdef DESKTOP_GL
@@ -31,6 +33,7 @@
 #endif
 
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 
 class GLES2Renderer {
@@ -49,7 +52,13 @@ public:
 
     virtual void initRenderModel(const RenderModel &model);
 
-    virtual void preDrawUpdate();
+    // Uploads |batch| and adds a render state for it, after those of
+    // the models.
+    virtual void initStaticBatch(const StaticBatches::Batch &batch);
+
+    // Takes the camera, light and objects to draw next from |snapshot|,
+    // which must stay valid until then.
+    virtual void preDrawUpdate(const RenderSnapshot &snapshot);
 
     virtual void draw();
 
@@ -89,6 +98,72 @@ public:
     RenderState currRenderState;
     std::vector<RenderState> renderStates;
 
+    // GL objects by asset content hash, shared by every model with the
+    // same mesh or texture. Reset along with renderStates.
+    struct MeshBuffers {
+        GLuint vbo;
+        GLuint ibo;
+        GLuint vao;
+    };
+    std::unordered_map<uint64_t, MeshBuffers> meshBuffersByContent;
+    std::unordered_map<uint64_t, GLuint> texturesByContent;
+
+    // One per static batch. Batches are in world space, so they are
+    // drawn with an identity world matrix.
+    struct StaticBatchDraw {
+        render_state_handle_t renderHandle;
+        uint32_t indexCount;
+        Aabb bounds;
+    };
+    std::vector<StaticBatchDraw> staticBatchDraws;
+
+    // What preDrawUpdate found in a pass's view: indices into the
+    // snapshot's objects and into |staticBatchDraws|.
+    struct VisibleSet {
+        std::vector<uint32_t> objects;
+        std::vector<uint32_t> batches;
+    };
+    VisibleSet cameraVisible;
+    VisibleSet lightVisible;
+
+    // Only objects the snapshot has in |view| (RenderSnapshot::kIn*View)
+    // are tested; the simulation already dropped the rest.
+    virtual void cull(const matrix4 &viewProj, uint8_t view, VisibleSet &visible);
+
+    // Drops what the occluders in view hide from the camera.
+    bool occlusionCullingEnabled = true;
+    OcclusionCuller occlusion;
+
+    virtual void occlusionCull(VisibleSet &visible);
+
+    // Model and index count each of the snapshot's objects is drawn
+    // with, once its level of detail is picked.
+    struct ObjectDraw {
+        render_state_handle_t renderHandle;
+        uint32_t indexCount;
+        uint32_t lodLevel;
+    };
+    std::vector<ObjectDraw> objectDraws;
+
+    // Picks levels of detail by projected size on the camera.
+    bool lodEnabled = true;
+
+    virtual void selectLods();
+
+    // Level last picked per entity slot, for hysteresis.
+    struct LodState {
+        entity_handle_t handle;
+        uint32_t level;
+    };
+    std::vector<LodState> lodStates;
+
+    // Objects the camera pass drew at each level, summed over frames.
+    std::vector<uint64_t> lodHistogram;
+    uint64_t lodHistogramFrames = 0;
+
+    // Logs and resets |lodHistogram|.
+    virtual void logLodHistogram();
+
     bool shadowMapsEnabled = true;
 
     virtual void initShadowRendererState();
@@ -124,17 +199,7 @@ public:
 
     virtual void setSkyboxVertexAttribs();
 
-    // hopefully, we can sort objects so that
-    // render state doesn't change very much.
-    struct ObjectState {
-        bool visible;
-        render_state_handle_t renderHandle;
-        uint32_t indexCount;
-        matrix4 worldMatrix;
-        matrix4 lastWorldMatrix; // for motion blur
-    };
-
-    std::vector<ObjectState> objects;
+    const RenderSnapshot *snapshot = nullptr;
 };
 
 
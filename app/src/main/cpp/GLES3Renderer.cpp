@@ -19,6 +19,8 @@
 
 #include "log.h"
 
+#include <cstddef>
+
 #if DESKTOP_GL
 #include "GLCoreShaders.cpp"
 #else
@@ -43,11 +45,16 @@ void GLES3Renderer::reInit(WorldState *worldState, int width, int height) {
     glDisable(GL_BLEND);
 
     world = worldState;
+    world->prepareAssetsForUpload();
 
     currentCameraMatrix = identity4();
 
     renderStates.clear();
-    objects.clear();
+    meshBuffersByContent.clear();
+    texturesByContent.clear();
+    staticBatchDraws.clear();
+    gpuParticleDraws.clear();
+    snapshot = nullptr;
 
     if (shadowMapsEnabled && world->lights.size() != 0) {
         initShadowRendererState();
@@ -63,6 +70,23 @@ void GLES3Renderer::reInit(WorldState *worldState, int width, int height) {
     for (const auto &model : world->renderModels) {
         initRenderModel(model);
     }
+
+    for (const auto &batch : world->staticBatches.batches) {
+        initStaticBatch(batch);
+    }
+
+    // The world only hands particles over when it has a light to draw
+    // them with, in the shadow mapped pass.
+    if (world->gpuParticles) {
+        if (!shadowMapsEnabled) {
+            LOGE("GPU particles are only drawn with shadow maps enabled");
+        }
+        initGpuParticles();
+    }
+
+    occlusion.setOccluders(world->entities, world->renderModels);
+
+    world->onAssetsUploaded();
 }
 
 GLuint GLES3Renderer::compileAndValidateShader(GLenum shaderType, const char *src) {
@@ -373,7 +397,12 @@ void GLES3Renderer::initRenderModel(const RenderModel &model) {
         uWorldMatrixPrevLoc = glGetUniformLocation(shaderProgram, "worldmatrixPrev");
     }
 
-    {
+    auto buffers = meshBuffersByContent.find(model.geometryHash);
+    if (buffers != meshBuffersByContent.end()) {
+        vbo = buffers->second.vbo;
+        ibo = buffers->second.ibo;
+        vao = buffers->second.vao;
+    } else {
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
         glGenBuffers(1, &ibo);
@@ -382,11 +411,11 @@ void GLES3Renderer::initRenderModel(const RenderModel &model) {
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
         glBufferData(GL_ARRAY_BUFFER,
-                     model.geometry.vertexData.size() * sizeof(OBJParse::VertexAttributes),
-                     &model.geometry.vertexData[0], GL_STATIC_DRAW);
+                     model.geometry->vertexData.size() * sizeof(OBJParse::VertexAttributes),
+                     &model.geometry->vertexData[0], GL_STATIC_DRAW);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                     model.geometry.indexData.size() * sizeof(uint32_t),
-                     &model.geometry.indexData[0], GL_STATIC_DRAW);
+                     model.geometry->indexData.size() * sizeof(uint32_t),
+                     &model.geometry->indexData[0], GL_STATIC_DRAW);
 
         glEnableVertexAttribArray(aPosLoc);
         glEnableVertexAttribArray(aNormLoc);
@@ -407,16 +436,21 @@ void GLES3Renderer::initRenderModel(const RenderModel &model) {
 
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        meshBuffersByContent[model.geometryHash] = {vbo, ibo, vao};
     }
 
     // init texture
-    {
+    auto sharedTexture = texturesByContent.find(model.diffuseHash);
+    if (sharedTexture != texturesByContent.end()) {
+        texture = sharedTexture->second;
+    } else {
         glGenTextures(1, &texture);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texture);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, model.diffuseTexWidth, model.diffuseTexHeight, 0,
-                     GL_RGBA, GL_UNSIGNED_BYTE, &model.diffuseRGBA8[0]);
+                     GL_RGBA, GL_UNSIGNED_BYTE, &model.diffuse->rgba8[0]);
         glGenerateMipmap(GL_TEXTURE_2D);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -425,6 +459,8 @@ void GLES3Renderer::initRenderModel(const RenderModel &model) {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
         glBindTexture(GL_TEXTURE_2D, 0);
+
+        texturesByContent[model.diffuseHash] = texture;
     }
 
     renderStates.push_back({
@@ -443,53 +479,274 @@ void GLES3Renderer::initRenderModel(const RenderModel &model) {
                                    uCameraMatrixPrevLoc});
 }
 
-void GLES3Renderer::preDrawUpdate() {
-
-    lastCameraMatrix = currentCameraMatrix;
-    const WorldState::CameraInfo &caminfo =
-            world->cameraInfos[world->currentCamera];
-    world->entities[world->currentCamera].updateCameraMatrix(
-            caminfo.fov, caminfo.aspect,
-            caminfo.near, caminfo.far,
-            caminfo.right, caminfo.isOrtho,
-            currentCameraMatrix);
-
-    if (hasSkybox) {
-        lastCameraSkyboxMatrix = currentCameraSkyboxMatrix;
-        world->entities[world->currentCamera].updateCameraSkyboxMatrix(
-                caminfo.fov, caminfo.aspect,
-                caminfo.near, caminfo.far,
-                caminfo.right, caminfo.isOrtho,
-                currentCameraSkyboxMatrix);
+void GLES3Renderer::initStaticBatch(const StaticBatches::Batch &batch) {
+    GLint aPosLoc = 0;
+    GLint aNormLoc = 1;
+    GLint aTexcoordLoc = 2;
+
+    GLuint vbo, ibo, vao;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ibo);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    glBufferData(GL_ARRAY_BUFFER,
+                 batch.vertexData.size() * sizeof(OBJParse::VertexAttributes),
+                 &batch.vertexData[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 batch.indexData.size() * sizeof(uint16_t),
+                 &batch.indexData[0], GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(aPosLoc);
+    glEnableVertexAttribArray(aNormLoc);
+    glEnableVertexAttribArray(aTexcoordLoc);
+    glVertexAttribPointer(aPosLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                          0);
+    glVertexAttribPointer(aNormLoc, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                          (void *) (uintptr_t) (3 * sizeof(GLfloat)));
+    glVertexAttribPointer(aTexcoordLoc, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(OBJParse::VertexAttributes),
+                          (void *) (uintptr_t) (6 * sizeof(GLfloat)));
+
+    glBindVertexArray(defaultVao);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // Same shader and texture as the model it takes its texture from.
+    RenderState state = renderStates[batch.textureModel];
+    state.vbo = vbo;
+    state.ibo = ibo;
+    state.vao = vao;
+    renderStates.push_back(state);
+    staticBatchDraws.push_back({(render_state_handle_t) (renderStates.size() - 1),
+                                batch.indexCount, batch.bounds});
+}
+
+// The update pass writes nothing but these, one after the other.
+static void sCaptureParticleMatrices(GLuint program) {
+    static const char *const varyings[] = {
+            "world0", "world1", "world2", "world3",
+            "worldPrev0", "worldPrev1", "worldPrev2", "worldPrev3"};
+    glTransformFeedbackVaryings(program, 8, varyings, GL_INTERLEAVED_ATTRIBS);
+}
+
+void GLES3Renderer::initGpuParticles() {
+    LOGV("compile particle update prog");
+    particleUpdateProgram =
+            compileShaderProgram(
+                    sParticleUpdateVShaderSrc,
+                    sParticleUpdateFShaderSrc,
+                    sCaptureParticleMatrices);
+    particleUpdatePathLoc =
+            glGetUniformLocation(particleUpdateProgram, "path");
+    particleUpdateFrameTimeLoc =
+            glGetUniformLocation(particleUpdateProgram, "frameTime");
+    particleUpdateLastFrameTimeLoc =
+            glGetUniformLocation(particleUpdateProgram, "lastFrameTime");
+    particleUpdateLifetimeLoc =
+            glGetUniformLocation(particleUpdateProgram, "lifetime");
+    particleUpdateMovingFramesLoc =
+            glGetUniformLocation(particleUpdateProgram, "movingFrames");
+
+    LOGV("compile particle draw progs");
+    particleDepthMapProgram =
+            compileShaderProgram(
+                    sParticleDepthMapVShaderSrc,
+                    sDepthMapFShaderSrc,
+                    nullptr);
+    particleDepthMapProjLoc =
+            glGetUniformLocation(particleDepthMapProgram, "projmatrix");
+
+    particleRenderProgram =
+            compileShaderProgram(
+                    sParticleShadowRenderVShaderSrc,
+                    sShadowRenderFShaderESMSrc,
+                    nullptr);
+    particleRenderProjLoc =
+            glGetUniformLocation(particleRenderProgram, "projmatrix");
+    particleRenderProjPrevLoc =
+            glGetUniformLocation(particleRenderProgram, "projmatrixPrev");
+    particleRenderLightMatrixLoc =
+            glGetUniformLocation(particleRenderProgram, "projMatrixLight");
+    particleRenderLightPosLoc =
+            glGetUniformLocation(particleRenderProgram, "lightPos");
+
+    glUseProgram(particleRenderProgram);
+    glUniform1i(glGetUniformLocation(particleRenderProgram, "diffuse"), 0);
+    glUniform1i(glGetUniformLocation(particleRenderProgram, "depthMapFromLight"), 1);
+    glUniform1f(glGetUniformLocation(particleRenderProgram, "windowWidth"), (float) windowWidth);
+    glUniform1f(glGetUniformLocation(particleRenderProgram, "windowHeight"),
+                (float) windowHeight);
+    glUseProgram(0);
+
+    typedef ParticleSystem::GpuParticle GpuParticle;
+    const GLsizei spawnStride = sizeof(GpuParticle);
+    const GLsizei instanceStride = 2 * sizeof(matrix4);
+
+    for (const auto &it : world->particleSystems) {
+        const ParticleSystem *system = it.second;
+
+        GLuint pathTexture;
+        glGenTextures(1, &pathTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pathTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0,
+                     GL_RGB32F, ParticleSystem::kGpuPathSamples, 1, 0,
+                     GL_RGB, GL_FLOAT, system->gpuPath.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        for (size_t m = 0; m < system->gpuParticles.size(); m++) {
+            const std::vector<GpuParticle> &particles = system->gpuParticles[m];
+            if (particles.empty()) continue;
+
+            GpuParticleDraw draw;
+            draw.system = system;
+            draw.model = m;
+            draw.renderHandle = system->models[m];
+            draw.pathTexture = pathTexture;
+            draw.liveCount = 0;
+
+            glGenVertexArrays(1, &draw.spawnVao);
+            glGenBuffers(1, &draw.spawnVbo);
+
+            glBindVertexArray(draw.spawnVao);
+            glBindBuffer(GL_ARRAY_BUFFER, draw.spawnVbo);
+            glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(GpuParticle),
+                         &particles[0], GL_STATIC_DRAW);
+
+            for (GLuint attrib = 0; attrib < 4; attrib++) {
+                glEnableVertexAttribArray(attrib);
+            }
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, spawnStride,
+                                  (void *) offsetof(GpuParticle, spawnFrame));
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, spawnStride,
+                                  (void *) offsetof(GpuParticle, axis));
+            glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, spawnStride,
+                                  (void *) offsetof(GpuParticle, orientation));
+            glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, spawnStride,
+                                  (void *) offsetof(GpuParticle, scale));
+
+            // Room for every particle of the model alive at once.
+            glGenBuffers(1, &draw.instanceVbo);
+            glBindBuffer(GL_ARRAY_BUFFER, draw.instanceVbo);
+            glBufferData(GL_ARRAY_BUFFER, particles.size() * instanceStride,
+                         nullptr, GL_DYNAMIC_COPY);
+
+            // The model's mesh, then two matrices per instance, a column
+            // per attribute.
+            const RenderState &state = renderStates[draw.renderHandle];
+            glGenVertexArrays(1, &draw.drawVao);
+            glBindVertexArray(draw.drawVao);
+            glBindBuffer(GL_ARRAY_BUFFER, state.vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, state.ibo);
+
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                                  0);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(OBJParse::VertexAttributes),
+                                  (void *) (uintptr_t) (3 * sizeof(GLfloat)));
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
+                                  sizeof(OBJParse::VertexAttributes),
+                                  (void *) (uintptr_t) (6 * sizeof(GLfloat)));
+
+            glBindBuffer(GL_ARRAY_BUFFER, draw.instanceVbo);
+            for (GLuint column = 0; column < 8; column++) {
+                glEnableVertexAttribArray(3 + column);
+                glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, instanceStride,
+                                      (void *) (uintptr_t) (4 * column * sizeof(GLfloat)));
+                glVertexAttribDivisor(3 + column, 1);
+            }
+
+            glBindVertexArray(defaultVao);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            gpuParticleDraws.push_back(draw);
+        }
     }
+}
 
-    if (shadowMapsEnabled) {
-        const WorldState::CameraInfo &caminfo =
-                world->cameraInfos[world->currentLight];
-        world->entities[world->currentLight].updateCameraMatrix(
-                caminfo.fov, caminfo.aspect,
-                caminfo.near, caminfo.far,
-                caminfo.right, caminfo.isOrtho,
-                currentLightMatrix);
-        shadowLightPos_x = world->entities[world->currentLight].pos.x;
-        shadowLightPos_y = world->entities[world->currentLight].pos.y;
-        shadowLightPos_z = world->entities[world->currentLight].pos.z;
+// Only the particles alive now are run, so they come out packed for
+// instancing.
+void GLES3Renderer::updateGpuParticles() {
+    glUseProgram(particleUpdateProgram);
+    glUniform1i(particleUpdatePathLoc, 0);
+    glUniform1f(particleUpdateFrameTimeLoc, snapshot->frameTime);
+    glUniform1f(particleUpdateLastFrameTimeLoc, snapshot->lastFrameTime);
+    glActiveTexture(GL_TEXTURE0);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    for (auto &draw : gpuParticleDraws) {
+        size_t first, end;
+        draw.system->gpuLiveRange(draw.model, snapshot->frameTime, &first, &end);
+        draw.liveCount = (GLsizei) (end - first);
+        if (!draw.liveCount) continue;
+
+        glUniform1f(particleUpdateLifetimeLoc, (float) draw.system->lifetime);
+        glUniform1f(particleUpdateMovingFramesLoc, draw.system->movingFrames());
+        glBindTexture(GL_TEXTURE_2D, draw.pathTexture);
+        glBindVertexArray(draw.spawnVao);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, draw.instanceVbo);
+
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, (GLint) first, draw.liveCount);
+        glEndTransformFeedback();
     }
+    glDisable(GL_RASTERIZER_DISCARD);
 
-    objects.resize(world->entities.size());
-
-    uint32_t oi = 0;
-    for (const auto &ent : world->entities) {
-        objects[oi].lastWorldMatrix = objects[oi].worldMatrix;
-        objects[oi].visible = ent.renderable;
-        objects[oi].renderHandle = ent.renderModel;
-        objects[oi].indexCount =
-                (uint32_t) world->renderModels[ent.renderModel].geometry.indexData.size();
-        ent.updateWorldMatrix(objects[oi].worldMatrix);
-        oi++;
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(defaultVao);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void GLES3Renderer::drawGpuParticles(bool forDepth) {
+    if (gpuParticleDraws.empty()) return;
+
+    if (forDepth) {
+        glUseProgram(particleDepthMapProgram);
+        glUniformMatrix4fv(particleDepthMapProjLoc,
+                           1, GL_FALSE, currentLightMatrix.vals);
+    } else {
+        glUseProgram(particleRenderProgram);
+        glUniformMatrix4fv(particleRenderProjLoc,
+                           1, GL_FALSE, currentCameraMatrix.vals);
+        glUniformMatrix4fv(particleRenderProjPrevLoc,
+                           1, GL_FALSE, lastCameraMatrix.vals);
+        glUniformMatrix4fv(particleRenderLightMatrixLoc,
+                           1, GL_FALSE, currentLightMatrix.vals);
+        glUniform3f(particleRenderLightPosLoc,
+                    shadowLightPos_x,
+                    shadowLightPos_y,
+                    shadowLightPos_z);
     }
 
-    lastCameraPos = world->entities[world->currentCamera].pos;
+    glActiveTexture(GL_TEXTURE0);
+    for (const auto &draw : gpuParticleDraws) {
+        if (!draw.liveCount) continue;
+        glBindVertexArray(draw.drawVao);
+        if (!forDepth) {
+            glBindTexture(GL_TEXTURE_2D, renderStates[draw.renderHandle].texture0);
+        }
+        glDrawElementsInstanced(GL_TRIANGLES,
+                                world->renderModels[draw.renderHandle].indexCount,
+                                GL_UNSIGNED_INT, 0, draw.liveCount);
+    }
+    glBindVertexArray(defaultVao);
+}
+
+void GLES3Renderer::preDrawUpdate(const RenderSnapshot &frame) {
+    GLES2Renderer::preDrawUpdate(frame);
+    lastCameraMatrix = frame.lastCameraMatrix;
+    lastCameraSkyboxMatrix = frame.lastCameraSkyboxMatrix;
+    lastCameraPos = frame.cameraPos;
 }
 
 void GLES3Renderer::initializeRenderState(
@@ -588,6 +845,11 @@ void GLES3Renderer::finalPass() {
 
 void GLES3Renderer::draw() {
     render_state_handle_t lastRenderState = -1;
+    const matrix4 identity = identity4();
+
+    if (!gpuParticleDraws.empty()) {
+        updateGpuParticles();
+    }
 
     if (shadowMapsEnabled) {
         glActiveTexture(GL_TEXTURE0);
@@ -602,13 +864,22 @@ void GLES3Renderer::draw() {
 
 
         {
-            for (const auto &obj: objects) {
-                if (!(obj.visible)) continue;
-                changeRenderState(obj.renderHandle, true);
+            for (uint32_t index : lightVisible.objects) {
+                const auto &obj = snapshot->objects[index];
+                const ObjectDraw &draw = objectDraws[index];
+                changeRenderState(draw.renderHandle, true);
                 glUniformMatrix4fv(depthMapWorldMatrixLoc,
                                    1, GL_FALSE, (currentLightMatrix * obj.worldMatrix).vals);
-                glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, 0);
+                glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_INT, 0);
+            }
+            for (uint32_t index : lightVisible.batches) {
+                const auto &batch = staticBatchDraws[index];
+                changeRenderState(batch.renderHandle, true);
+                glUniformMatrix4fv(depthMapWorldMatrixLoc,
+                                   1, GL_FALSE, currentLightMatrix.vals);
+                glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
             }
+            drawGpuParticles(true);
         }
 
         blurPass();
@@ -637,9 +908,10 @@ void GLES3Renderer::draw() {
         glActiveTexture(GL_TEXTURE0);
 
         {
-            for (const auto &obj: objects) {
-                if (!(obj.visible)) continue;
-                changeRenderState(obj.renderHandle);
+            for (uint32_t index : cameraVisible.objects) {
+                const auto &obj = snapshot->objects[index];
+                const ObjectDraw &draw = objectDraws[index];
+                changeRenderState(draw.renderHandle);
                 glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
                                    1, GL_FALSE, (obj.worldMatrix).vals);
                 glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
@@ -650,8 +922,24 @@ void GLES3Renderer::draw() {
                                    1, GL_FALSE, (lastCameraMatrix.vals));
                 glUniformMatrix4fv(currRenderState.uWorldMatrixPrevLoc,
                                    1, GL_FALSE, (obj.lastWorldMatrix).vals);
-                glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, 0);
+                glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_INT, 0);
             }
+            for (uint32_t index : cameraVisible.batches) {
+                const auto &batch = staticBatchDraws[index];
+                changeRenderState(batch.renderHandle);
+                glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
+                                   1, GL_FALSE, identity.vals);
+                glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
+                                   1, GL_FALSE, currentCameraMatrix.vals);
+                glUniformMatrix4fv(shadowRenderLightMatrixLoc,
+                                   1, GL_FALSE, currentLightMatrix.vals);
+                glUniformMatrix4fv(lastCameraProjLoc,
+                                   1, GL_FALSE, (lastCameraMatrix.vals));
+                glUniformMatrix4fv(currRenderState.uWorldMatrixPrevLoc,
+                                   1, GL_FALSE, identity.vals);
+                glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
+            }
+            drawGpuParticles(false);
         }
 
         if (hasSkybox) {
@@ -661,14 +949,24 @@ void GLES3Renderer::draw() {
         finalPass();
     } else {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        for (const auto &obj: objects) {
-            if (!(obj.visible)) continue;
-            changeRenderState(obj.renderHandle);
+        for (uint32_t index : cameraVisible.objects) {
+            const auto &obj = snapshot->objects[index];
+            const ObjectDraw &draw = objectDraws[index];
+            changeRenderState(draw.renderHandle);
             glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
                                1, GL_FALSE, (obj.worldMatrix).vals);
             glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
                                1, GL_FALSE, currentCameraMatrix.vals);
-            glDrawElements(GL_TRIANGLES, obj.indexCount, GL_UNSIGNED_INT, 0);
+            glDrawElements(GL_TRIANGLES, draw.indexCount, GL_UNSIGNED_INT, 0);
+        }
+        for (uint32_t index : cameraVisible.batches) {
+            const auto &batch = staticBatchDraws[index];
+            changeRenderState(batch.renderHandle);
+            glUniformMatrix4fv(currRenderState.uWorldMatrixLoc,
+                               1, GL_FALSE, identity.vals);
+            glUniformMatrix4fv(currRenderState.uCameraMatrixLoc,
+                               1, GL_FALSE, currentCameraMatrix.vals);
+            glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, 0);
         }
     }
 
@@ -32,6 +32,8 @@ public:
 
     virtual void initRenderModel(const RenderModel &model);
 
+    virtual void initStaticBatch(const StaticBatches::Batch &batch);
+
     virtual void initializeRenderState(const RenderState &targetState, bool forDepth);
 
     virtual void changeRenderState(render_state_handle_t, bool forDepth = false);
@@ -46,10 +48,19 @@ public:
 
     virtual void renderSkybox();
 
-    virtual void preDrawUpdate();
+    virtual void preDrawUpdate(const RenderSnapshot &snapshot);
 
     virtual void draw();
 
+    // Particles moved on the GPU; see WorldState::gpuParticles. They
+    // need the shadow mapping path and aren't culled.
+    virtual void initGpuParticles();
+
+    // Runs the update pass for the snapshot's frame time.
+    virtual void updateGpuParticles();
+
+    virtual void drawGpuParticles(bool forDepth);
+
     GLuint defaultVao;
 
     GLuint depthMapDestination;
@@ -83,6 +94,40 @@ public:
 
     GLint finalPassProgramWindowWidthLoc;
     GLint finalPassProgramWindowHeightLoc;
+
+    // One per model of each particle system, drawn with one instanced
+    // call.
+    struct GpuParticleDraw {
+        const ParticleSystem *system;
+        size_t model;
+        render_state_handle_t renderHandle;
+        GLuint pathTexture;
+        // The system's particles of |model| and the update pass over them.
+        GLuint spawnVbo;
+        GLuint spawnVao;
+        // World matrices written by the update pass, now and at the last
+        // frame, and the mesh drawn with them.
+        GLuint instanceVbo;
+        GLuint drawVao;
+        GLsizei liveCount;
+    };
+    std::vector<GpuParticleDraw> gpuParticleDraws;
+
+    GLuint particleUpdateProgram;
+    GLint particleUpdatePathLoc;
+    GLint particleUpdateFrameTimeLoc;
+    GLint particleUpdateLastFrameTimeLoc;
+    GLint particleUpdateLifetimeLoc;
+    GLint particleUpdateMovingFramesLoc;
+
+    GLuint particleDepthMapProgram;
+    GLint particleDepthMapProjLoc;
+
+    GLuint particleRenderProgram;
+    GLint particleRenderProjLoc;
+    GLint particleRenderProjPrevLoc;
+    GLint particleRenderLightMatrixLoc;
+    GLint particleRenderLightPosLoc;
 };
 
 
@@ -290,4 +290,124 @@ void main() {
     fragData[1] = vec4(0.5, 0.5, 0.0, 0.0);
 })";
 
+// Particles moved on the GPU. The update pass writes each live
+// particle's world matrix, now and at the last frame, with transform
+// feedback; the draws read them per instance.
+static const char *const sParticleUpdateVShaderSrc = R"(#version 300 es
+precision highp float;
+
+uniform highp sampler2D path;
+uniform highp float frameTime;
+uniform highp float lastFrameTime;
+uniform highp float lifetime;
+uniform highp float movingFrames;
+
+layout (location = 0) in highp vec4 spawnFrameOffset;
+layout (location = 1) in highp vec4 spinAxisPeriod;
+layout (location = 2) in highp vec4 orientation;
+layout (location = 3) in highp float scale;
+
+out highp vec4 world0;
+out highp vec4 world1;
+out highp vec4 world2;
+out highp vec4 world3;
+out highp vec4 worldPrev0;
+out highp vec4 worldPrev1;
+out highp vec4 worldPrev2;
+out highp vec4 worldPrev3;
+
+// Rotation by b followed by a.
+vec4 qmul(vec4 a, vec4 b) {
+    return vec4(a.w * b.xyz + b.w * a.xyz + cross(a.xyz, b.xyz),
+                a.w * b.w - dot(a.xyz, b.xyz));
+}
+
+// The path is sampled at even steps of arclength up to where
+// particles stop.
+vec3 pathAt(float movedFrames) {
+    int last = textureSize(path, 0).x - 1;
+    float x = movedFrames / movingFrames * float(last);
+    int i = min(int(x), last - 1);
+    return mix(texelFetch(path, ivec2(i, 0), 0).xyz,
+               texelFetch(path, ivec2(i + 1, 0), 0).xyz,
+               x - float(i));
+}
+
+// All zeros, which draws nothing, unless the particle is alive.
+mat4 worldAt(float time) {
+    float age = time - spawnFrameOffset.x;
+    if (age < 0.0 || age >= lifetime) return mat4(0.0);
+
+    float movedFrames = min(age, movingFrames);
+    float halfAngle = 3.14159265 * movedFrames / spinAxisPeriod.w;
+    vec4 q = qmul(vec4(sin(halfAngle) * spinAxisPeriod.xyz, cos(halfAngle)), orientation);
+
+    vec3 q2 = 2.0 * q.xyz;
+    vec3 wq2 = q.w * q2;
+    float xx = q.x * q2.x, yy = q.y * q2.y, zz = q.z * q2.z;
+    float xy = q.x * q2.y, yz = q.y * q2.z, xz = q.x * q2.z;
+    return mat4(vec4(scale * vec3(1.0 - yy - zz, xy + wq2.z, xz - wq2.y), 0.0),
+                vec4(scale * vec3(xy - wq2.z, 1.0 - xx - zz, yz + wq2.x), 0.0),
+                vec4(scale * vec3(xz + wq2.y, yz - wq2.x, 1.0 - xx - yy), 0.0),
+                vec4(pathAt(movedFrames) + spawnFrameOffset.yzw, 1.0));
+}
+
+void main() {
+    mat4 world = worldAt(frameTime);
+    mat4 worldPrev = lastFrameTime < spawnFrameOffset.x ? world : worldAt(lastFrameTime);
+    world0 = world[0];
+    world1 = world[1];
+    world2 = world[2];
+    world3 = world[3];
+    worldPrev0 = worldPrev[0];
+    worldPrev1 = worldPrev[1];
+    worldPrev2 = worldPrev[2];
+    worldPrev3 = worldPrev[3];
+})";
+
+static const char *const sParticleUpdateFShaderSrc = R"(#version 300 es
+void main() {
+})";
+
+static const char *const sParticleDepthMapVShaderSrc = R"(#version 300 es
+uniform highp mat4 projmatrix;
+layout (location = 0) in highp vec3 position;
+layout (location = 1) in highp vec3 v3NormalIn;
+layout (location = 2) in highp vec2 v2TexCoordsIn;
+layout (location = 3) in highp mat4 worldmatrix;
+out highp vec4 coordVarying;
+void main() {
+    coordVarying = projmatrix * worldmatrix * vec4(position.xyz, 1);
+    gl_Position = coordVarying;
+})";
+
+static const char *const sParticleShadowRenderVShaderSrc = R"(#version 300 es
+uniform highp mat4 projmatrix;
+uniform highp mat4 projMatrixLight;
+
+layout (location = 0) in highp vec3 position;
+layout (location = 1) in highp vec3 v3NormalIn;
+layout (location = 2) in highp vec2 v2TexCoordsIn;
+
+layout (location = 3) in highp mat4 worldmatrix;
+layout (location = 7) in highp mat4 worldmatrixPrev;
+
+out highp vec2 v2TexCoord;
+
+out highp vec4 prevPos;
+out highp vec4 fragPos;
+out highp vec3 fragNorm;
 
+out highp vec4 depthMapCoord;
+
+void main() {
+    v2TexCoord = v2TexCoordsIn;
+
+    vec4 worldPos = worldmatrix * vec4(position.xyz, 1);
+    prevPos = worldmatrixPrev * vec4(position.xyz, 1);
+    fragPos = worldPos;
+    fragNorm = (worldmatrix * vec4(v3NormalIn, 1)).xyz;
+
+    depthMapCoord = projMatrixLight * worldPos;
+    gl_Position = projmatrix * worldPos;
+})";
@@ -0,0 +1,149 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "JobSystem.h"
+
+#include "log.h"
+
+#include <algorithm>
+
+static const unsigned kMaxWorkers = 7;
+
+const size_t JobSystem::kEntityChunk;
+
+static JobSystem *sJobSystem = nullptr;
+
+// static
+JobSystem *JobSystem::get() {
+    if (!sJobSystem) sJobSystem = new JobSystem;
+    return sJobSystem;
+}
+
+JobSystem::JobSystem() {
+    unsigned cores = std::thread::hardware_concurrency();
+    start(std::min(cores > 1 ? cores - 1 : 0, kMaxWorkers));
+}
+
+JobSystem::JobSystem(unsigned workerCount) {
+    start(workerCount);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+        mQuit = true;
+    }
+    mWake.notify_all();
+    for (auto &worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void JobSystem::start(unsigned workerCount) {
+    mQueued = 0;
+    for (unsigned i = 0; i < workerCount; i++) {
+        mQueues.emplace_back(new Queue);
+    }
+    for (unsigned i = 0; i < workerCount; i++) {
+        mWorkers.emplace_back(&JobSystem::workerLoop, this, i);
+    }
+    LOGV("%s: %u workers", __func__, workerCount);
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain, const RangeFunc &func) {
+    if (!count) return;
+    if (!grain) grain = count;
+
+    size_t chunkCount = (count + grain - 1) / grain;
+    unsigned queueCount = mQueues.size();
+    if (chunkCount == 1 || !queueCount) {
+        for (size_t begin = 0; begin < count; begin += grain) {
+            func(begin, std::min(begin + grain, count));
+        }
+        return;
+    }
+
+    Loop loop;
+    loop.func = &func;
+    loop.remaining = chunkCount;
+
+    // Each worker starts out with a contiguous run of chunks.
+    size_t chunk = 0;
+    for (unsigned q = 0; q < queueCount; q++) {
+        size_t runEnd = chunkCount * (q + 1) / queueCount;
+        std::lock_guard<std::mutex> lock(mQueues[q]->lock);
+        for (; chunk < runEnd; chunk++) {
+            size_t begin = chunk * grain;
+            mQueues[q]->chunks.push_back(Chunk{&loop, begin, std::min(begin + grain, count)});
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+        mQueued += chunkCount;
+    }
+    mWake.notify_all();
+
+    while (loop.remaining.load(std::memory_order_acquire)) {
+        Chunk stolen;
+        if (takeChunk(queueCount, stolen)) {
+            runChunk(stolen);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::workerLoop(unsigned index) {
+    for (;;) {
+        Chunk chunk;
+        if (takeChunk(index, chunk)) {
+            runChunk(chunk);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mWakeLock);
+        mWake.wait(lock, [this] { return mQuit || mQueued.load() > 0; });
+        if (mQuit) return;
+    }
+}
+
+// Takes from the back of queue |self| if it is a worker's own, then
+// steals from the front of the others.
+bool JobSystem::takeChunk(unsigned self, Chunk &chunk) {
+    unsigned queueCount = mQueues.size();
+    for (unsigned i = 0; i < queueCount; i++) {
+        unsigned q = (self + i) % queueCount;
+        Queue &queue = *mQueues[q];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.chunks.empty()) continue;
+        if (q == self) {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+        } else {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+        }
+        mQueued--;
+        return true;
+    }
+    return false;
+}
+
+// static
+void JobSystem::runChunk(const Chunk &chunk) {
+    (*chunk.loop->func)(chunk.begin, chunk.end);
+    chunk.loop->remaining.fetch_sub(1, std::memory_order_release);
+}
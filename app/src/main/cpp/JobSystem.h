@@ -0,0 +1,93 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_JOBSYSTEM_H
+#define GPU_EMULATION_STRESS_TEST_JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads for data-parallel loops. Each worker
+// has its own queue of chunks; it takes work from the back of its own
+// and, once that is empty, steals from the front of the others. The
+// thread calling parallelFor steals too until its loop is done.
+class JobSystem {
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeFunc;
+
+    // Entity loops are split into chunks of this many, which keeps the
+    // arrays a chunk touches within a core's cache.
+    static const size_t kEntityChunk = 1024;
+
+    // One worker per core besides the caller's.
+    JobSystem();
+
+    explicit JobSystem(unsigned workerCount);
+
+    ~JobSystem();
+
+    static JobSystem *get();
+
+    unsigned threadCount() const { return mWorkers.size() + 1; }
+
+    // Calls |func| on consecutive ranges of at most |grain| covering
+    // [0, count), on any thread, and returns once all calls are done.
+    // Ranges don't depend on the thread count or scheduling, so loops
+    // whose ranges write disjoint data give the same result every time.
+    void parallelFor(size_t count, size_t grain, const RangeFunc &func);
+
+private:
+    struct Loop {
+        const RangeFunc *func;
+        std::atomic<size_t> remaining;
+    };
+
+    struct Chunk {
+        Loop *loop;
+        size_t begin;
+        size_t end;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Chunk> chunks;
+    };
+
+    void start(unsigned workerCount);
+
+    void workerLoop(unsigned index);
+
+    bool takeChunk(unsigned first, Chunk &chunk);
+
+    static void runChunk(const Chunk &chunk);
+
+    std::vector<std::thread> mWorkers;
+    std::vector<std::unique_ptr<Queue> > mQueues;
+
+    std::mutex mWakeLock;
+    std::condition_variable mWake;
+    std::atomic<size_t> mQueued;
+    bool mQuit = false;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_JOBSYSTEM_H
@@ -0,0 +1,395 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Weight of the planes holding seam edges in place, relative to those of
+// the triangles, per squared edge length.
+static const double kSeamWeight = 10.0;
+
+// A collapse may turn no remaining triangle's normal further than about
+// 75 degrees, which also keeps it from folding the surface over.
+static const double kMinNormalCos = 0.25;
+
+static void sTriangleNormal(const float *a, const float *b, const float *c, double n[3]) {
+    double ab[3], ac[3];
+    for (int i = 0; i < 3; i++) {
+        ab[i] = (double) b[i] - a[i];
+        ac[i] = (double) c[i] - a[i];
+    }
+    n[0] = ab[1] * ac[2] - ab[2] * ac[1];
+    n[1] = ab[2] * ac[0] - ab[0] * ac[2];
+    n[2] = ab[0] * ac[1] - ab[1] * ac[0];
+}
+
+void MeshSimplifier::Quadric::addPlane(const double n[3], double d, double weight) {
+    const double p[4] = {n[0], n[1], n[2], d};
+    int k = 0;
+    for (int row = 0; row < 4; row++) {
+        for (int col = row; col < 4; col++) {
+            q[k++] += weight * p[row] * p[col];
+        }
+    }
+}
+
+void MeshSimplifier::Quadric::add(const Quadric &other) {
+    for (int k = 0; k < 10; k++) {
+        q[k] += other.q[k];
+    }
+}
+
+double MeshSimplifier::Quadric::error(const float p[3]) const {
+    const double x = p[0], y = p[1], z = p[2];
+    return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+           q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+           q[7] * z * z + 2.0 * q[8] * z +
+           q[9];
+}
+
+MeshSimplifier::MeshSimplifier(const OBJParse &source) : mSource(source) {
+    const std::vector<OBJParse::VertexAttributes> &vertices = source.vertexData;
+    mCorners.assign(source.indexData.begin(), source.indexData.end());
+    mLiveTriangles = mCorners.size() / 3;
+    mCorners.resize(mLiveTriangles * 3);
+    mDead.assign(mLiveTriangles, 0);
+
+    // Weld vertices with equal positions. Sorting keeps the numbering
+    // independent of any hashing.
+    std::vector<uint32_t> order(vertices.size());
+    for (uint32_t v = 0; v < order.size(); v++) {
+        order[v] = v;
+    }
+    auto less = [&vertices](uint32_t a, uint32_t b) -> bool {
+        const float *pa = vertices[a].pos;
+        const float *pb = vertices[b].pos;
+        if (pa[0] != pb[0]) return pa[0] < pb[0];
+        if (pa[1] != pb[1]) return pa[1] < pb[1];
+        if (pa[2] != pb[2]) return pa[2] < pb[2];
+        return a < b;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    mPositionOf.resize(vertices.size());
+    size_t positionCount = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        const float *p = vertices[order[i]].pos;
+        const float *prev = i ? vertices[order[i - 1]].pos : nullptr;
+        if (!prev || p[0] != prev[0] || p[1] != prev[1] || p[2] != prev[2]) {
+            mPositions.insert(mPositions.end(), p, p + 3);
+            positionCount++;
+        }
+        mPositionOf[order[i]] = (uint32_t) positionCount - 1;
+    }
+
+    mLocked.assign(positionCount, 0);
+    mQuadrics.assign(positionCount, Quadric());
+    mTriangles.resize(positionCount);
+
+    // Planes of the triangles around each position, weighted by area.
+    std::vector<double> normals(mLiveTriangles * 3);
+    for (uint32_t t = 0; t < mLiveTriangles; t++) {
+        uint32_t p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = mPositionOf[mCorners[t * 3 + k]];
+            mTriangles[p[k]].push_back(t);
+        }
+
+        double *n = &normals[t * 3];
+        sTriangleNormal(&mPositions[p[0] * 3], &mPositions[p[1] * 3], &mPositions[p[2] * 3], n);
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (length == 0.0) continue;
+        for (int i = 0; i < 3; i++) {
+            n[i] /= length;
+        }
+        const float *a = &mPositions[p[0] * 3];
+        double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+        for (int k = 0; k < 3; k++) {
+            mQuadrics[p[k]].addPlane(n, d, 0.5 * length);
+        }
+    }
+
+    // Edges by position, with the triangle side listing them.
+    std::vector<std::pair<uint64_t, uint32_t> > edges;
+    edges.reserve(mCorners.size());
+    for (uint32_t t = 0; t < mLiveTriangles; t++) {
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t a = mPositionOf[mCorners[t * 3 + k]];
+            uint32_t b = mPositionOf[mCorners[t * 3 + (k + 1) % 3]];
+            edges.push_back(std::make_pair(((uint64_t) std::min(a, b) << 32) | std::max(a, b),
+                                           t * 3 + k));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i;
+        while (j < edges.size() && edges[j].first == edges[i].first) j++;
+        uint32_t a = (uint32_t) (edges[i].first >> 32);
+        uint32_t b = (uint32_t) edges[i].first;
+
+        // Every edge of a vertex free to move has exactly two triangles.
+        if (j - i != 2 || a == b) {
+            mLocked[a] = 1;
+            mLocked[b] = 1;
+            i = j;
+            continue;
+        }
+
+        // The two triangles list the edge in opposite directions; on a
+        // seam, they disagree on the vertices at its ends.
+        uint32_t side0 = edges[i].second;
+        uint32_t side1 = edges[i + 1].second;
+        uint32_t start0 = mCorners[side0];
+        uint32_t end0 = mCorners[side0 - side0 % 3 + (side0 + 1) % 3];
+        uint32_t start1 = mCorners[side1];
+        uint32_t end1 = mCorners[side1 - side1 % 3 + (side1 + 1) % 3];
+        if (start0 != end1 || end0 != start1) {
+            for (uint32_t side : {side0, side1}) {
+                const double *n = &normals[side / 3 * 3];
+                const float *pa = &mPositions[a * 3];
+                const float *pb = &mPositions[b * 3];
+                double edge[3] = {(double) pb[0] - pa[0], (double) pb[1] - pa[1],
+                                  (double) pb[2] - pa[2]};
+                double lengthSq = edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2];
+                // The plane through the edge at right angles to the
+                // triangle.
+                double m[3] = {edge[1] * n[2] - edge[2] * n[1],
+                               edge[2] * n[0] - edge[0] * n[2],
+                               edge[0] * n[1] - edge[1] * n[0]};
+                double length = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+                if (length == 0.0) continue;
+                for (int c = 0; c < 3; c++) {
+                    m[c] /= length;
+                }
+                double d = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+                mQuadrics[a].addPlane(m, d, kSeamWeight * lengthSq);
+                mQuadrics[b].addPlane(m, d, kSeamWeight * lengthSq);
+            }
+        }
+        i = j;
+    }
+}
+
+void MeshSimplifier::simplify(size_t targetTriangles) {
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t> touched;
+
+    while (mLiveTriangles > targetTriangles) {
+        // Edges with a free end can go either way. Such edges have two
+        // triangles, which list them in opposite directions, so taking
+        // a < b sees each once.
+        collapses.clear();
+        for (size_t t = 0; t < mDead.size(); t++) {
+            if (mDead[t]) continue;
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = mPositionOf[mCorners[t * 3 + k]];
+                uint32_t b = mPositionOf[mCorners[t * 3 + (k + 1) % 3]];
+                if (a >= b || (mLocked[a] && mLocked[b])) continue;
+
+                Quadric sum = mQuadrics[a];
+                sum.add(mQuadrics[b]);
+                if (!mLocked[a]) collapses.push_back(Collapse{sum.error(&mPositions[b * 3]), a, b});
+                if (!mLocked[b]) collapses.push_back(Collapse{sum.error(&mPositions[a * 3]), b, a});
+            }
+        }
+        if (collapses.empty()) break;
+
+        // Only the cheapest quarter per pass, so that costly collapses
+        // wait until the cheap ones around them are used up. Positions
+        // around a collapse are left alone for the rest of the pass, as
+        // the costs there are stale.
+        size_t limit = std::max(collapses.size() / 4, (size_t) 1);
+        auto cheaper = [](const Collapse &x, const Collapse &y) -> bool {
+            if (x.cost != y.cost) return x.cost < y.cost;
+            if (x.from != y.from) return x.from < y.from;
+            return x.to < y.to;
+        };
+        std::nth_element(collapses.begin(), collapses.begin() + limit - 1, collapses.end(),
+                         cheaper);
+        std::sort(collapses.begin(), collapses.begin() + limit, cheaper);
+
+        touched.assign(mPositions.size() / 3, 0);
+        size_t collapsed = 0;
+        for (size_t i = 0; i < limit && mLiveTriangles > targetTriangles; i++) {
+            const Collapse &c = collapses[i];
+            VertexMap map;
+            if (touched[c.from] || touched[c.to] || !canCollapse(c.from, c.to, &map)) {
+                continue;
+            }
+            for (uint32_t p : mFromNeighbours) {
+                touched[p] = 1;
+            }
+            touched[c.from] = 1;
+            collapse(c.from, c.to, map);
+            collapsed++;
+        }
+        if (!collapsed) break;
+    }
+}
+
+void MeshSimplifier::neighbours(uint32_t position, std::vector<uint32_t> &out) const {
+    out.clear();
+    for (uint32_t t : mTriangles[position]) {
+        if (mDead[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            uint32_t p = mPositionOf[mCorners[t * 3 + k]];
+            if (p != position) out.push_back(p);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+bool MeshSimplifier::VertexMap::find(uint32_t vertex, uint32_t *replacement) const {
+    for (int i = 0; i < count; i++) {
+        if (from[i] == vertex) {
+            *replacement = to[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to, VertexMap *map) {
+    // The edge must be the only thing joining the two rings, or the
+    // collapse pinches the surface.
+    neighbours(from, mFromNeighbours);
+    neighbours(to, mToNeighbours);
+    size_t shared = 0;
+    for (size_t i = 0, j = 0; i < mFromNeighbours.size() && j < mToNeighbours.size();) {
+        if (mFromNeighbours[i] < mToNeighbours[j]) {
+            i++;
+        } else if (mFromNeighbours[i] > mToNeighbours[j]) {
+            j++;
+        } else {
+            shared++;
+            i++;
+            j++;
+        }
+    }
+    if (shared != 2) return false;
+
+    // The two triangles on the edge say which vertex at |to| each one at
+    // |from| becomes. A vertex at |from| neither of them uses is on the
+    // far side of a seam not running along the edge.
+    map->count = 0;
+    for (uint32_t t : mTriangles[from]) {
+        if (mDead[t]) continue;
+        uint32_t fromVertex = 0, toVertex = 0;
+        bool hasTo = false;
+        for (int k = 0; k < 3; k++) {
+            uint32_t vertex = mCorners[t * 3 + k];
+            uint32_t p = mPositionOf[vertex];
+            if (p == from) fromVertex = vertex;
+            if (p == to) {
+                toVertex = vertex;
+                hasTo = true;
+            }
+        }
+        if (!hasTo) continue;
+
+        uint32_t mapped;
+        if (map->find(fromVertex, &mapped)) {
+            if (mapped != toVertex) return false;
+        } else {
+            if (map->count == 2) return false;
+            map->from[map->count] = fromVertex;
+            map->to[map->count] = toVertex;
+            map->count++;
+        }
+    }
+
+    const float *target = &mPositions[to * 3];
+    for (uint32_t t : mTriangles[from]) {
+        if (mDead[t]) continue;
+
+        const float *before[3];
+        const float *after[3];
+        bool hasTo = false;
+        for (int k = 0; k < 3; k++) {
+            uint32_t vertex = mCorners[t * 3 + k];
+            uint32_t p = mPositionOf[vertex];
+            uint32_t mapped;
+            if (p == from && !map->find(vertex, &mapped)) return false;
+            before[k] = &mPositions[p * 3];
+            after[k] = p == from ? target : before[k];
+            hasTo = hasTo || p == to;
+        }
+        if (hasTo) continue;
+
+        double n0[3], n1[3];
+        sTriangleNormal(before[0], before[1], before[2], n0);
+        sTriangleNormal(after[0], after[1], after[2], n1);
+        double dot = n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2];
+        double lengths = sqrt((n0[0] * n0[0] + n0[1] * n0[1] + n0[2] * n0[2]) *
+                              (n1[0] * n1[0] + n1[1] * n1[1] + n1[2] * n1[2]));
+        if (lengths == 0.0 || dot < kMinNormalCos * lengths) return false;
+    }
+    return map->count > 0;
+}
+
+void MeshSimplifier::collapse(uint32_t from, uint32_t to, const VertexMap &map) {
+    std::vector<uint32_t> &toTriangles = mTriangles[to];
+    for (uint32_t t : mTriangles[from]) {
+        if (mDead[t]) continue;
+
+        bool hasTo = false;
+        int fromCorner = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t p = mPositionOf[mCorners[t * 3 + k]];
+            hasTo = hasTo || p == to;
+            if (p == from) fromCorner = k;
+        }
+        if (hasTo) {
+            mDead[t] = 1;
+            mLiveTriangles--;
+        } else {
+            map.find(mCorners[t * 3 + fromCorner], &mCorners[t * 3 + fromCorner]);
+            toTriangles.push_back(t);
+        }
+    }
+    std::vector<uint32_t>().swap(mTriangles[from]);
+
+    const std::vector<uint8_t> &dead = mDead;
+    toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(),
+                                     [&dead](uint32_t t) -> bool { return dead[t] != 0; }),
+                      toTriangles.end());
+    mQuadrics[to].add(mQuadrics[from]);
+}
+
+void MeshSimplifier::write(OBJParse &out) const {
+    out.vertexData.clear();
+    out.indexData.clear();
+    out.indexData.reserve(mLiveTriangles * 3);
+
+    // Vertices are renumbered in the order triangles first use them.
+    std::vector<uint32_t> remap(mSource.vertexData.size(), UINT32_MAX);
+    for (size_t t = 0; t < mDead.size(); t++) {
+        if (mDead[t]) continue;
+        for (int k = 0; k < 3; k++) {
+            uint32_t vertex = mCorners[t * 3 + k];
+            if (remap[vertex] == UINT32_MAX) {
+                remap[vertex] = (uint32_t) out.vertexData.size();
+                out.vertexData.push_back(mSource.vertexData[vertex]);
+            }
+            out.indexData.push_back((unsigned short) remap[vertex]);
+        }
+    }
+    out.computeBounds();
+}
@@ -0,0 +1,96 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_MESHSIMPLIFIER_H
+#define GPU_EMULATION_STRESS_TEST_MESHSIMPLIFIER_H
+
+#include "OBJParse.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reduces a mesh by quadric error edge collapses (Garland and Heckbert),
+// each moving a vertex onto a neighbour. Vertices on open or non-manifold
+// edges never move, so borders keep their shape. Where a UV or normal
+// seam splits a vertex, it only moves along the seam, which keeps the
+// seam closed; extra planes through seam edges keep its shape.
+class MeshSimplifier {
+public:
+    explicit MeshSimplifier(const OBJParse &source);
+
+    // Collapses edges, cheapest first, until at most |targetTriangles|
+    // remain or no collapse is left that wouldn't fold the surface.
+    void simplify(size_t targetTriangles);
+
+    size_t triangleCount() const { return mLiveTriangles; }
+
+    // The mesh as simplified so far, with its bounds.
+    void write(OBJParse &out) const;
+
+private:
+    // Sum of squared distances to a set of planes: the symmetric 4x4
+    // matrix of Garland and Heckbert, upper triangle by rows.
+    struct Quadric {
+        double q[10];
+
+        void addPlane(const double n[3], double d, double weight);
+        void add(const Quadric &other);
+        double error(const float p[3]) const;
+    };
+
+    struct Collapse {
+        double cost;
+        uint32_t from;
+        uint32_t to;
+    };
+
+    // Which of the vertices at |to| replaces each one at |from|.
+    struct VertexMap {
+        uint32_t from[2];
+        uint32_t to[2];
+        int count;
+
+        bool find(uint32_t vertex, uint32_t *replacement) const;
+    };
+
+    bool canCollapse(uint32_t from, uint32_t to, VertexMap *map);
+
+    void collapse(uint32_t from, uint32_t to, const VertexMap &map);
+
+    void neighbours(uint32_t position, std::vector<uint32_t> &out) const;
+
+    const OBJParse &mSource;
+
+    // Source vertex at each triangle corner.
+    std::vector<uint32_t> mCorners;
+    std::vector<uint8_t> mDead;
+    size_t mLiveTriangles = 0;
+
+    // Vertices are welded by position for collapsing.
+    std::vector<uint32_t> mPositionOf;
+    std::vector<float> mPositions;
+    std::vector<uint8_t> mLocked;
+    std::vector<Quadric> mQuadrics;
+    // Triangles around each position; may list dead ones.
+    std::vector<std::vector<uint32_t> > mTriangles;
+
+    // Scratch for canCollapse().
+    std::vector<uint32_t> mFromNeighbours;
+    std::vector<uint32_t> mToNeighbours;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_MESHSIMPLIFIER_H
@@ -22,11 +22,13 @@
 
 #include "util.h"
 
-OBJParse::OBJParse(const std::string &objFileName) {
+#include <algorithm>
+#include <cmath>
 
-    std::vector<unsigned char> objContents =
-            FileLoader::get()->loadFileFromAssets(objFileName);
+OBJParse::OBJParse(const std::string &objFileName) :
+        OBJParse(FileLoader::get()->loadFileFromAssets(objFileName)) {}
 
+OBJParse::OBJParse(const std::vector<unsigned char> &objContents) {
     std::string objStr(objContents.begin(), objContents.end());
 
     std::vector<std::string> objLines = splitLines(objStr);
@@ -105,6 +107,8 @@ OBJParse::OBJParse(const std::string &objFileName) {
         vertexData.push_back(it.second);
     }
 
+    computeBounds();
+
     for (unsigned int i = 0; i < (unsigned int) obj_f.size(); i++) {
         unsigned int vertA = obj_f[i][0] - 1;
         unsigned int vertB = obj_f[i][3] - 1;
@@ -127,3 +131,35 @@ OBJParse::OBJParse(const std::string &objFileName) {
         indexData.push_back(indexDataMap[keyC]);
     }
 }
+
+void OBJParse::releaseParseData() {
+    std::vector<std::vector<float> >().swap(obj_v);
+    std::vector<std::vector<float> >().swap(obj_vn);
+    std::vector<std::vector<float> >().swap(obj_vt);
+    std::vector<std::vector<uint32_t> >().swap(obj_f);
+    vertexDataMap.clear();
+    indexDataMap.clear();
+}
+
+void OBJParse::computeBounds() {
+    for (size_t i = 0; i < vertexData.size(); i++) {
+        for (int c = 0; c < 3; c++) {
+            float v = vertexData[i].pos[c];
+            boundsMin[c] = (i == 0 || v < boundsMin[c]) ? v : boundsMin[c];
+            boundsMax[c] = (i == 0 || v > boundsMax[c]) ? v : boundsMax[c];
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        boundsCenter[c] = 0.5f * (boundsMin[c] + boundsMax[c]);
+    }
+    float radiusSq = 0.0f;
+    for (const auto &vertex : vertexData) {
+        float distSq = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float d = vertex.pos[c] - boundsCenter[c];
+            distSq += d * d;
+        }
+        radiusSq = std::max(radiusSq, distSq);
+    }
+    boundsRadius = sqrtf(radiusSq);
+}
@@ -27,6 +27,14 @@ public:
 
     OBJParse(const std::string &objFileName);
 
+    OBJParse(const std::vector<unsigned char> &objContents);
+
+    // Frees the tables only needed while parsing.
+    void releaseParseData();
+
+    // Fills in the bounds below from vertexData.
+    void computeBounds();
+
     // Use interleaved vertex attributes
     struct VertexAttributes {
         float pos[3];
@@ -55,6 +63,14 @@ public:
 
     std::vector<VertexAttributes> vertexData;
     std::vector<unsigned short> indexData;
+
+    // Axis-aligned bounds of the vertex positions, zero if there are none.
+    float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+    float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+    // Sphere around the center of those bounds, through the farthest
+    // vertex.
+    float boundsCenter[3] = {0.0f, 0.0f, 0.0f};
+    float boundsRadius = 0.0f;
 private:
     std::vector<std::vector<float> > obj_v;
     std::vector<std::vector<float> > obj_vn;
@@ -0,0 +1,350 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "OcclusionCuller.h"
+
+#include "log.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cmath>
+
+// Bounding radius, in model units, from which a model hides others.
+static const float kMinOccluderRadius = 5.0f;
+
+// Triangles per separately culled part of a static occluder.
+static const size_t kChunkTriangles = 256;
+
+static const int kTilesX = OcclusionCuller::kWidth / OcclusionCuller::kTileSize;
+static const int kTilesY = OcclusionCuller::kHeight / OcclusionCuller::kTileSize;
+
+const int OcclusionCuller::kWidth;
+const int OcclusionCuller::kHeight;
+const int OcclusionCuller::kTileSize;
+
+// Buffer coordinates and normalized depth of a clip space position.
+static void sToScreen(const float *clip, float *screen) {
+    float invW = 1.0f / clip[3];
+    screen[0] = (clip[0] * invW * 0.5f + 0.5f) * OcclusionCuller::kWidth;
+    screen[1] = (clip[1] * invW * 0.5f + 0.5f) * OcclusionCuller::kHeight;
+    screen[2] = clip[2] * invW;
+}
+
+void OcclusionCuller::setOccluders(const EntityStore &entities,
+                                   const std::vector<RenderModel> &models) {
+    mModelMeshes.assign(models.size(), Mesh());
+    for (size_t i = 0; i < models.size(); i++) {
+        const RenderModel &model = models[i];
+        if (!model.geometry || model.boundsRadius < kMinOccluderRadius) continue;
+
+        Mesh &mesh = mModelMeshes[i];
+        for (const auto &vertex : model.geometry->vertexData) {
+            mesh.positions.insert(mesh.positions.end(), vertex.pos, vertex.pos + 3);
+        }
+        mesh.indices.assign(model.geometry->indexData.begin(), model.geometry->indexData.end());
+    }
+
+    // Batched entities aren't in snapshots, so those big enough are
+    // kept here, already placed.
+    mStaticMesh = Mesh();
+    mStaticOccluders.clear();
+    for (size_t i = 0; i < entities.size(); i++) {
+        render_state_handle_t modelHandle = entities.renderModel[i];
+        if (!(entities.flags[i] & EntityStore::kBatched) || !isOccluder(modelHandle)) continue;
+
+        const Mesh &mesh = mModelMeshes[modelHandle];
+        matrix4 world;
+        entities.buildWorldMatrices(i, 1, &world, sizeof(world));
+
+        std::vector<float> placed(mesh.positions.size());
+        for (size_t v = 0; v < mesh.positions.size(); v += 3) {
+            vector4 pos = world * makevector4(mesh.positions[v], mesh.positions[v + 1],
+                                              mesh.positions[v + 2], 1.0f);
+            placed[v] = pos.x;
+            placed[v + 1] = pos.y;
+            placed[v + 2] = pos.z;
+        }
+
+        // Split into runs of triangles with bounds of their own, so that
+        // those of big meshes out of view are skipped.
+        std::vector<uint32_t> localIndex(mesh.positions.size() / 3);
+        for (size_t first = 0; first < mesh.indices.size(); first += kChunkTriangles * 3) {
+            size_t end = std::min(first + kChunkTriangles * 3, mesh.indices.size());
+            std::fill(localIndex.begin(), localIndex.end(), UINT32_MAX);
+
+            StaticOccluder chunk;
+            chunk.bounds = Aabb::empty();
+            chunk.firstVertex = (uint32_t) (mStaticMesh.positions.size() / 3);
+            chunk.vertexCount = 0;
+            chunk.firstIndex = (uint32_t) mStaticMesh.indices.size();
+            chunk.indexCount = (uint32_t) (end - first);
+            for (size_t k = first; k < end; k++) {
+                uint32_t index = mesh.indices[k];
+                if (localIndex[index] == UINT32_MAX) {
+                    localIndex[index] = chunk.vertexCount++;
+                    const float *pos = &placed[index * 3];
+                    mStaticMesh.positions.insert(mStaticMesh.positions.end(), pos, pos + 3);
+                    chunk.bounds.grow(Aabb{{pos[0], pos[1], pos[2]}, {pos[0], pos[1], pos[2]}});
+                }
+                mStaticMesh.indices.push_back(localIndex[index]);
+            }
+            mStaticOccluders.push_back(chunk);
+        }
+    }
+
+    mDepth.assign(kWidth * kHeight, 1.0f);
+    mTileMaxDepth.assign(kTilesX * kTilesY, 1.0f);
+
+    size_t modelCount = 0;
+    for (size_t i = 0; i < models.size(); i++) modelCount += isOccluder(i);
+    LOGD("%s: %zu occluder models, %zu static occluder parts with %zu triangles", __func__,
+         modelCount, mStaticOccluders.size(), mStaticMesh.indices.size() / 3);
+}
+
+void OcclusionCuller::begin(const matrix4 &viewProj) {
+    mViewProj = viewProj;
+    std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+
+    Frustum frustum(viewProj);
+    for (const auto &occluder : mStaticOccluders) {
+        if (frustum.test(occluder.bounds) == kOutside) continue;
+        rasterizeMesh(&mStaticMesh.positions[occluder.firstVertex * 3], occluder.vertexCount,
+                      &mStaticMesh.indices[occluder.firstIndex], occluder.indexCount, viewProj);
+    }
+}
+
+void OcclusionCuller::addOccluder(render_state_handle_t model, const matrix4 &world) {
+    const Mesh &mesh = mModelMeshes[model];
+    rasterizeMesh(mesh.positions.data(), mesh.positions.size() / 3, mesh.indices.data(),
+                  mesh.indices.size(), mViewProj * world);
+}
+
+void OcclusionCuller::rasterizeMesh(const float *positions, size_t vertexCount,
+                                    const uint32_t *indices, size_t indexCount,
+                                    const matrix4 &toClip) {
+    const float4 col0 = f4load(&toClip.vals[0]);
+    const float4 col1 = f4load(&toClip.vals[4]);
+    const float4 col2 = f4load(&toClip.vals[8]);
+    const float4 col3 = f4load(&toClip.vals[12]);
+    mClip.resize(vertexCount * 4);
+    mScreen.resize(vertexCount * 3);
+    for (size_t v = 0; v < vertexCount; v++) {
+        const float *p = &positions[v * 3];
+        float *clip = &mClip[v * 4];
+        f4store(clip, col0 * f4splat(p[0]) + col1 * f4splat(p[1]) + col2 * f4splat(p[2]) + col3);
+        // Only used for vertices in front of the near plane.
+        if (clip[2] + clip[3] >= 0.0f) sToScreen(clip, &mScreen[v * 3]);
+    }
+
+    for (size_t t = 0; t + 2 < indexCount; t += 3) {
+        const uint32_t tri[3] = {indices[t], indices[t + 1], indices[t + 2]};
+
+        // Clip against the near plane, z >= -w.
+        float dist[3];
+        int inside = 0;
+        for (int k = 0; k < 3; k++) {
+            const float *clip = &mClip[tri[k] * 4];
+            dist[k] = clip[2] + clip[3];
+            inside += dist[k] >= 0.0f;
+        }
+        if (inside == 0) continue;
+        if (inside == 3) {
+            rasterizeTriangle(&mScreen[tri[0] * 3], &mScreen[tri[1] * 3], &mScreen[tri[2] * 3]);
+            continue;
+        }
+
+        float poly[4][3];
+        int count = 0;
+        for (int k = 0; k < 3; k++) {
+            int next = (k + 1) % 3;
+            const float *a = &mClip[tri[k] * 4];
+            const float *b = &mClip[tri[next] * 4];
+            if (dist[k] >= 0.0f) {
+                sToScreen(a, poly[count++]);
+            }
+            if ((dist[k] >= 0.0f) != (dist[next] >= 0.0f)) {
+                float s = dist[k] / (dist[k] - dist[next]);
+                float clip[4];
+                for (int c = 0; c < 4; c++) {
+                    clip[c] = a[c] + s * (b[c] - a[c]);
+                }
+                sToScreen(clip, poly[count++]);
+            }
+        }
+        for (int k = 1; k + 1 < count; k++) {
+            rasterizeTriangle(poly[0], poly[k], poly[k + 1]);
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(const float *a, const float *b, const float *c) {
+    const float x[3] = {a[0], b[0], c[0]};
+    const float y[3] = {a[1], b[1], c[1]};
+    const float z[3] = {a[2], b[2], c[2]};
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    // Only front faces, wound counterclockwise; a back face is behind
+    // one of those in any closed mesh, and open ones only hide less.
+    if (!(area > 0.0f)) return;
+
+    // Pixels whose centers are inside, clamped in float first so that
+    // far off screen vertices can't overflow.
+    float left = std::max(std::min(std::min(x[0], x[1]), x[2]) - 0.5f, 0.0f);
+    float right = std::min(std::max(std::max(x[0], x[1]), x[2]) - 0.5f, kWidth - 1.0f);
+    float bottom = std::max(std::min(std::min(y[0], y[1]), y[2]) - 0.5f, 0.0f);
+    float top = std::min(std::max(std::max(y[0], y[1]), y[2]) - 0.5f, kHeight - 1.0f);
+    if (left > right || bottom > top) return;
+    int minY = (int) ceilf(bottom);
+    int maxY = (int) floorf(top);
+
+    // Edge functions E(x, y) = A x + B y + C, positive inside. Edge k
+    // faces vertex k.
+    float edgeA[3], edgeB[3], edgeC[3], invEdgeA[3];
+    for (int k = 0; k < 3; k++) {
+        int i = (k + 1) % 3, j = (k + 2) % 3;
+        edgeA[k] = y[i] - y[j];
+        edgeB[k] = x[j] - x[i];
+        edgeC[k] = x[i] * y[j] - x[j] * y[i];
+        invEdgeA[k] = edgeA[k] != 0.0f ? 1.0f / edgeA[k] : 0.0f;
+    }
+
+    // Depth as a plane over the screen, from the barycentric weights
+    // E_k / area.
+    float invArea = 1.0f / area;
+    float depthA = 0.0f, depthB = 0.0f, depthC = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        depthA += edgeA[k] * z[k] * invArea;
+        depthB += edgeB[k] * z[k] * invArea;
+        depthC += edgeC[k] * z[k] * invArea;
+    }
+
+    static const float kLaneOffsets[4] = {0.5f, 1.5f, 2.5f, 3.5f};
+    const float4 laneOffsets = f4load(kLaneOffsets);
+    const float4 zero = f4splat(0.0f);
+    const float4 a0 = f4splat(edgeA[0]), a1 = f4splat(edgeA[1]), a2 = f4splat(edgeA[2]);
+    const float4 depthStep = f4splat(depthA);
+
+    for (int row = minY; row <= maxY; row++) {
+        float py = row + 0.5f;
+        float rowEdge[3];
+        for (int k = 0; k < 3; k++) rowEdge[k] = edgeB[k] * py + edgeC[k];
+
+        // Where the row crosses the edges, widened by a pixel so that
+        // rounding can't lose coverage; the masks below decide.
+        float spanLeft = left, spanRight = right;
+        bool empty = false;
+        for (int k = 0; k < 3; k++) {
+            if (edgeA[k] > 0.0f) {
+                spanLeft = std::max(spanLeft, -rowEdge[k] * invEdgeA[k] - 1.5f);
+            } else if (edgeA[k] < 0.0f) {
+                spanRight = std::min(spanRight, -rowEdge[k] * invEdgeA[k] + 0.5f);
+            } else {
+                empty = empty || rowEdge[k] < 0.0f;
+            }
+        }
+        if (empty || spanLeft > spanRight) continue;
+        int colBegin = ((int) ceilf(spanLeft)) & ~3;
+        int colEnd = (int) floorf(spanRight);
+
+        float4 rowE0 = f4splat(rowEdge[0]);
+        float4 rowE1 = f4splat(rowEdge[1]);
+        float4 rowE2 = f4splat(rowEdge[2]);
+        float4 rowDepth = f4splat(depthB * py + depthC);
+        float *depthRow = &mDepth[row * kWidth];
+
+        for (int col = colBegin; col <= colEnd; col += 4) {
+            float4 px = f4splat((float) col) + laneOffsets;
+            mask4 covered = m4and(m4and(f4greaterEqual(a0 * px + rowE0, zero),
+                                        f4greaterEqual(a1 * px + rowE1, zero)),
+                                  f4greaterEqual(a2 * px + rowE2, zero));
+            if (!m4any(covered)) continue;
+
+            float4 depth = depthStep * px + rowDepth;
+            float4 old = f4load(&depthRow[col]);
+            f4store(&depthRow[col], f4select(covered, f4min(old, depth), old));
+        }
+    }
+}
+
+void OcclusionCuller::finishOccluders() {
+    for (int ty = 0; ty < kTilesY; ty++) {
+        for (int tx = 0; tx < kTilesX; tx++) {
+            float4 farthest = f4splat(-FLT_MAX);
+            for (int row = ty * kTileSize; row < (ty + 1) * kTileSize; row++) {
+                const float *depthRow = &mDepth[row * kWidth + tx * kTileSize];
+                for (int col = 0; col < kTileSize; col += 4) {
+                    farthest = f4max(farthest, f4load(&depthRow[col]));
+                }
+            }
+            float lanes[4];
+            f4store(lanes, farthest);
+            mTileMaxDepth[ty * kTilesX + tx] =
+                    std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(const Aabb &box) const {
+    // Screen rectangle and nearest depth of the box corners.
+    float left = FLT_MAX, right = -FLT_MAX, bottom = FLT_MAX, top = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; corner++) {
+        vector4 clip = mViewProj * makevector4(corner & 1 ? box.max[0] : box.min[0],
+                                               corner & 2 ? box.max[1] : box.min[1],
+                                               corner & 4 ? box.max[2] : box.min[2], 1.0f);
+        // Boxes reaching past the near plane are taken as visible.
+        if (clip.w <= 0.0f || clip.z < -clip.w) return false;
+
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * kWidth;
+        float y = (clip.y * invW * 0.5f + 0.5f) * kHeight;
+        left = std::min(left, x);
+        right = std::max(right, x);
+        bottom = std::min(bottom, y);
+        top = std::max(top, y);
+        nearest = std::min(nearest, clip.z * invW);
+    }
+
+    // Occluders only cover the pixels whose centers they do, so a box
+    // just past an occluder's edge can sit in a pixel marked covered.
+    // Widened by a pixel, the rectangle always reaches a pixel center
+    // on the box's side of any edge.
+    left = std::max(left - 1.0f, 0.0f);
+    right = std::min(right + 1.0f, kWidth - 1.0f);
+    bottom = std::max(bottom - 1.0f, 0.0f);
+    top = std::min(top + 1.0f, kHeight - 1.0f);
+    if (left > right || bottom > top) return false;
+    int minX = (int) left, maxX = (int) right;
+    int minY = (int) bottom, maxY = (int) top;
+
+    for (int ty = minY / kTileSize; ty <= maxY / kTileSize; ty++) {
+        for (int tx = minX / kTileSize; tx <= maxX / kTileSize; tx++) {
+            // Behind everything drawn in the tile.
+            if (nearest > mTileMaxDepth[ty * kTilesX + tx]) continue;
+
+            int rowEnd = std::min(maxY, (ty + 1) * kTileSize - 1);
+            int colEnd = std::min(maxX, (tx + 1) * kTileSize - 1);
+            for (int row = std::max(minY, ty * kTileSize); row <= rowEnd; row++) {
+                for (int col = std::max(minX, tx * kTileSize); col <= colEnd; col++) {
+                    if (nearest <= mDepth[row * kWidth + col]) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
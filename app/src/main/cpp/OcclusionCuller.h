@@ -0,0 +1,93 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_OCCLUSIONCULLER_H
+#define GPU_EMULATION_STRESS_TEST_OCCLUSIONCULLER_H
+
+#include "Bounds.h"
+#include "EntityStore.h"
+#include "RenderModel.h"
+#include "matrix.h"
+
+#include <cstdint>
+#include <vector>
+
+// Software occlusion culling. Large models are rasterized at low
+// resolution into a CPU depth buffer, whose per-tile maximum then tells
+// whether the bounding box of an object is entirely behind them.
+class OcclusionCuller {
+public:
+    // Keeps the triangles of the models big enough to hide others, and
+    // of the batched entities using them, in world space. Call while the
+    // models have CPU data.
+    void setOccluders(const EntityStore &entities, const std::vector<RenderModel> &models);
+
+    bool isOccluder(render_state_handle_t model) const {
+        return model < mModelMeshes.size() && !mModelMeshes[model].indices.empty();
+    }
+
+    // Starts a frame seen through |viewProj|, with the static occluders
+    // in view already drawn.
+    void begin(const matrix4 &viewProj);
+
+    void addOccluder(render_state_handle_t model, const matrix4 &world);
+
+    // Call after the last addOccluder() and before testing.
+    void finishOccluders();
+
+    bool isOccluded(const Aabb &box) const;
+
+    static const int kWidth = 256;
+    static const int kHeight = 144;
+    static const int kTileSize = 8;
+
+private:
+    struct Mesh {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+    };
+
+    // Range of |mStaticMesh|, whose indices count from |firstVertex|.
+    struct StaticOccluder {
+        Aabb bounds;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+    };
+
+    void rasterizeMesh(const float *positions, size_t vertexCount, const uint32_t *indices,
+                       size_t indexCount, const matrix4 &toClip);
+
+    // Takes buffer x, y and depth of each corner.
+    void rasterizeTriangle(const float *a, const float *b, const float *c);
+
+    // By render model; empty for those that aren't occluders.
+    std::vector<Mesh> mModelMeshes;
+    Mesh mStaticMesh;
+    std::vector<StaticOccluder> mStaticOccluders;
+
+    matrix4 mViewProj;
+    // Clip and screen space positions of the mesh being rasterized.
+    std::vector<float> mClip;
+    std::vector<float> mScreen;
+
+    // Normalized device depth, nearest occluder first.
+    std::vector<float> mDepth;
+    std::vector<float> mTileMaxDepth;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_OCCLUSIONCULLER_H
@@ -16,69 +16,23 @@
 
 #include "ParticleSystem.h"
 
+#include "JobSystem.h"
 #include "log.h"
+#include "simd.h"
 
 #include <algorithm>
-#include <cstdlib>
 
-struct RandomState {
-    bool initialized = false;
-    int randomSeed;
-};
-
-static RandomState sRandomState;
-
-static void sInitRandom() {
-    if (sRandomState.initialized) return;
-
-    sRandomState.randomSeed = 0xBA5EFEA2;
-    srand(sRandomState.randomSeed);
-    sRandomState.initialized = true;
-}
-
-// Yes, these are not great but they make stuff that looks
-// different
-static int sUniformInteger(int start, int end) {
-    if (start == end) return start;
-
-    int r = rand() % (end - start);
-    return start + r;
-}
-
-static float sUniformFloat(float start, float end) {
-    float num = (float) rand();
-    float den = (float) RAND_MAX;
-    float frac = num / den;
+// Particles stop once they are this far along the path.
+static const float kMaxPathProgress = 0.995f;
 
-    return start + (end - start) * frac;
-}
-
-static bool sFlip(float prob) {
-    if (sUniformFloat(0, 1) < prob) return true;
-    return false;
-}
-
-static vector4 sRandomDirection() {
-    float x = (sFlip(0.5) ? -1.0f : 1.0f) * sUniformFloat(0.1f, 1.0f);
-    float y = (sFlip(0.5) ? -1.0f : 1.0f) * sUniformFloat(0.1f, 1.0f);
-    float z = (sFlip(0.5) ? -1.0f : 1.0f) * sUniformFloat(0.1f, 1.0f);
-    return v4normed(makevector4(x, y, z, 0));
-}
-
-template<class T>
-static T &sRandomSelect(std::vector<T> &items) {
-    return items[sUniformInteger(0, items.size() - 1)];
-}
-
-ParticleSystem::ParticleSystem() {
-    sInitRandom();
-}
+ParticleSystem::ParticleSystem(uint64_t seed) : mRandom(seed) {}
 
 void ParticleSystem::setCountAndStartEnd(int count_in, int begin_in, int end_in) {
     begin = begin_in;
     end = end_in;
     count = count_in;
     mCurrentCount = count_in;
+    mPool.reserve(count_in);
 
     int onInterval = end - begin;
 
@@ -104,125 +58,327 @@ void ParticleSystem::setCountAndStartEnd(int count_in, int begin_in, int end_in)
     }
 }
 
-void ParticleSystem::setFrame(int frame) {
-    mFrame = frame;
+void ParticleSystem::setFrame(float frameTime) {
+    mFrameTime = frameTime;
+    mFrame = (int) frameTime;
 }
 
 void ParticleSystem::updateParticlesToEntities(WorldState *world) {
+    scheduleSpawns();
+    spawnParticles(world);
+    updateParticles(world);
+
+    mLastFrame = mFrame;
+    mLastFrameTime = mFrameTime;
+}
+
+void ParticleSystem::scheduleSpawns() {
+    mSpawnLifeOffsets.clear();
     if (mFrame >= begin && mFrame <= end) {
         for (int i = mLastFrame + 1; i <= mFrame; i++) {
             if (mCurrentCount) {
                 if (mMultiParticleSpawn) {
                     for (int j = 0; j < mParticlesPerFrameBase; j++) {
                         mCurrentCount--;
-                        spawnParticle(world, i - mFrame);
+                        mSpawnLifeOffsets.push_back(i - mFrame);
                     }
 
                     if (mAdditionalParticleInterval &&
                         ((i - begin) % mAdditionalParticleInterval == 0)) {
                         mCurrentCount--;
-                        spawnParticle(world, i - mFrame);
+                        mSpawnLifeOffsets.push_back(i - mFrame);
                     }
                 } else {
                     if (((i - begin) % mSpawnInterval == 0)) {
                         mCurrentCount--;
-                        spawnParticle(world, i - mFrame);
+                        mSpawnLifeOffsets.push_back(i - mFrame);
                     }
                 }
             }
         }
     }
-    updateParticles(world);
+}
 
-    mLastFrame = mFrame;
+// The random numbers are drawn in one order whatever the number of
+// threads, so the particles can then be set up in parallel.
+void ParticleSystem::drawSpawnRandoms() {
+    size_t count = mSpawnLifeOffsets.size();
+    mSpawnModels.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        mSpawnModels[i] = mRandom.uniformInt(0, (int) models.size() - 1);
+    }
+    mSpawnUniforms.resize(count * kUniformsPerParticle);
+    mRandom.fillUniform(mSpawnUniforms.data(), mSpawnUniforms.size(), 0.0f, 1.0f);
+    mSpawnDirections.resize(count * kDirectionsPerParticle);
+    mRandom.fillDirections(mSpawnDirections.data(), mSpawnDirections.size());
 }
 
-void ParticleSystem::spawnParticle(WorldState *world, int lifeOffset) {
-    entity_handle_t newHandle = world->spawnEntity();
-    mLiveParticles.push_back(newHandle);
-    initParticle(world->entities[newHandle], lifeOffset);
+void ParticleSystem::spawnParticles(WorldState *world) {
+    size_t count = mSpawnLifeOffsets.size();
+    if (!count) return;
+
+    size_t first = mPool.size();
+    mPool.resize(first + count);
+    for (size_t i = 0; i < count; i++) {
+        mPool.handles[first + i] = world->spawnEntity();
+    }
+
+    drawSpawnRandoms();
+
+    EntityStore &entities = world->entities;
+    JobSystem::get()->parallelFor(
+            count, JobSystem::kEntityChunk,
+            [this, &entities, first](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    initParticle(entities, first + i, i);
+                }
+            });
 }
 
+// Particles that died this frame are dropped first, by moving the last
+// one into their place; the order of the pool doesn't matter. Each
+// particle only writes its own entity, so the rest runs in parallel.
 void ParticleSystem::updateParticles(WorldState *world) {
-    for (const auto handle : mLiveParticles) {
-        updateParticle(world->entity(handle));
+    EntityStore &entities = world->entities;
+    size_t i = 0;
+    while (i < mPool.size()) {
+        if (!entities.live(mPool.handles[i])) {
+            mPool.remove(i);
+        } else {
+            i++;
+        }
     }
+
+    if (!followPath) return;
+
+    float frameFraction = mFrameTime - (float) mFrame;
+    float elapsedFrames = mFrameTime - mLastFrameTime;
+    JobSystem::get()->parallelFor(
+            mPool.size(), JobSystem::kEntityChunk,
+            [this, &entities, frameFraction, elapsedFrames](size_t begin, size_t end) {
+                for (size_t first = begin; first < end; first += kBlockSize) {
+                    updateParticleBlock(entities, first, std::min(kBlockSize, end - first),
+                                        frameFraction, elapsedFrames);
+                }
+            });
 }
 
-void ParticleSystem::updateForDeadEntities(const std::vector<entity_handle_t> &dyingIndices,
-                                           const std::vector<entity_handle_t> &newIndices) {
-    mLiveParticles.erase(
-            std::remove_if(
-                    mLiveParticles.begin(), mLiveParticles.end(),
-                    [&newIndices](const entity_handle_t i) {
-                        if (i < newIndices.size()) {
-                            return newIndices[i] == -1;
-                        } else {
-                            // must be just added, then we only need
-                            // adjust by death offset and leave it
-                            return false;
-                        }
-                    }),
-            mLiveParticles.end());
-
-    int death_offset = dyingIndices.size();
-    for (auto &handle : mLiveParticles) {
-        if (handle < newIndices.size()) {
-            handle = newIndices[handle];
-        } else {
-            handle -= death_offset;
+ParticleSystem::GpuParticle ParticleSystem::spawnParameters(size_t spawn) const {
+    const float *uniforms = &mSpawnUniforms[spawn * kUniformsPerParticle];
+    const vector4 *directions = &mSpawnDirections[spawn * kDirectionsPerParticle];
+
+    GpuParticle particle;
+    particle.spawnFrame = 0.0f;
+    particle.offset[0] = -0.3f + 0.6f * uniforms[0];
+    particle.offset[1] = -0.3f + 0.6f * uniforms[1];
+    particle.offset[2] = -0.3f + 0.6f * uniforms[2];
+    particle.axis[0] = directions[0].x;
+    particle.axis[1] = directions[0].y;
+    particle.axis[2] = directions[0].z;
+    particle.spinPeriod = (float) (int) (60.0f * (0.8f + 0.4f * uniforms[3]));
+    particle.orientation = qfromframe(directions[1], directions[2]);
+    particle.scale = scale + scale * randomScale * (uniforms[4] - 0.5f);
+    return particle;
+}
+
+void ParticleSystem::initParticle(EntityStore &entities, size_t particle, size_t spawn) {
+    GpuParticle params = spawnParameters(spawn);
+
+    mPool.offsetX[particle] = params.offset[0];
+    mPool.offsetY[particle] = params.offset[1];
+    mPool.offsetZ[particle] = params.offset[2];
+
+    mPool.axisX[particle] = params.axis[0];
+    mPool.axisY[particle] = params.axis[1];
+    mPool.axisZ[particle] = params.axis[2];
+    mPool.spinPeriod[particle] = params.spinPeriod;
+
+    const quaternion &orientation = params.orientation;
+    mPool.rotX[particle] = orientation.x;
+    mPool.rotY[particle] = orientation.y;
+    mPool.rotZ[particle] = orientation.z;
+    mPool.rotW[particle] = orientation.w;
+
+    entity_handle_t handle = mPool.handles[particle];
+    size_t index = entities.indexOf(handle);
+    entities.renderModel[index] = models[mSpawnModels[spawn]];
+    entities.lifetimes[index].framesToLive = lifetime + mSpawnLifeOffsets[spawn];
+
+    float s = params.scale;
+    entities.setScale(handle, makevector4(s, s, s, 0));
+    entities.setFrame(handle, makevector4(0, 0, 0, 1), orientation);
+}
+
+void ParticleSystem::spawnForGpu() {
+    gpuParticles.assign(models.size(), std::vector<GpuParticle>());
+    for (int frame = begin; frame <= end; frame++) {
+        setFrame((float) frame);
+        mLastFrame = frame - 1;
+        scheduleSpawns();
+        drawSpawnRandoms();
+        for (size_t i = 0; i < mSpawnLifeOffsets.size(); i++) {
+            GpuParticle particle = spawnParameters(i);
+            particle.spawnFrame = (float) frame;
+            gpuParticles[mSpawnModels[i]].push_back(particle);
         }
     }
+    mLastFrame = end;
+
+    // Particles stop before the end of the path, which arclength
+    // lookups don't reach.
+    std::vector<float> t(kGpuPathSamples);
+    for (int i = 0; i < kGpuPathSamples; i++) {
+        t[i] = kMaxPathProgress * (float) i / (float) (kGpuPathSamples - 1);
+    }
+    std::vector<float> x(kGpuPathSamples), y(kGpuPathSamples), z(kGpuPathSamples);
+    if (followPath) {
+        followPath->evalArclen(t.data(), t.size(), x.data(), y.data(), z.data());
+    }
+    gpuPath.resize(3 * kGpuPathSamples);
+    for (int i = 0; i < kGpuPathSamples; i++) {
+        gpuPath[3 * i + 0] = x[i];
+        gpuPath[3 * i + 1] = y[i];
+        gpuPath[3 * i + 2] = z[i];
+    }
 }
 
-void ParticleSystem::initParticle(Entity &entity, int lifeOffset) {
-    entity.framesToLive = lifetime + lifeOffset;
-    entity.renderModel = sRandomSelect(models);
+float ParticleSystem::movingFrames() const {
+    return kMaxPathProgress * 0.5f * (float) lifetime;
+}
 
-    float randomOffX = sUniformFloat(-0.3f, 0.3f);
-    float randomOffY = sUniformFloat(-0.3f, 0.3f);
-    float randomOffZ = sUniformFloat(-0.3f, 0.3f);
+// A particle lives from its spawn frame until |lifetime| frames later.
+void ParticleSystem::gpuLiveRange(size_t model, float frameTime,
+                                  size_t *first, size_t *end) const {
+    const std::vector<GpuParticle> &particles = gpuParticles[model];
+    auto spawnedAfter = [](float frame, const GpuParticle &particle) -> bool {
+        return frame < particle.spawnFrame;
+    };
+    *first = std::upper_bound(particles.begin(), particles.end(),
+                              frameTime - (float) lifetime, spawnedAfter) - particles.begin();
+    *end = std::upper_bound(particles.begin(), particles.end(),
+                            frameTime, spawnedAfter) - particles.begin();
+}
 
-    entity.initialOffset =
-            makevector4(
-                    randomOffX, randomOffY, randomOffZ, 1);
+namespace {
 
-    entity.spinAxis = sRandomDirection();
-    entity.spinPeriod = 60 * sUniformFloat(0.8, 1.2);
+// Quaternions, four at a time.
+struct Quat4 {
+    float4 x, y, z, w;
+};
 
-    entity.fwd = sRandomDirection();
-    entity.up = sRandomDirection();
+} // namespace
 
-    float randomScalePart = scale + scale * randomScale * sUniformFloat(-0.5f, 0.5f);
-    entity.scale =
-            makevector4(
-                    randomScalePart,
-                    randomScalePart,
-                    randomScalePart,
-                    0);
+// Rotation by |b| followed by |a|; see qmul.
+static inline Quat4 sMul(const Quat4 &a, const Quat4 &b) {
+    return Quat4{a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+                 a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+                 a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+                 a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
 }
 
-void ParticleSystem::updateParticle(Entity &entity) {
-    if (!followPath) return;
+static inline Quat4 sNormed(const Quat4 &q) {
+    float4 length = f4sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+    return Quat4{q.x / length, q.y / length, q.z / length, q.w / length};
+}
 
-    // int particleFrame = begin + (lifetime - entity.framesToLive);
-    // float pathProgress =
-    //     followPath->action().evalAtFrame(particleFrame, true /* normalized */);
+// Lifetimes count whole frames; |frameFraction| places the particle
+// between them and |elapsedFrames| scales the spin, so motion doesn't
+// depend on how often this is called.
+void ParticleSystem::updateParticleBlock(EntityStore &entities, size_t first, size_t count,
+                                         float frameFraction, float elapsedFrames) {
+    // Where each particle is along the path, padded to whole groups
+    // with particles that stay put.
+    float progress[kBlockSize];
+    uint32_t entityIndex[kBlockSize];
+    // Particles still moving, and their path positions.
+    uint32_t moving[kBlockSize];
+    float pathT[kBlockSize];
+    float pathX[kBlockSize], pathY[kBlockSize], pathZ[kBlockSize];
+    size_t movingCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t index = entities.indexOf(mPool.handles[first + i]);
+        entityIndex[i] = (uint32_t) index;
+        float entityFrames =
+                2.0f * ((float) (lifetime - entities.lifetimes[index].framesToLive) +
+                        frameFraction);
+        progress[i] = entityFrames / (float) lifetime;
+        if (progress[i] < kMaxPathProgress) {
+            moving[movingCount] = (uint32_t) i;
+            pathT[movingCount] = progress[i];
+            movingCount++;
+        }
+    }
+    if (!movingCount) return;
+    for (size_t i = count; i % 4; i++) {
+        progress[i] = kMaxPathProgress;
+    }
 
-    int entityFrames =
-            2 * (lifetime - entity.framesToLive);
-    float pathProgress =
-            entityFrames / (float) lifetime;
+    followPath->evalArclen(pathT, movingCount, pathX, pathY, pathZ);
+
+    // Spin about each particle's axis: one small rotation on top of the
+    // current orientation, renormalized so rounding doesn't build up.
+    const float4 stopped = f4splat(kMaxPathProgress);
+    const float4 halfTurn = f4splat(3.14159265f * elapsedFrames);
+    for (size_t g = 0; g < count; g += 4) {
+        size_t p = first + g;
+        mask4 keep = f4greaterEqual(f4load(&progress[g]), stopped);
+        if (!m4any(f4lessEqual(f4load(&progress[g]), stopped))) continue;
+
+        float4 s, c;
+        f4sincos(halfTurn / f4load(&mPool.spinPeriod[p]), &s, &c);
+        Quat4 spin = {f4load(&mPool.axisX[p]) * s, f4load(&mPool.axisY[p]) * s,
+                      f4load(&mPool.axisZ[p]) * s, c};
+        Quat4 rot = {f4load(&mPool.rotX[p]), f4load(&mPool.rotY[p]),
+                     f4load(&mPool.rotZ[p]), f4load(&mPool.rotW[p])};
+        Quat4 spun = sNormed(sMul(spin, rot));
+
+        f4store(&mPool.rotX[p], f4select(keep, rot.x, spun.x));
+        f4store(&mPool.rotY[p], f4select(keep, rot.y, spun.y));
+        f4store(&mPool.rotZ[p], f4select(keep, rot.z, spun.z));
+        f4store(&mPool.rotW[p], f4select(keep, rot.w, spun.w));
+    }
 
-    if (pathProgress >= 0.995) return;
+    for (size_t m = 0; m < movingCount; m++) {
+        size_t p = first + moving[m];
+        size_t index = entityIndex[moving[m]];
+        entities.posX[index] = pathX[m] + mPool.offsetX[p];
+        entities.posY[index] = pathY[m] + mPool.offsetY[p];
+        entities.posZ[index] = pathZ[m] + mPool.offsetZ[p];
+        entities.rotX[index] = mPool.rotX[p];
+        entities.rotY[index] = mPool.rotY[p];
+        entities.rotZ[index] = mPool.rotZ[p];
+        entities.rotW[index] = mPool.rotW[p];
+        entities.flags[index] |= EntityStore::kDirty;
+    }
+}
+
+std::array<std::vector<float> *, 11> ParticleSystem::Pool::floatArrays() {
+    return {{&offsetX, &offsetY, &offsetZ,
+             &axisX, &axisY, &axisZ,
+             &spinPeriod,
+             &rotX, &rotY, &rotZ, &rotW}};
+}
+
+void ParticleSystem::Pool::reserve(size_t count) {
+    size_t padded = (count + 3) & ~(size_t) 3;
+    if (padded <= handles.size()) return;
+    handles.resize(padded, EntityStore::kInvalidHandle);
+    for (std::vector<float> *array : floatArrays()) {
+        array->resize(padded, 0.0f);
+    }
+}
 
-    followPath->evalArclen(pathProgress,
-                           &entity.pos.x,
-                           &entity.pos.y,
-                           &entity.pos.z);
-    entity.pos = entity.pos + entity.initialOffset;
+void ParticleSystem::Pool::resize(size_t count) {
+    if (count > handles.size()) reserve(std::max(count, 2 * handles.size()));
+    mSize = count;
+}
 
-    float angle = 2 * 3.14159265358979;
-    angle /= (float) entity.spinPeriod;
-    entity.applyRotation(entity.spinAxis, angle);
+void ParticleSystem::Pool::remove(size_t index) {
+    size_t last = mSize - 1;
+    handles[index] = handles[last];
+    for (std::vector<float> *array : floatArrays()) {
+        (*array)[index] = (*array)[last];
+    }
+    mSize = last;
 }
@@ -19,7 +19,9 @@
 #include "Entity.h"
 #include "WorldState.h"
 #include "BezierCurve.h"
+#include "Random.h"
 
+#include <array>
 #include <vector>
 
 typedef uint32_t entity_handle_t;
@@ -28,7 +30,8 @@ class WorldState;
 
 class ParticleSystem {
 public:
-    ParticleSystem();
+    // Each system has its own random sequence, set by |seed|.
+    explicit ParticleSystem(uint64_t seed);
 
     int count;
     int begin;
@@ -43,21 +46,66 @@ public:
 
     void setCountAndStartEnd(int count_in, int begin, int end);
 
-    void setFrame(int frame);
+    // |frameTime| is in animation frames and may be fractional.
+    void setFrame(float frameTime);
 
     void updateParticlesToEntities(WorldState *world);
 
-    void updateForDeadEntities(const std::vector<entity_handle_t> &dyingIndices,
-                               const std::vector<entity_handle_t> &newIndices);
+    // For particles simulated by the renderer instead; see
+    // WorldState::gpuParticles. What a particle is spawned with.
+    struct GpuParticle {
+        float spawnFrame;
+        float offset[3];
+        float axis[3];
+        // In whole frames.
+        float spinPeriod;
+        quaternion orientation;
+        float scale;
+    };
+
+    // Spawns every particle of the system up front, with the random
+    // numbers it would get if updated on every frame, and samples the
+    // path. Takes the place of updateParticlesToEntities.
+    void spawnForGpu();
+
+    // By index into |models|, in spawn order.
+    std::vector<std::vector<GpuParticle> > gpuParticles;
+
+    // Path positions (xyz) at even steps of arclength, from the start
+    // to where particles stop after movingFrames().
+    static const int kGpuPathSamples = 256;
+    std::vector<float> gpuPath;
+
+    float movingFrames() const;
+
+    // The particles of |model| alive at |frameTime| are [*first, *end).
+    void gpuLiveRange(size_t model, float frameTime, size_t *first, size_t *end) const;
 
 private:
-    void spawnParticle(WorldState *world, int lifeOffset);
+    // Fills |mSpawnLifeOffsets| for the frames since the last update.
+    void scheduleSpawns();
+
+    // Draws the random numbers of the particles in |mSpawnLifeOffsets|.
+    void drawSpawnRandoms();
+
+    // What particle |spawn| of those spawned now starts out with; the
+    // spawn frame is left to the caller.
+    GpuParticle spawnParameters(size_t spawn) const;
+
+    // Spawns a particle for each of |mSpawnLifeOffsets|.
+    void spawnParticles(WorldState *world);
 
     void updateParticles(WorldState *world);
 
-    void initParticle(Entity &entity, int lifeOffset);
+    // Sets up |particle| of the pool and its entity from the random
+    // numbers drawn for |spawn|, its index among those spawned now.
+    void initParticle(EntityStore &entities, size_t particle, size_t spawn);
 
-    void updateParticle(Entity &entity);
+    // Moves and spins particles [first, first + count) of the pool, at
+    // most kBlockSize and |first| a multiple of 4, and writes them to
+    // their entities.
+    void updateParticleBlock(EntityStore &entities, size_t first, size_t count,
+                             float frameFraction, float elapsedFrames);
 
     int mCurrentCount = 0;
     int mSpawnInterval = 0;
@@ -69,7 +117,51 @@ private:
 
     int mFrame = 0;
     int mLastFrame = 0;
+    float mFrameTime = 0.0f;
+    float mLastFrameTime = 0.0f;
     int mParticlesStartIndex = 0;
 
-    std::vector<entity_handle_t> mLiveParticles;
-};
\ No newline at end of file
+    // Live particles as parallel arrays, allocated up front for all the
+    // particles the system spawns; their entities only hold what
+    // drawing needs. Arrays are padded to a multiple of 4 so that the
+    // update works on whole groups of 4.
+    struct Pool {
+        std::vector<entity_handle_t> handles;
+        std::vector<float> offsetX, offsetY, offsetZ;
+        std::vector<float> axisX, axisY, axisZ;
+        std::vector<float> spinPeriod;
+        std::vector<float> rotX, rotY, rotZ, rotW;
+
+        size_t size() const { return mSize; }
+
+        void reserve(size_t count);
+
+        // New particles come last and are left uninitialized.
+        void resize(size_t count);
+
+        // Moves the last particle into |index|.
+        void remove(size_t index);
+
+    private:
+        std::array<std::vector<float> *, 11> floatArrays();
+
+        size_t mSize = 0;
+    };
+
+    static const size_t kBlockSize = 64;
+
+    Pool mPool;
+
+    Random mRandom;
+
+    static const int kUniformsPerParticle = 5;
+    static const int kDirectionsPerParticle = 3;
+
+    // Particles to spawn this update, and their random numbers, drawn
+    // in one go.
+    std::vector<int> mSpawnLifeOffsets;
+    // Indices into |models|.
+    std::vector<int> mSpawnModels;
+    std::vector<float> mSpawnUniforms;
+    std::vector<vector4> mSpawnDirections;
+};
\ No newline at end of file
@@ -0,0 +1,134 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Random.h"
+
+#include "simd.h"
+
+// Expands the seed into well mixed state words; see splitmix64.
+static uint64_t sSplitMix64(uint64_t &x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Random::Random(uint64_t seed) {
+    for (int lane = 0; lane < 4; lane++) {
+        uint64_t a = sSplitMix64(seed);
+        uint64_t b = sSplitMix64(seed);
+        mState[0][lane] = (uint32_t) a;
+        mState[1][lane] = (uint32_t) (a >> 32);
+        mState[2][lane] = (uint32_t) b;
+        mState[3][lane] = (uint32_t) (b >> 32);
+    }
+}
+
+// One xoshiro128+ step of every stream.
+static inline uint4 sNext(uint4 s[4]) {
+    uint4 result = s[0] + s[3];
+    uint4 t = u4shl<9>(s[1]);
+    s[2] = s[2] ^ s[0];
+    s[3] = s[3] ^ s[1];
+    s[1] = s[1] ^ s[2];
+    s[0] = s[0] ^ s[3];
+    s[2] = s[2] ^ t;
+    s[3] = u4rotl<11>(s[3]);
+    return result;
+}
+
+void Random::refill() {
+    uint4 s[4] = {u4load(mState[0]), u4load(mState[1]), u4load(mState[2]), u4load(mState[3])};
+    u4store(mQueued, sNext(s));
+    for (int i = 0; i < 4; i++) {
+        u4store(mState[i], s[i]);
+    }
+    mQueuedCount = 4;
+}
+
+uint32_t Random::nextUint() {
+    if (!mQueuedCount) refill();
+    return mQueued[4 - mQueuedCount--];
+}
+
+int Random::uniformInt(int start, int end) {
+    if (end <= start) return start;
+    // Multiply and shift rather than modulo, which favours low values.
+    return start + (int) (((uint64_t) nextUint() * (uint32_t) (end - start)) >> 32);
+}
+
+float Random::uniformFloat(float start, float end) {
+    float frac = (float) (nextUint() >> 8) * (1.0f / 16777216.0f);
+    return start + (end - start) * frac;
+}
+
+void Random::fillUniform(float *out, size_t count, float start, float end) {
+    size_t i = 0;
+    for (; i < count && mQueuedCount; i++) {
+        out[i] = uniformFloat(start, end);
+    }
+
+    // Whole batches straight from the streams, rounded the same way
+    // as uniformFloat().
+    uint4 s[4] = {u4load(mState[0]), u4load(mState[1]), u4load(mState[2]), u4load(mState[3])};
+    float4 range = f4splat(end - start);
+    float4 offset = f4splat(start);
+    for (; i + 4 <= count; i += 4) {
+        f4store(out + i, offset + range * u4unitFloat(sNext(s)));
+    }
+    for (int w = 0; w < 4; w++) {
+        u4store(mState[w], s[w]);
+    }
+
+    for (; i < count; i++) {
+        out[i] = uniformFloat(start, end);
+    }
+}
+
+void Random::fillDirections(vector4 *out, size_t count) {
+    // Each component comes from one number: its sign from whether it
+    // is in the upper half, its size from where in that half.
+    const float4 zero = f4splat(0.0f);
+    const float4 two = f4splat(2.0f);
+    const float4 one = f4splat(1.0f);
+    const float4 minSize = f4splat(0.1f);
+    const float4 sizeRange = f4splat(0.9f);
+    auto component = [&](float4 u) -> float4 {
+        float4 t = u * two - one;
+        float4 size = minSize + sizeRange * f4max(t, zero - t);
+        return f4select(f4greaterEqual(t, zero), size, zero - size);
+    };
+
+    size_t i = 0;
+    while (i < count) {
+        float u[12];
+        fillUniform(u, 12, 0.0f, 1.0f);
+        float4 x = component(f4load(u));
+        float4 y = component(f4load(u + 4));
+        float4 z = component(f4load(u + 8));
+        float4 length = f4sqrt(x * x + y * y + z * z);
+        x = x / length;
+        y = y / length;
+        z = z / length;
+
+        float4 w = zero;
+        f4transpose(x, y, z, w);
+        const float4 directions[4] = {x, y, z, w};
+        for (int lane = 0; lane < 4 && i < count; lane++, i++) {
+            f4store(&out[i].x, directions[lane]);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_RANDOM_H
+#define GPU_EMULATION_STRESS_TEST_RANDOM_H
+
+#include "matrix.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Seedable xoshiro128+ generator, run as four interleaved streams so
+// that batches come out four numbers at a time. The sequence depends
+// only on the seed, not on the platform or its libc, and single draws
+// and batches take numbers from the same sequence in order.
+class Random {
+public:
+    explicit Random(uint64_t seed);
+
+    uint32_t nextUint();
+
+    // In [start, end), or start if the range is empty.
+    int uniformInt(int start, int end);
+
+    // In [start, end).
+    float uniformFloat(float start, float end);
+
+    void fillUniform(float *out, size_t count, float start, float end);
+
+    // Unit vectors, w = 0, whose components each have a random sign
+    // and are 0.1 to 1 before normalizing, so none points straight
+    // along an axis.
+    void fillDirections(vector4 *out, size_t count);
+
+private:
+    // Advances all streams and queues their outputs.
+    void refill();
+
+    // Words of the state, one stream per lane.
+    alignas(16) uint32_t mState[4][4];
+
+    alignas(16) uint32_t mQueued[4];
+    int mQueuedCount = 0;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_RANDOM_H
@@ -16,14 +16,39 @@
 
 #include "RenderModel.h"
 
-#include "TextureLoader.h"
 #include "util.h"
 
-void RenderModel::loadByBasename(const std::string &basename) {
+void RenderModel::loadByBasename(const std::string &basename, float detail) {
     LOGV("Loading %s", basename.c_str());
-    geometry = OBJParse(basename + ".obj");
-    diffuseRGBA8 = TextureLoader::get()->loadPNGAsRGBA8(basename + "_diffuse.png",
-                                                        diffuseTexWidth,
-                                                        diffuseTexHeight);
+    mBasename = basename;
+    mDetail = detail;
+    AssetRegistry *registry = AssetRegistry::get();
+    if (detail < 1.0f) {
+        geometry = registry->loadSimplifiedMesh(basename + ".obj", detail, geometryHash);
+    } else {
+        geometry = registry->loadMesh(basename + ".obj", geometryHash);
+    }
+    indexCount = (uint32_t) geometry->indexData.size();
+    for (int c = 0; c < 3; c++) {
+        boundsMin[c] = geometry->boundsMin[c];
+        boundsMax[c] = geometry->boundsMax[c];
+        boundsCenter[c] = geometry->boundsCenter[c];
+    }
+    boundsRadius = geometry->boundsRadius;
+    diffuse = registry->loadTexture(basename + "_diffuse.png", diffuseHash);
+    diffuseTexWidth = diffuse->width;
+    diffuseTexHeight = diffuse->height;
+    mHasCpuData = true;
     LOGV("Done loading");
 }
+
+void RenderModel::releaseCpuData() {
+    geometry.reset();
+    diffuse.reset();
+    mHasCpuData = false;
+}
+
+void RenderModel::ensureCpuData() {
+    if (mHasCpuData || mBasename.empty()) return;
+    loadByBasename(mBasename, mDetail);
+}
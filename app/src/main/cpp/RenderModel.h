@@ -16,18 +16,56 @@
 
 #pragma once
 
+#include "AssetRegistry.h"
+#include "Entity.h"
 #include "OBJParse.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
 class RenderModel {
 public:
     RenderModel() = default;
 
-    void loadByBasename(const std::string &basename);
+    // With |detail| below 1, the mesh is simplified to that fraction of
+    // its triangles.
+    void loadByBasename(const std::string &basename, float detail = 1.0f);
 
-    OBJParse geometry;
+    const std::string &basename() const { return mBasename; }
+
+    // Lets go of geometry and texels, e.g. once they are on the GPU.
+    // They are freed when no other model shares them. indexCount and
+    // the texture size stay valid.
+    void releaseCpuData();
+
+    // Loads the data again if it was released.
+    void ensureCpuData();
+
+    bool hasCpuData() const { return mHasCpuData; }
+
+    // Shared with every model whose files have the same contents. The
+    // hashes identify that content.
+    std::shared_ptr<const OBJParse> geometry;
+    uint64_t geometryHash = 0;
+    std::shared_ptr<const AssetRegistry::Texture> diffuse;
+    uint64_t diffuseHash = 0;
+
+    uint32_t indexCount = 0;
+    // Model space bounds; see OBJParse.
+    float boundsMin[3] = {0.0f, 0.0f, 0.0f};
+    float boundsMax[3] = {0.0f, 0.0f, 0.0f};
+    float boundsCenter[3] = {0.0f, 0.0f, 0.0f};
+    float boundsRadius = 0.0f;
     unsigned int diffuseTexWidth = 0;
     unsigned int diffuseTexHeight = 0;
-    std::vector<unsigned char> diffuseRGBA8;
+
+    // Coarser stand-ins for this model, finest first, drawn as it gets
+    // smaller on screen.
+    std::vector<render_state_handle_t> lods;
+
+private:
+    std::string mBasename;
+    float mDetail = 1.0f;
+    bool mHasCpuData = false;
 };
\ No newline at end of file
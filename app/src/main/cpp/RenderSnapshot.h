@@ -0,0 +1,71 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_RENDERSNAPSHOT_H
+#define GPU_EMULATION_STRESS_TEST_RENDERSNAPSHOT_H
+
+#include "Entity.h"
+#include "EntityStore.h"
+#include "matrix.h"
+
+#include <cstdint>
+#include <vector>
+
+// Everything a renderer needs to draw one simulated frame. Built by
+// Simulation and not changed while a renderer reads it.
+struct RenderSnapshot {
+    // Bits of ObjectState::inView.
+    enum : uint8_t {
+        kInCameraView = 1,
+        kInLightView = 2,
+    };
+
+    // hopefully, we can sort objects so that
+    // render state doesn't change very much.
+    struct ObjectState {
+        entity_handle_t handle;
+        bool visible;
+        // Views whose frustum the object's world bounds may reach, as
+        // the world's BVH found them. Renderers only test those further.
+        uint8_t inView;
+        render_state_handle_t renderHandle;
+        uint32_t indexCount;
+        matrix4 worldMatrix;
+        matrix4 lastWorldMatrix; // for motion blur
+    };
+
+    matrix4 cameraMatrix;
+    matrix4 cameraSkyboxMatrix;
+    matrix4 lightMatrix;
+
+    // Of the previous snapshot, for motion blur.
+    matrix4 lastCameraMatrix;
+    matrix4 lastCameraSkyboxMatrix;
+
+    // Animation time, in frames, of this and the previous snapshot, for
+    // what the renderer moves itself.
+    float frameTime;
+    float lastFrameTime;
+
+    vector4 cameraPos;
+    vector4 lightPos;
+    // Whether |lightMatrix| and |lightPos| are set.
+    bool hasLight;
+
+    std::vector<ObjectState> objects;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_RENDERSNAPSHOT_H
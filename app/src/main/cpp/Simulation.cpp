@@ -0,0 +1,231 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Simulation.h"
+
+#include "JobSystem.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+
+// How long the thread sleeps when the world has no new frame yet.
+static const int kIdleSleepUs = 1000;
+
+Simulation::Simulation(WorldState *world) : mWorld(world), mDone(false) {}
+
+Simulation::~Simulation() {
+    stop();
+}
+
+void Simulation::start() {
+    if (running()) return;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQuit = false;
+    }
+    mThread = std::thread(&Simulation::threadLoop, this);
+}
+
+void Simulation::stop() {
+    if (!running()) return;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQuit = true;
+    }
+    mConsumed.notify_all();
+    mThread.join();
+}
+
+bool Simulation::step() {
+    return advance();
+}
+
+const RenderSnapshot *Simulation::acquireLatest() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mFresh) return nullptr;
+        std::swap(mFront, mMiddle);
+        mFresh = false;
+    }
+    mConsumed.notify_one();
+    return &mBuffers[mFront];
+}
+
+bool Simulation::done() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDone.load() && !mFresh;
+}
+
+void Simulation::threadLoop() {
+    while (!mDone.load()) {
+        {
+            // Wait for the renderer to take the last snapshot.
+            std::unique_lock<std::mutex> lock(mLock);
+            mConsumed.wait(lock, [this] { return mQuit || !mFresh; });
+            if (mQuit) return;
+        }
+        if (!advance() && !mDone.load()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+        }
+    }
+    LOGV("%s: world done", __func__);
+}
+
+// Only ever called by one thread at a time; the back buffer and the
+// motion blur history belong to it.
+bool Simulation::advance() {
+    if (mDone.load()) return false;
+
+    if (!mWorld->update()) {
+        if (mWorld->done) mDone.store(true);
+        return false;
+    }
+
+    buildSnapshot(mBuffers[mBack]);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    std::swap(mBack, mMiddle);
+    mFresh = true;
+    return true;
+}
+
+void Simulation::buildSnapshot(RenderSnapshot &snapshot) {
+    EntityStore &entities = mWorld->entities;
+
+    const WorldState::CameraInfo &caminfo =
+            mWorld->cameraInfos[mWorld->currentCamera];
+    Entity camera = entities.get(mWorld->currentCamera);
+    camera.updateCameraMatrix(
+            caminfo.fov, caminfo.aspect,
+            caminfo.near, caminfo.far,
+            caminfo.right, caminfo.isOrtho,
+            snapshot.cameraMatrix);
+    camera.updateCameraSkyboxMatrix(
+            caminfo.fov, caminfo.aspect,
+            caminfo.near, caminfo.far,
+            caminfo.right, caminfo.isOrtho,
+            snapshot.cameraSkyboxMatrix);
+    snapshot.cameraPos = camera.pos;
+
+    if (!mHasLastCamera) {
+        mLastCameraMatrix = snapshot.cameraMatrix;
+        mLastCameraSkyboxMatrix = snapshot.cameraSkyboxMatrix;
+        mLastFrameTime = mWorld->currFrameTime;
+        mHasLastCamera = true;
+    }
+    snapshot.lastCameraMatrix = mLastCameraMatrix;
+    snapshot.lastCameraSkyboxMatrix = mLastCameraSkyboxMatrix;
+    mLastCameraMatrix = snapshot.cameraMatrix;
+    mLastCameraSkyboxMatrix = snapshot.cameraSkyboxMatrix;
+
+    snapshot.frameTime = mWorld->currFrameTime;
+    snapshot.lastFrameTime = mLastFrameTime;
+    mLastFrameTime = snapshot.frameTime;
+
+    snapshot.hasLight = mWorld->currentLight < mWorld->cameraInfos.size();
+    if (snapshot.hasLight) {
+        const WorldState::CameraInfo &lightinfo =
+                mWorld->cameraInfos[mWorld->currentLight];
+        Entity light = entities.get(mWorld->currentLight);
+        light.updateCameraMatrix(
+                lightinfo.fov, lightinfo.aspect,
+                lightinfo.near, lightinfo.far,
+                lightinfo.right, lightinfo.isOrtho,
+                snapshot.lightMatrix);
+        snapshot.lightPos = light.pos;
+    }
+
+    std::vector<RenderSnapshot::ObjectState> &objects = snapshot.objects;
+    objects.resize(entities.size());
+    if (objects.empty()) return;
+
+    // Entities change index as others die, so cached state is found by
+    // slot. New entities start out unblurred.
+    mCachedObjects.resize(entities.slotCount(),
+                          CachedObject{EntityStore::kInvalidHandle, 0, identity4(), identity4()});
+
+    const std::vector<RenderModel> &renderModels = mWorld->renderModels;
+    JobSystem::get()->parallelFor(
+            objects.size(), JobSystem::kEntityChunk,
+            [this, &entities, &objects, &renderModels](size_t begin, size_t end) {
+                // Matrices are built four at a time, so a group with any
+                // changed entity is rebuilt whole.
+                for (size_t group = begin; group < end; group += 4) {
+                    size_t groupEnd = std::min(group + 4, end);
+                    bool changed = false;
+                    for (size_t oi = group; oi < groupEnd; oi++) {
+                        const CachedObject &cached =
+                                mCachedObjects[EntityStore::slotOf(entities.handles[oi])];
+                        changed = changed ||
+                                  (entities.flags[oi] & EntityStore::kDirty) ||
+                                  cached.handle != entities.handles[oi];
+                    }
+
+                    matrix4 built[4];
+                    if (changed) {
+                        entities.buildWorldMatrices(group, groupEnd - group,
+                                                    built, sizeof(matrix4));
+                    }
+
+                    for (size_t oi = group; oi < groupEnd; oi++) {
+                        entity_handle_t handle = entities.handles[oi];
+                        CachedObject &cached = mCachedObjects[EntityStore::slotOf(handle)];
+                        if (cached.handle != handle) {
+                            cached.handle = handle;
+                            cached.worldMatrix = built[oi - group];
+                            entities.flags[oi] |= EntityStore::kDirty;
+                        }
+                        cached.lastWorldMatrix = cached.worldMatrix;
+                        if (entities.flags[oi] & EntityStore::kDirty) {
+                            cached.worldMatrix = built[oi - group];
+                            cached.indexCount =
+                                    (uint32_t) renderModels[entities.renderModel[oi]].indexCount;
+                            entities.flags[oi] &= ~EntityStore::kDirty;
+                        }
+
+                        RenderSnapshot::ObjectState &object = objects[oi];
+                        object.handle = handle;
+                        object.visible = (entities.flags[oi] &
+                                          (EntityStore::kRenderable | EntityStore::kBatched)) ==
+                                         EntityStore::kRenderable;
+                        object.inView = 0;
+                        object.renderHandle = entities.renderModel[oi];
+                        object.indexCount = cached.indexCount;
+                        object.worldMatrix = cached.worldMatrix;
+                        object.lastWorldMatrix = cached.lastWorldMatrix;
+                    }
+                }
+            });
+
+    // The BVH was refit by the world's update(), so it matches the
+    // matrices above.
+    markInView(snapshot, snapshot.cameraMatrix, RenderSnapshot::kInCameraView);
+    if (snapshot.hasLight) {
+        markInView(snapshot, snapshot.lightMatrix, RenderSnapshot::kInLightView);
+    }
+}
+
+void Simulation::markInView(RenderSnapshot &snapshot, const matrix4 &viewProj, uint8_t view) {
+    const EntityStore &entities = mWorld->entities;
+    mInViewHandles.clear();
+    mInViewHandles.reserve(entities.size());
+    mWorld->bvh.queryFrustum(viewProj, mInViewHandles);
+    // Objects are in entity order.
+    for (entity_handle_t handle : mInViewHandles) {
+        snapshot.objects[entities.indexOf(handle)].inView |= view;
+    }
+}
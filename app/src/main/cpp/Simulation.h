@@ -0,0 +1,103 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_SIMULATION_H
+#define GPU_EMULATION_STRESS_TEST_SIMULATION_H
+
+#include "RenderSnapshot.h"
+#include "WorldState.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Advances a WorldState and turns each new frame into a RenderSnapshot.
+// Snapshots go through a triple buffer: the simulation writes one, the
+// renderer reads another and the third holds the newest finished one.
+// After start() this runs on a thread of its own, so simulating frame
+// N + 1 overlaps submitting frame N. It stays at most one frame ahead
+// of the renderer, so every simulated frame is drawn.
+class Simulation {
+public:
+    explicit Simulation(WorldState *world);
+
+    ~Simulation();
+
+    // The world must not be touched by other threads between start()
+    // and stop(), e.g. stop around WorldState::resetAspectRatio and
+    // renderer reInit.
+    void start();
+
+    void stop();
+
+    bool running() const { return mThread.joinable(); }
+
+    // Without a thread, advances the world on the calling thread.
+    // Returns whether a new snapshot was published.
+    bool step();
+
+    // Returns the newest snapshot not handed out before, or null if
+    // there is none. It stays valid until the next call.
+    const RenderSnapshot *acquireLatest();
+
+    // The world ran to its end and every snapshot has been handed out.
+    bool done();
+
+private:
+    void threadLoop();
+
+    bool advance();
+
+    void buildSnapshot(RenderSnapshot &snapshot);
+
+    // Flags the snapshot's objects the world's BVH finds in the
+    // frustum of |viewProj|.
+    void markInView(RenderSnapshot &snapshot, const matrix4 &viewProj, uint8_t view);
+
+    WorldState *mWorld;
+
+    RenderSnapshot mBuffers[3];
+    int mBack = 0;
+    int mMiddle = 1;
+    int mFront = 2;
+    bool mFresh = false;
+    std::mutex mLock;
+    std::condition_variable mConsumed;
+
+    std::thread mThread;
+    bool mQuit = false;
+    std::atomic<bool> mDone;
+
+    // Per entity slot: the draw state last built for |handle| and the
+    // matrix of the frame before, for motion blur. Only rebuilt for
+    // entities flagged dirty.
+    struct CachedObject {
+        entity_handle_t handle;
+        uint32_t indexCount;
+        matrix4 worldMatrix;
+        matrix4 lastWorldMatrix;
+    };
+    std::vector<CachedObject> mCachedObjects;
+    std::vector<entity_handle_t> mInViewHandles;
+    matrix4 mLastCameraMatrix;
+    matrix4 mLastCameraSkyboxMatrix;
+    float mLastFrameTime = 0.0f;
+    bool mHasLastCamera = false;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_SIMULATION_H
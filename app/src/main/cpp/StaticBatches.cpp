@@ -0,0 +1,102 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "StaticBatches.h"
+
+#include "log.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+// Vertices per batch, so that any of them can be named by a uint16_t.
+static const size_t kMaxBatchVertices = 65536;
+
+void StaticBatches::select(EntityStore &entities, const std::vector<RenderModel> &models,
+                           const std::vector<entity_handle_t> &animated) {
+    std::unordered_set<entity_handle_t> moving(animated.begin(), animated.end());
+
+    size_t count = 0;
+    for (size_t i = 0; i < entities.size(); i++) {
+        // Anything with a lifetime is spawned later, by particle systems.
+        if (!(entities.flags[i] & EntityStore::kRenderable) ||
+            entities.lifetimes[i].framesToLive >= 0 ||
+            moving.count(entities.handles[i]) ||
+            models[entities.renderModel[i]].geometry->vertexData.size() > kMaxBatchVertices) {
+            continue;
+        }
+        entities.flags[i] |= EntityStore::kBatched;
+        count++;
+    }
+    LOGD("%s: %zu of %zu entities are static", __func__, count, entities.size());
+}
+
+void StaticBatches::build(const EntityStore &entities, const std::vector<RenderModel> &models) {
+    batches.clear();
+
+    // Batch still taking geometry, by texture content.
+    std::unordered_map<uint64_t, size_t> openBatches;
+
+    size_t entityCount = 0;
+    for (size_t i = 0; i < entities.size(); i++) {
+        if (!(entities.flags[i] & EntityStore::kBatched)) continue;
+
+        render_state_handle_t modelHandle = entities.renderModel[i];
+        const RenderModel &model = models[modelHandle];
+        const OBJParse &geometry = *model.geometry;
+
+        auto open = openBatches.find(model.diffuseHash);
+        if (open == openBatches.end() ||
+            batches[open->second].vertexData.size() + geometry.vertexData.size() >
+            kMaxBatchVertices) {
+            batches.push_back(Batch{modelHandle, 0, Aabb::empty(), {}, {}});
+            openBatches[model.diffuseHash] = batches.size() - 1;
+        }
+        Batch &batch = batches[openBatches[model.diffuseHash]];
+
+        matrix4 world;
+        entities.buildWorldMatrices(i, 1, &world, sizeof(world));
+        batch.bounds.grow(Aabb::transformed(model.boundsMin, model.boundsMax, world));
+
+        uint16_t base = (uint16_t) batch.vertexData.size();
+        for (const auto &vertex : geometry.vertexData) {
+            vector4 pos = world * makevector4(vertex.pos[0], vertex.pos[1], vertex.pos[2], 1.0f);
+            // The shaders transform normals as points; so does this, to
+            // light batched entities like the others.
+            vector4 norm = world * makevector4(vertex.norm[0], vertex.norm[1], vertex.norm[2],
+                                               1.0f);
+            batch.vertexData.push_back({
+                                               {pos.x, pos.y, pos.z},
+                                               {norm.x, norm.y, norm.z},
+                                               {vertex.texcoord[0], vertex.texcoord[1]}});
+        }
+        for (unsigned short index : geometry.indexData) {
+            batch.indexData.push_back(base + index);
+        }
+        batch.indexCount = (uint32_t) batch.indexData.size();
+        entityCount++;
+    }
+
+    mHasCpuData = true;
+    LOGD("%s: %zu entities in %zu batches", __func__, entityCount, batches.size());
+}
+
+void StaticBatches::releaseCpuData() {
+    for (auto &batch : batches) {
+        std::vector<OBJParse::VertexAttributes>().swap(batch.vertexData);
+        std::vector<uint16_t>().swap(batch.indexData);
+    }
+    mHasCpuData = false;
+}
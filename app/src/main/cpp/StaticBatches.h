@@ -0,0 +1,65 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_STATICBATCHES_H
+#define GPU_EMULATION_STRESS_TEST_STATICBATCHES_H
+
+#include "Bounds.h"
+#include "EntityStore.h"
+#include "OBJParse.h"
+#include "RenderModel.h"
+
+#include <cstdint>
+#include <vector>
+
+// Geometry of entities that never move, transformed to world space and
+// merged by texture, so that they take a few draw calls instead of one
+// each. Batches are split to keep their indices 16 bit.
+class StaticBatches {
+public:
+    struct Batch {
+        // Model whose texture the batch is drawn with.
+        render_state_handle_t textureModel;
+        uint32_t indexCount;
+        // World space, kept when the geometry is released.
+        Aabb bounds;
+
+        std::vector<OBJParse::VertexAttributes> vertexData;
+        std::vector<uint16_t> indexData;
+    };
+
+    // Flags the renderable entities that aren't in |animated| as
+    // EntityStore::kBatched, to be drawn from the batches only. Call
+    // once the scene is loaded, with the models' CPU data.
+    void select(EntityStore &entities, const std::vector<RenderModel> &models,
+                const std::vector<entity_handle_t> &animated);
+
+    // Merges the flagged entities. Needs the models' CPU data.
+    void build(const EntityStore &entities, const std::vector<RenderModel> &models);
+
+    // Drops the merged geometry, e.g. once it is on the GPU. Batches
+    // and their index counts stay valid.
+    void releaseCpuData();
+
+    bool hasCpuData() const { return mHasCpuData; }
+
+    std::vector<Batch> batches;
+
+private:
+    bool mHasCpuData = false;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_STATICBATCHES_H
@@ -0,0 +1,197 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "TextScanner.h"
+
+#include <string.h>
+
+// Powers of ten that are exactly representable as doubles.
+static const double kExactPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+        1e21, 1e22,
+};
+
+static const int kMaxExactPow10 = 22;
+
+// A uint64_t holds any 19 decimal digits.
+static const int kMaxMantissaDigits = 19;
+
+static bool sIsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool sIsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+TextScanner::TextScanner(const char *begin, const char *end) :
+        mLineStart(begin), mCurr(begin), mEnd(end) {}
+
+void TextScanner::nextLine() {
+    const char *nl = (const char *) memchr(mCurr, '\n', mEnd - mCurr);
+    mCurr = nl ? nl + 1 : mEnd;
+    mLineStart = mCurr;
+}
+
+void TextScanner::seek(const char *pos) {
+    mCurr = pos;
+    mLineStart = pos;
+}
+
+void TextScanner::skipSpaces() {
+    while (mCurr < mEnd && sIsSpace(*mCurr)) mCurr++;
+}
+
+bool TextScanner::token(const char *&tokBegin, size_t &tokLen) {
+    skipSpaces();
+    tokBegin = mCurr;
+    while (mCurr < mEnd && *mCurr != '\n' && !sIsSpace(*mCurr) && *mCurr) mCurr++;
+    tokLen = mCurr - tokBegin;
+    return tokLen != 0;
+}
+
+bool TextScanner::tokenString(std::string &out) {
+    const char *tok;
+    size_t len;
+    if (!token(tok, len)) return false;
+    out.assign(tok, len);
+    return true;
+}
+
+bool TextScanner::parseUint(uint32_t &out) {
+    skipSpaces();
+    const char *p = mCurr;
+    uint32_t res = 0;
+    while (p < mEnd && sIsDigit(*p)) {
+        res = res * 10 + (uint32_t) (*p - '0');
+        p++;
+    }
+    if (p == mCurr) return false;
+    mCurr = p;
+    out = res;
+    return true;
+}
+
+bool TextScanner::parseInt(int &out) {
+    skipSpaces();
+    const char *start = mCurr;
+    bool negative = false;
+    if (mCurr < mEnd && (*mCurr == '-' || *mCurr == '+')) {
+        negative = *mCurr == '-';
+        mCurr++;
+    }
+    uint32_t magnitude;
+    if (!parseUint(magnitude)) {
+        mCurr = start;
+        return false;
+    }
+    out = negative ? -(int) magnitude : (int) magnitude;
+    return true;
+}
+
+// Decimal to float without strtof: gather up to 19 significant digits
+// into an integer, then apply the decimal exponent with exact powers
+// of ten in double precision. This is exact for everything the Blender
+// exporter writes (%f with six decimals) and within an ulp otherwise.
+bool TextScanner::parseFloat(float &out) {
+    skipSpaces();
+    const char *p = mCurr;
+
+    bool negative = false;
+    if (p < mEnd && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool sawDigit = false;
+
+    while (p < mEnd && sIsDigit(*p)) {
+        sawDigit = true;
+        if (digits < kMaxMantissaDigits) {
+            mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exp10++;
+        }
+        p++;
+    }
+
+    if (p < mEnd && *p == '.') {
+        p++;
+        while (p < mEnd && sIsDigit(*p)) {
+            sawDigit = true;
+            if (digits < kMaxMantissaDigits) {
+                mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+                if (mantissa) digits++;
+                exp10--;
+            }
+            p++;
+        }
+    }
+
+    if (!sawDigit) return false;
+
+    if (p < mEnd && (*p == 'e' || *p == 'E')) {
+        const char *expStart = p;
+        p++;
+        bool expNegative = false;
+        if (p < mEnd && (*p == '-' || *p == '+')) {
+            expNegative = *p == '-';
+            p++;
+        }
+        if (p < mEnd && sIsDigit(*p)) {
+            int e = 0;
+            while (p < mEnd && sIsDigit(*p)) {
+                if (e < 10000) e = e * 10 + (*p - '0');
+                p++;
+            }
+            exp10 += expNegative ? -e : e;
+        } else {
+            // Not an exponent after all; leave the 'e' unconsumed.
+            p = expStart;
+        }
+    }
+
+    double value = (double) mantissa;
+    if (mantissa) {
+        while (exp10 > kMaxExactPow10) {
+            value *= kExactPow10[kMaxExactPow10];
+            exp10 -= kMaxExactPow10;
+        }
+        while (exp10 < -kMaxExactPow10) {
+            value /= kExactPow10[kMaxExactPow10];
+            exp10 += kMaxExactPow10;
+        }
+        if (exp10 > 0) {
+            value *= kExactPow10[exp10];
+        } else if (exp10 < 0) {
+            value /= kExactPow10[-exp10];
+        }
+    }
+
+    mCurr = p;
+    out = (float) (negative ? -value : value);
+    return true;
+}
+
+// static
+bool TextScanner::tokenIs(const char *tok, size_t len, const char *keyword) {
+    return strlen(keyword) == len && !memcmp(tok, keyword, len);
+}
@@ -0,0 +1,63 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef GPU_EMULATION_STRESS_TEST_TEXTSCANNER_H
+#define GPU_EMULATION_STRESS_TEST_TEXTSCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Reads whitespace separated tokens out of a text buffer in place,
+// one line at a time. Tokens never span lines; call nextLine() to
+// move on. Numbers are parsed without going through the C locale.
+class TextScanner {
+public:
+    TextScanner(const char *begin, const char *end);
+
+    bool atEnd() const { return mCurr >= mEnd; }
+
+    // Start of the current line, for lookahead.
+    const char *lineStart() const { return mLineStart; }
+
+    // Skips the rest of the current line.
+    void nextLine();
+
+    // Moves to the start of |pos|, which must be a line start.
+    void seek(const char *pos);
+
+    // Returns false if the current line has no more tokens.
+    bool token(const char *&tokBegin, size_t &tokLen);
+
+    bool tokenString(std::string &out);
+
+    bool parseUint(uint32_t &out);
+
+    bool parseInt(int &out);
+
+    bool parseFloat(float &out);
+
+    static bool tokenIs(const char *tok, size_t len, const char *keyword);
+
+private:
+    void skipSpaces();
+
+    const char *mLineStart;
+    const char *mCurr;
+    const char *mEnd;
+};
+
+#endif //GPU_EMULATION_STRESS_TEST_TEXTSCANNER_H
@@ -34,8 +34,12 @@ TextureLoader *TextureLoader::get() {
 std::vector<unsigned char> TextureLoader::loadPNGAsRGBA8(const std::string &filename,
                                                          unsigned int &w,
                                                          unsigned int &h) {
-    std::vector<unsigned char> pngData =
-            FileLoader::get()->loadFileFromAssets(filename);
+    return decodePNGAsRGBA8(FileLoader::get()->loadFileFromAssets(filename), w, h);
+}
+
+std::vector<unsigned char> TextureLoader::decodePNGAsRGBA8(const std::vector<unsigned char> &pngData,
+                                                           unsigned int &w,
+                                                           unsigned int &h) {
     std::vector<unsigned char> res;
     lodepng::decode(res, w, h, pngData);
     return res;
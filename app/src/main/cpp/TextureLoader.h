@@ -28,4 +28,8 @@ public:
     std::vector<unsigned char> loadPNGAsRGBA8(const std::string &filename,
                                               unsigned int &w,
                                               unsigned int &h);
+
+    std::vector<unsigned char> decodePNGAsRGBA8(const std::vector<unsigned char> &pngData,
+                                                unsigned int &w,
+                                                unsigned int &h);
 };
\ No newline at end of file
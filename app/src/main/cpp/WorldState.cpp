@@ -17,98 +17,178 @@
 #include "WorldState.h"
 
 #include "FileLoader.h"
+#include "JobSystem.h"
 #include "ScopedProfiler.h"
+#include "TextScanner.h"
 #include "TextureLoader.h"
 #include "util.h"
 
 #include <algorithm>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+
+enum class EsysKeyword {
+    Unknown,
+    // First keyword
+    Define,
+    Set,
+    // define ...
+    Camera,
+    Light,
+    Model,
+    Entity,
+    Curve,
+    Particles,
+    // set ...
+    EntityAnim,
+    CurveAction,
+    ParticlesModel,
+    Lod,
+    // set <handle> ...
+    Proj,
+    OrthoProj,
+    Scale,
+    Frame,
+    Prop,
+    // set <handle> prop ...
+    Int,
+    Float,
+    Str,
+};
+
+struct EsysKeywordEntry {
+    const char *name;
+    EsysKeyword keyword;
+};
+
+const EsysKeywordEntry kEsysKeywords[] = {
+        {"define",         EsysKeyword::Define},
+        {"set",            EsysKeyword::Set},
+        {"camera",         EsysKeyword::Camera},
+        {"light",          EsysKeyword::Light},
+        {"model",          EsysKeyword::Model},
+        {"entity",         EsysKeyword::Entity},
+        {"curve",          EsysKeyword::Curve},
+        {"particles",      EsysKeyword::Particles},
+        {"entityanim",     EsysKeyword::EntityAnim},
+        {"curveaction",    EsysKeyword::CurveAction},
+        {"particlesmodel", EsysKeyword::ParticlesModel},
+        {"lod",            EsysKeyword::Lod},
+        {"proj",           EsysKeyword::Proj},
+        {"orthoproj",      EsysKeyword::OrthoProj},
+        {"scale",          EsysKeyword::Scale},
+        {"frame",          EsysKeyword::Frame},
+        {"prop",           EsysKeyword::Prop},
+        {"int",            EsysKeyword::Int},
+        {"float",          EsysKeyword::Float},
+        {"str",            EsysKeyword::Str},
+};
+
+} // namespace
+
+static EsysKeyword sNextKeyword(TextScanner &scanner) {
+    const char *tok;
+    size_t len;
+    if (!scanner.token(tok, len)) return EsysKeyword::Unknown;
+    for (const auto &entry : kEsysKeywords) {
+        if (TextScanner::tokenIs(tok, len, entry.name)) return entry.keyword;
+    }
+    return EsysKeyword::Unknown;
+}
 
-#define MAX_NAME_LEN 128
+// Rate the esys animation frames were authored at.
+static const float kAnimFramesPerSecond = 60.0f;
+
+// Scratch file for streamed animation keys; removed once mapped.
+static const char kAnimStreamFilename[] = "anim_tracks.bin";
+
+// Animation frames make up almost all of an esys file and are written
+// as one contiguous run of lines with this prefix.
+static const char kAnimLinePrefix[] = "set entityanim ";
+static const size_t kAnimLinePrefixLen = sizeof(kAnimLinePrefix) - 1;
+
+// Don't bother spinning up a thread for less than this much text.
+static const size_t kMinAnimChunkBytes = 256 * 1024;
+// Text parsed per batch, which bounds the raw samples held at once
+// before the animation tracks compress them.
+static const size_t kMaxAnimBatchBytes = 4 * 1024 * 1024;
+
+// Fraction of the triangles of a model kept by each generated level of
+// detail, finest first.
+static const float kGeneratedLodRatios[] = {0.5f, 0.25f, 0.1f};
+
+// Models with fewer triangles get no generated levels of detail.
+static const size_t kMinLodTriangles = 128;
+
+// A generated level must drop at least this fraction of the triangles of
+// the one before it. Seams and borders don't simplify, so mostly seam
+// models stop early.
+static const float kMinLodReduction = 0.2f;
+
+// Each particle system gets its own sequence, seeded by FNV-1a of its
+// name, so that adding one doesn't change the others.
+static uint64_t sParticleSeed(const std::string &name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-static char name1[MAX_NAME_LEN] = {};
-static char name2[MAX_NAME_LEN] = {};
-static char name3[MAX_NAME_LEN] = {};
-static char name4[MAX_NAME_LEN] = {};
-static char name5[MAX_NAME_LEN] = {};
+static bool sIsAnimLine(const char *pos, const char *end) {
+    return (size_t) (end - pos) >= kAnimLinePrefixLen &&
+           !memcmp(pos, kAnimLinePrefix, kAnimLinePrefixLen);
+}
 
-static void resetNames() {
-    memset(name1, 0, sizeof(name1));
-    memset(name2, 0, sizeof(name2));
-    memset(name3, 0, sizeof(name3));
-    memset(name4, 0, sizeof(name4));
-    memset(name5, 0, sizeof(name5));
+static bool sParseFloats(TextScanner &scanner, float *out, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!scanner.parseFloat(out[i])) return false;
+    }
+    return true;
+}
+
+static const char *sNextLineStart(const char *pos, const char *end) {
+    const char *nl = (const char *) memchr(pos, '\n', end - pos);
+    return nl ? nl + 1 : end;
 }
 
 void WorldState::loadFromFile(const std::string &filename, int numObjects) {
     std::vector<unsigned char> bytes =
             FileLoader::get()->loadFileFromAssets(filename);
 
-    std::vector<std::string> lines =
-            splitLines(std::string(bytes.begin(), bytes.end()));
-
-    uint32_t framenum, handle;
-    int i1, i2, i3, i4;
-    float f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12;
+    const char *begin = (const char *) bytes.data();
+    const char *end = begin + bytes.size();
+    // FileLoader null terminates what it returns.
+    while (end > begin && !end[-1]) end--;
 
     uint32_t gpuTextCount = 0;
 
-    for (const auto &line : lines) {
-        if (sscanf(&line[0], "define camera %s %u", name1, &handle) == 2) {
-            defineCameraOrLight(name1, handle);
-        } else if (sscanf(&line[0], "define light %s %u", name1, &handle) == 2) {
-            defineCameraOrLight(name1, handle, true);
-        } else if (sscanf(&line[0], "define model %s", name1) == 1) {
-            defineModel(name1);
-        } else if (sscanf(&line[0], "define entity %s %u", name1, &handle) == 2) {
-            if (!strcmp("gpu_text", name1)) {
-                gpuTextCount++;
+    TextScanner scanner(begin, end);
+    while (!scanner.atEnd()) {
+        if (sIsAnimLine(scanner.lineStart(), end)) {
+            const char *animEnd = scanner.lineStart();
+            while (sIsAnimLine(animEnd, end)) {
+                animEnd = sNextLineStart(animEnd, end);
             }
-            defineEntity(name1, handle);
-        } else if (sscanf(&line[0], "set %u proj %f %f %f %f",
-                          &handle, &f1, &f2, &f3, &f4) == 5) {
-            setProjectionMatrix(handle, f1, f2, f3, f4, 1.0f, false);
-        } else if (sscanf(&line[0], "set %u orthoproj %f %f %f %f",
-                          &handle, &f1, &f2, &f3, &f4) == 5) {
-            setProjectionMatrix(handle, 0.0f, f1, f2, f3, f4, true);
-        } else if (sscanf(&line[0], "set %u scale %f %f %f",
-                          &handle, &f1, &f2, &f3) == 4) {
-            setScale(handle, f1, f2, f3);
-        } else if (sscanf(&line[0], "set %u frame %f %f %f %f %f %f %f %f %f",
-                          &handle, &f1, &f2, &f3, &f4, &f5, &f6, &f7, &f8, &f9) == 10) {
-            setWorldFrame(handle, f1, f2, f3, f4, f5, f6, f7, f8, f9);
-        } else if (sscanf(&line[0], "set entityanim %u %u %f %f %f %f %f %f %f %f %f %f %f %f",
-                          &framenum, &handle, &f1, &f2, &f3, &f4, &f5, &f6, &f7, &f8, &f9, &f10,
-                          &f11, &f12) == 14) {
-            setAnimFrame(framenum, handle, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12);
-        } else if (sscanf(&line[0], "set %u prop int %s %d",
-                          &handle, name1, &i1) == 3) {
-            setIntProp(handle, name1, i1);
-        } else if (sscanf(&line[0], "set %u prop float %s %f",
-                          &handle, name1, &f1) == 3) {
-            setFloatProp(handle, name1, f1);
-        } else if (sscanf(&line[0], "set %u prop str %s %s",
-                          &handle, name1, name2) == 3) {
-            setStringProp(handle, name1, name2);
-        } else if (sscanf(&line[0], "define curve %s", name1) == 1) {
-            defineCurve(name1);
-        } else if (sscanf(&line[0], "set curve %s %d %s %s %f %f %f %f %f %f %f %f %f",
-                          name1, &i1, name2, name3, &f1, &f2, &f3, &f4, &f5, &f6, &f7, &f8, &f9) ==
-                   13) {
-            setCurve(name1, i1, name2, name3, f1, f2, f3, f4, f5, f6, f7, f8, f9);
-        } else if (sscanf(&line[0], "set curveaction %s %s %s %s %s %f %f %f %f %f %f",
-                          name1, name2, name3, name4, name5, &f1, &f2, &f3, &f4, &f5, &f6) == 11) {
-            setCurveAction(name1, name2, name3, name4, name5, f1, f2, f3, f4, f5, f6);
-        } else if (sscanf(&line[0], "define particles %s", name1) == 1) {
-            defineParticles(name1);
-        } else if (sscanf(&line[0], "set particles %s %d %d %d %d %f %f %s",
-                          name1, &i1, &i2, &i3, &i4, &f1, &f2, name2) == 8) {
-            // Override # particles
-            setParticles(name1, numObjects, i2, i3, i4, f1, f2, name2);
-        } else if (sscanf(&line[0], "set particlesmodel %s %s",
-                          name1, name2) == 2) {
-            setParticlesModel(name1, name2);
+            loadAnimFrames(scanner.lineStart(), animEnd);
+            scanner.seek(animEnd);
+            continue;
         }
-        resetNames();
+
+        parseLine(scanner, numObjects, gpuTextCount);
+        scanner.nextLine();
+    }
+
+    animTracks.build();
+    totalFrames = animTracks.frameCount();
+    staticBatches.select(entities, renderModels, animTracks.animatedEntities());
+    generateLods();
+    bvh.build(entities, renderModels);
+    if (!animStreamDirectory.empty()) {
+        animTracks.streamFromFile(animStreamDirectory + FILE_PATH_SEP + kAnimStreamFilename);
     }
 
     if (gpuTextCount != 1) {
@@ -119,7 +199,19 @@ void WorldState::loadFromFile(const std::string &filename, int numObjects) {
     // initialize stuff
     // Curves
     for (auto it : curves) {
-        it.second->precalcArclengths(16);
+        it.second->precalcArclengths();
+    }
+
+    // GPU particles are drawn in the shadow mapped pass, which needs a
+    // light; without one, particles stay with the world.
+    if (gpuParticles && lights.empty()) {
+        LOGD("No light; particles are updated on the CPU");
+        gpuParticles = false;
+    }
+    if (gpuParticles) {
+        for (auto it : particleSystems) {
+            it.second->spawnForGpu();
+        }
     }
 
     // Skybox
@@ -127,6 +219,155 @@ void WorldState::loadFromFile(const std::string &filename, int numObjects) {
     loadSkybox();
 }
 
+void WorldState::parseLine(TextScanner &scanner, int numObjects, uint32_t &gpuTextCount) {
+    std::string name1, name2, name3, name4, name5;
+    uint32_t framenum, handle;
+    int i1, i2, i3, i4;
+    float f[12];
+
+    switch (sNextKeyword(scanner)) {
+        case EsysKeyword::Define:
+            switch (sNextKeyword(scanner)) {
+                case EsysKeyword::Camera:
+                    if (scanner.tokenString(name1) && scanner.parseUint(handle)) {
+                        defineCameraOrLight(name1, handle);
+                    }
+                    break;
+                case EsysKeyword::Light:
+                    if (scanner.tokenString(name1) && scanner.parseUint(handle)) {
+                        defineCameraOrLight(name1, handle, true);
+                    }
+                    break;
+                case EsysKeyword::Model:
+                    if (scanner.tokenString(name1)) {
+                        defineModel(name1);
+                    }
+                    break;
+                case EsysKeyword::Entity:
+                    if (scanner.tokenString(name1) && scanner.parseUint(handle)) {
+                        if (name1 == "gpu_text") {
+                            gpuTextCount++;
+                        }
+                        defineEntity(name1, handle);
+                    }
+                    break;
+                case EsysKeyword::Curve:
+                    if (scanner.tokenString(name1)) {
+                        defineCurve(name1);
+                    }
+                    break;
+                case EsysKeyword::Particles:
+                    if (scanner.tokenString(name1)) {
+                        defineParticles(name1);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case EsysKeyword::Set: {
+            if (scanner.parseUint(handle)) {
+                switch (sNextKeyword(scanner)) {
+                    case EsysKeyword::Proj:
+                        if (sParseFloats(scanner, f, 4)) {
+                            setProjectionMatrix(handle, f[0], f[1], f[2], f[3], 1.0f, false);
+                        }
+                        break;
+                    case EsysKeyword::OrthoProj:
+                        if (sParseFloats(scanner, f, 4)) {
+                            setProjectionMatrix(handle, 0.0f, f[0], f[1], f[2], f[3], true);
+                        }
+                        break;
+                    case EsysKeyword::Scale:
+                        if (sParseFloats(scanner, f, 3)) {
+                            setScale(handle, f[0], f[1], f[2]);
+                        }
+                        break;
+                    case EsysKeyword::Frame:
+                        if (sParseFloats(scanner, f, 9)) {
+                            setWorldFrame(handle, f[0], f[1], f[2], f[3], f[4], f[5],
+                                          f[6], f[7], f[8]);
+                        }
+                        break;
+                    case EsysKeyword::Prop:
+                        switch (sNextKeyword(scanner)) {
+                            case EsysKeyword::Int:
+                                if (scanner.tokenString(name1) && scanner.parseInt(i1)) {
+                                    setIntProp(handle, name1, i1);
+                                }
+                                break;
+                            case EsysKeyword::Float:
+                                if (scanner.tokenString(name1) && scanner.parseFloat(f[0])) {
+                                    setFloatProp(handle, name1, f[0]);
+                                }
+                                break;
+                            case EsysKeyword::Str:
+                                if (scanner.tokenString(name1) && scanner.tokenString(name2)) {
+                                    setStringProp(handle, name1, name2);
+                                }
+                                break;
+                            default:
+                                break;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
+
+            switch (sNextKeyword(scanner)) {
+                case EsysKeyword::EntityAnim:
+                    if (scanner.parseUint(framenum) && scanner.parseUint(handle) &&
+                        sParseFloats(scanner, f, 12)) {
+                        setAnimFrame(framenum, handle, f[0], f[1], f[2], f[3], f[4], f[5],
+                                     f[6], f[7], f[8], f[9], f[10], f[11]);
+                    }
+                    break;
+                case EsysKeyword::Curve:
+                    if (scanner.tokenString(name1) && scanner.parseInt(i1) &&
+                        scanner.tokenString(name2) && scanner.tokenString(name3) &&
+                        sParseFloats(scanner, f, 9)) {
+                        setCurve(name1, i1, name2, name3, f[0], f[1], f[2], f[3], f[4], f[5],
+                                 f[6], f[7], f[8]);
+                    }
+                    break;
+                case EsysKeyword::CurveAction:
+                    if (scanner.tokenString(name1) && scanner.tokenString(name2) &&
+                        scanner.tokenString(name3) && scanner.tokenString(name4) &&
+                        scanner.tokenString(name5) && sParseFloats(scanner, f, 6)) {
+                        setCurveAction(name1, name2, name3, name4, name5,
+                                       f[0], f[1], f[2], f[3], f[4], f[5]);
+                    }
+                    break;
+                case EsysKeyword::Particles:
+                    if (scanner.tokenString(name1) && scanner.parseInt(i1) &&
+                        scanner.parseInt(i2) && scanner.parseInt(i3) && scanner.parseInt(i4) &&
+                        sParseFloats(scanner, f, 2) && scanner.tokenString(name2)) {
+                        // Override # particles
+                        setParticles(name1, numObjects, i2, i3, i4, f[0], f[1], name2);
+                    }
+                    break;
+                case EsysKeyword::ParticlesModel:
+                    if (scanner.tokenString(name1) && scanner.tokenString(name2)) {
+                        setParticlesModel(name1, name2);
+                    }
+                    break;
+                case EsysKeyword::Lod:
+                    if (scanner.tokenString(name1) && scanner.tokenString(name2)) {
+                        setModelLod(name1, name2);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
 void WorldState::resetAspectRatio(int width, int height) {
     float aspect = (float) width / (float) height;
     for (auto &it : cameraInfos) {
@@ -146,7 +387,7 @@ WorldState::defineCameraOrLight(const std::string &name, entity_handle_t handle,
     } else {
         currentLight = handle;
     }
-    entities[handle].renderable = false;
+    entities.setRenderable(handle, false);
 }
 
 void WorldState::defineModel(const std::string &name) {
@@ -181,18 +422,17 @@ void WorldState::setWorldFrame(entity_handle_t handle,
          p0, p1, p2,
          up0, up1, up2,
          fwd0, fwd1, fwd2);
-    Entity &ent = entities[handle];
-    ent.pos = makevector4(p0, p1, p2, 1.0f);
-    ent.fwd = makevector4(fwd0, fwd1, fwd2, 0.0f);
-    ent.up = makevector4(up0, up1, up2, 0.0f);
+    entities.setFrame(handle,
+                      makevector4(p0, p1, p2, 1.0f),
+                      qfromframe(makevector4(fwd0, fwd1, fwd2, 0.0f),
+                                 makevector4(up0, up1, up2, 0.0f)));
 }
 
 void WorldState::setScale(entity_handle_t handle,
                           float xscale, float yscale, float zscale) {
     LOGV("scale: %f %f %f",
          xscale, yscale, zscale);
-    Entity &ent = entities[handle];
-    ent.scale = makevector4(xscale, yscale, zscale, 1.0f);
+    entities.setScale(handle, makevector4(xscale, yscale, zscale, 1.0f));
 }
 
 void WorldState::setIntProp(entity_handle_t handle, const std::string &key, int val) {
@@ -258,7 +498,7 @@ void WorldState::setCurveAction(const std::string &name,
 
 void WorldState::defineParticles(const std::string &name) {
     LOGV("%s: %s", __FUNCTION__, name.c_str());
-    particleSystems[name] = new ParticleSystem();
+    particleSystems[name] = new ParticleSystem(sParticleSeed(name));
 
 }
 
@@ -293,8 +533,67 @@ void WorldState::setParticlesModel(const std::string &name,
     p.models.push_back(namedRenderModels[modelName]);
 }
 
+void WorldState::setModelLod(const std::string &modelName, const std::string &lodName) {
+    LOGV("%s: %s %s", __FUNCTION__, modelName.c_str(), lodName.c_str());
+
+    for (const std::string &name : {modelName, lodName}) {
+        if (namedRenderModels.find(name) == namedRenderModels.end()) {
+            defineModel(name);
+        }
+    }
+
+    renderModels[namedRenderModels[modelName]].lods.push_back(namedRenderModels[lodName]);
+}
+
+
+void WorldState::generateLods() {
+    // Only models drawn on their own ever switch levels.
+    std::vector<bool> drawnAlone(renderModels.size(), false);
+    for (size_t i = 0; i < entities.size(); i++) {
+        if ((entities.flags[i] & (EntityStore::kRenderable | EntityStore::kBatched)) ==
+            EntityStore::kRenderable) {
+            drawnAlone[entities.renderModel[i]] = true;
+        }
+    }
+    for (const auto &it : particleSystems) {
+        for (render_state_handle_t model : it.second->models) {
+            drawnAlone[model] = true;
+        }
+    }
+
+    uint64_t start = currTimeUs();
+    size_t modelCount = renderModels.size();
+    for (size_t m = 0; m < modelCount; m++) {
+        if (!drawnAlone[m] || !renderModels[m].lods.empty()) continue;
+
+        std::string basename = renderModels[m].basename();
+        size_t triangles = renderModels[m].indexCount / 3;
+        if (triangles < kMinLodTriangles) continue;
+
+        std::string counts;
+        for (float ratio : kGeneratedLodRatios) {
+            RenderModel lod;
+            lod.loadByBasename(basename, ratio);
+            size_t lodTriangles = lod.indexCount / 3;
+            if (lodTriangles > (1.0f - kMinLodReduction) * triangles) break;
+
+            triangles = lodTriangles;
+            renderModels.push_back(lod);
+            renderModels[m].lods.push_back((render_state_handle_t) (renderModels.size() - 1));
+            counts += " " + std::to_string(triangles);
+        }
+        LOGD("%s: %s has %u triangles, levels of detail:%s", __func__, basename.c_str(),
+             renderModels[m].indexCount / 3, counts.c_str());
+    }
+    LOGD("%s: took %.1f ms", __func__, (currTimeUs() - start) / 1000.0);
+}
 
 void WorldState::addRenderModel(const std::string &name) {
+    if (namedRenderModels.find(name) != namedRenderModels.end()) {
+        LOGV("%s: %s already defined", __func__, name.c_str());
+        return;
+    }
+
     renderModels.push_back(RenderModel());
     renderModels[renderModels.size() - 1].loadByBasename(name);
 
@@ -302,12 +601,12 @@ void WorldState::addRenderModel(const std::string &name) {
 }
 
 void WorldState::addEntity(entity_handle_t handle, const std::string &name) {
-    if (handle >= entities.size())
-        entities.resize(handle + 1);
+    entities.spawnUpTo(handle);
 
     // Note this sets the render model from the name.
-    Entity &ent = entities[handle];
-    ent.renderModel = namedRenderModels[name];
+    size_t index = entities.indexOf(handle);
+    entities.renderModel[index] = namedRenderModels[name];
+    entities.flags[index] |= EntityStore::kDirty;
 }
 
 void WorldState::addCameraInfo(entity_handle_t handle, bool isLight) {
@@ -320,36 +619,96 @@ void WorldState::addCameraInfo(entity_handle_t handle, bool isLight) {
     }
 }
 
+// static
+void WorldState::parseAnimChunk(const char *begin, const char *end,
+                                std::vector<AnimationTracks::Sample> &samples) {
+    uint32_t framenum, handle;
+    float f[12];
+
+    TextScanner scanner(begin, end);
+    while (!scanner.atEnd()) {
+        const char *tok;
+        size_t len;
+        // Callers only hand us lines starting with "set entityanim".
+        if (scanner.token(tok, len) && scanner.token(tok, len) &&
+            scanner.parseUint(framenum) && scanner.parseUint(handle) &&
+            sParseFloats(scanner, f, 12)) {
+            samples.push_back(AnimationTracks::makeSample(
+                    framenum, handle,
+                    makevector4(f[0], f[1], f[2], 1.0f),
+                    makevector4(f[3], f[4], f[5], 0.0f),
+                    makevector4(f[6], f[7], f[8], 0.0f),
+                    makevector4(f[9], f[10], f[11], 0.0f)));
+        }
+        scanner.nextLine();
+    }
+}
+
+// Splits a run of "set entityanim" lines at newlines into batches, and
+// each batch into pieces parsed in parallel. Samples go to the animation
+// tracks in file order, so the result is the same as calling
+// setAnimFrame() line by line.
+void WorldState::loadAnimFrames(const char *begin, const char *end) {
+    while (begin != end) {
+        const char *batchEnd = end;
+        if ((size_t) (end - begin) > kMaxAnimBatchBytes) {
+            batchEnd = sNextLineStart(begin + kMaxAnimBatchBytes - 1, end);
+        }
+        loadAnimBatch(begin, batchEnd);
+        begin = batchEnd;
+    }
+}
+
+void WorldState::loadAnimBatch(const char *begin, const char *end) {
+    size_t bytes = end - begin;
+
+    size_t chunkCount = std::max((size_t) 1, (size_t) std::thread::hardware_concurrency());
+    chunkCount = std::min(chunkCount, std::max((size_t) 1, bytes / kMinAnimChunkBytes));
+
+    std::vector<const char *> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunkCount; i++) {
+        const char *split = std::max(bounds[i - 1], begin + bytes * i / chunkCount);
+        bounds[i] = split == begin ? begin : sNextLineStart(split - 1, end);
+    }
+    bounds[chunkCount] = end;
+
+    std::vector<std::vector<AnimationTracks::Sample> > chunkSamples(chunkCount);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunkCount; i++) {
+        workers.emplace_back(parseAnimChunk, bounds[i], bounds[i + 1],
+                             std::ref(chunkSamples[i]));
+    }
+    parseAnimChunk(bounds[0], bounds[1], chunkSamples[0]);
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (const auto &samples : chunkSamples) {
+        animTracks.addSamples(samples);
+    }
+
+    LOGV("%s: %zu bytes in %zu chunks", __func__, bytes, chunkCount);
+}
+
 void
 WorldState::setAnimFrame(uint32_t framenum, uint32_t handle, float f1, float f2, float f3, float f4,
                          float f5, float f6, float f7, float f8, float f9, float f10, float f11,
                          float f12) {
-    if (framenum >= animFrames.size())
-        animFrames.resize(framenum + 1);
-
-    animFrames[framenum].push_back({
-                                           handle,
-                                           makevector4(f1, f2, f3, 1.0f),
-                                           makevector4(f4, f5, f6, 0.0f),
-                                           makevector4(f7, f8, f9, 0.0f),
-                                           makevector4(f10, f11, f12, 0.0f),
-                                   });
-    totalFrames = animFrames.size();
-}
-
-void WorldState::applyAnimFramesAt(uint32_t frame) {
-    if (frame >= animFrames.size()) {
-        currFrame = 0;
-        return;
-    }
+    animTracks.addSample(AnimationTracks::makeSample(
+            framenum, handle,
+            makevector4(f1, f2, f3, 1.0f),
+            makevector4(f4, f5, f6, 0.0f),
+            makevector4(f7, f8, f9, 0.0f),
+            makevector4(f10, f11, f12, 0.0f)));
+}
 
-    for (const auto &entUpdate : animFrames[frame]) {
-        Entity &ent = entities[entUpdate.eid];
-        ent.pos = entUpdate.pos;
-        ent.fwd = entUpdate.fwd;
-        ent.up = entUpdate.up;
-        ent.scale = entUpdate.scale;
-    }
+void WorldState::applyAnimFramesAt(float frameTime) {
+    animTracks.applyAt(frameTime, entities);
+}
+
+void WorldState::setTargetRefreshRate(float hz) {
+    targetRefreshHz = hz > 0.0f ? hz : 0.0f;
 }
 
 // The huge update function!
@@ -361,66 +720,134 @@ bool WorldState::update() {
         startTime = now;
     }
 
-    currFrame = ((now - startTime) / (uint64_t) 16667) % (uint64_t) animFrames.size();
-
-    if (currFrame && (currFrame == lastFrame)) {
-        return false;
+    // Sample animation on the refresh grid when throttled so that motion
+    // advances evenly per displayed frame; otherwise at the actual time.
+    uint64_t elapsedUs = now - startTime;
+    double frameTime;
+    if (targetRefreshHz > 0.0f) {
+        uint64_t tick = (uint64_t) ((double) elapsedUs * targetRefreshHz / 1000000.0);
+        if (lastUpdateTime && tick == lastRefreshTick) {
+            return false;
+        }
+        lastRefreshTick = tick;
+        frameTime = (double) tick * kAnimFramesPerSecond / targetRefreshHz;
+    } else {
+        frameTime = (double) elapsedUs * kAnimFramesPerSecond / 1000000.0;
     }
 
-    if (currFrame < lastFrame) {
+    if (frameTime >= (double) totalFrames) {
         done = true;
-        uint32_t droppedFrames = totalFrames - framesShown;
-        float dropRatio = (float) droppedFrames / (float) totalFrames;
-        fps = 60.0f * (1.0f - dropRatio);
-        LOGD("curr %d last %d anims %zu Result: Total frames: %u Dropped: %u Drop ratio: %f Avg fps: %f",
-             currFrame, lastFrame, animFrames.size(),
-             totalFrames, droppedFrames, dropRatio, fps);
+        // Average over the nominal length of the animation, in frames
+        // per second of wall time.
+        float seconds = (float) totalFrames / kAnimFramesPerSecond;
+        fps = (float) framesShown / seconds;
+        if (targetRefreshHz > 0.0f) {
+            uint32_t expectedFrames = (uint32_t) (seconds * targetRefreshHz);
+            uint32_t droppedFrames =
+                    expectedFrames > framesShown ? expectedFrames - framesShown : 0;
+            LOGD("Result: target %.1f Hz anims %u Frames: %u Dropped: %u Avg fps: %f",
+                 targetRefreshHz, totalFrames, framesShown, droppedFrames, fps);
+        } else {
+            LOGD("Result: unthrottled anims %u Frames: %u Avg fps: %f",
+                 totalFrames, framesShown, fps);
+        }
+        LOGD("BVH update: %.1f us/frame, %u rebuilds",
+             framesShown ? (double) bvhUpdateUs / framesShown : 0.0, bvh.rebuildCount());
         return false;
     }
 
-    framesShown++;
-    applyAnimFramesAt(currFrame);
+    currFrameTime = (float) frameTime;
+    currFrame = (uint32_t) frameTime;
 
-    dyingIndices.clear();
-    newIndices.resize(entities.size(), 0);
+    framesShown++;
+    applyAnimFramesAt(currFrameTime);
 
     // Update existing entities and their lifetimes.
-    entity_handle_t i = 0;
-    entity_handle_t death_offset = 0;
-    for (auto &e : entities) {
-        e.update(currFrame);
-        if (!e.live) {
-            dyingIndices.push_back(i);
-            newIndices[i] = -1;
-            death_offset++;
-        } else {
-            newIndices[i] = i - death_offset;
+    JobSystem::get()->parallelFor(
+            entities.size(), JobSystem::kEntityChunk,
+            [this](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    entities.updateLifetime(i, currFrame);
+                }
+            });
+
+    dyingEntities.clear();
+    for (size_t i = 0; i < entities.size(); i++) {
+        if (!(entities.flags[i] & EntityStore::kLive)) {
+            dyingEntities.push_back(entities.handles[i]);
         }
-        i++;
     }
 
-    for (auto it : particleSystems) {
-        ParticleSystem *p = it.second;
-        p->setFrame(currFrame);
-        p->updateParticlesToEntities(this);
-        p->updateForDeadEntities(dyingIndices, newIndices);
+    // Particle systems drop their dead entities as they go. GPU
+    // particles have no entities.
+    if (!gpuParticles) {
+        for (auto it : particleSystems) {
+            ParticleSystem *p = it.second;
+            p->setFrame(currFrameTime);
+            p->updateParticlesToEntities(this);
+        }
     }
 
     // Collect all dead entities.
-    entities.erase(
-            std::remove_if(
-                    entities.begin(), entities.end(),
-                    [](const Entity &e) { return !e.live; }),
-            entities.end());
+    uint64_t bvhStart = currTimeUs();
+    for (entity_handle_t handle : dyingEntities) {
+        bvh.remove(handle);
+        entities.destroy(handle);
+    }
+    bvh.update(entities, renderModels);
+    bvhUpdateUs += currTimeUs() - bvhStart;
 
     lastFrame = currFrame;
     lastUpdateTime = now;
     return true;
 }
 
+void WorldState::prepareAssetsForUpload() {
+    for (auto &model : renderModels) {
+        model.ensureCpuData();
+    }
+    if (skyboxData.empty()) {
+        loadSkybox();
+    }
+    if (!staticBatches.hasCpuData()) {
+        staticBatches.build(entities, renderModels);
+    }
+}
+
+void WorldState::onAssetsUploaded() {
+    if (!releaseAssetsAfterUpload) return;
+
+    size_t bytes = 0;
+    std::unordered_set<const void *> counted;
+    for (auto &model : renderModels) {
+        if (!model.hasCpuData()) continue;
+        if (counted.insert(model.geometry.get()).second) {
+            bytes += model.geometry->vertexData.size() * sizeof(OBJParse::VertexAttributes) +
+                     model.geometry->indexData.size() * sizeof(unsigned short);
+        }
+        if (counted.insert(model.diffuse.get()).second) {
+            bytes += model.diffuse->rgba8.size();
+        }
+        model.releaseCpuData();
+    }
+    for (const auto &face : skyboxData) {
+        bytes += face.size();
+    }
+    std::vector<std::vector<unsigned char> >().swap(skyboxData);
+    for (const auto &batch : staticBatches.batches) {
+        bytes += batch.vertexData.size() * sizeof(OBJParse::VertexAttributes) +
+                 batch.indexData.size() * sizeof(uint16_t);
+    }
+    staticBatches.releaseCpuData();
+
+    LOGD("%s: released about %zu KiB of model, batch and skybox data", __func__, bytes / 1024);
+}
+
 void WorldState::loadSkybox() {
     if (skyboxName.empty()) return;
 
+    skyboxData.clear();
+
     /* Texture target order for cube map
        GL_TEXTURE_CUBE_MAP_POSITIVE_X	Right
        GL_TEXTURE_CUBE_MAP_NEGATIVE_X	Left
@@ -16,10 +16,14 @@
 
 #pragma once
 
+#include "AnimationTracks.h"
 #include "BezierCurve.h"
+#include "Bvh.h"
 #include "Entity.h"
+#include "EntityStore.h"
 #include "ParticleSystem.h"
 #include "RenderModel.h"
+#include "StaticBatches.h"
 
 #include <string>
 #include <unordered_map>
@@ -31,6 +35,8 @@ class BezierCurve;
 
 class ParticleSystem;
 
+class TextScanner;
+
 class WorldState {
 public:
     struct CameraInfo {
@@ -47,6 +53,10 @@ public:
 
     void loadFromFile(const std::string &filename, int numObjects);
 
+    // If set before loadFromFile, animation keys are streamed from a
+    // scratch file in |dir| instead of staying resident.
+    void setAnimationStreamDirectory(const std::string &dir) { animStreamDirectory = dir; }
+
     void resetAspectRatio(int width, int height);
 
     void defineCameraOrLight(const std::string &name, entity_handle_t handle, bool isLight = false);
@@ -103,6 +113,13 @@ public:
     void setParticlesModel(const std::string &name,
                            const std::string &modelName);
 
+    // Adds |lodName| as the next coarser level of detail of |modelName|.
+    void setModelLod(const std::string &modelName, const std::string &lodName);
+
+    // Updates at most once per refresh period of |hz|; 0 updates on
+    // every call. Animation plays at the authored rate either way.
+    void setTargetRefreshRate(float hz);
+
     bool update();
 
     std::vector<RenderModel> renderModels;
@@ -113,20 +130,17 @@ public:
     entity_handle_t currentLight = 0;
     std::vector<entity_handle_t> lights = {};
 
-    // Entity management
-    std::vector<Entity> entities;
-    // When entities are collected, users of WorldState
-    // may need to update their indices. This tracks how.
-    std::vector<entity_handle_t> dyingIndices;
-    std::vector<entity_handle_t> newIndices;
+    // Entity management. Handles stay valid until the entity dies.
+    EntityStore entities;
 
-    Entity &entity(entity_handle_t index) { return entities[index]; }
+    entity_handle_t spawnEntity() { return entities.spawn(); }
 
-    entity_handle_t spawnEntity() {
-        entity_handle_t res = entities.size();
-        entities.emplace_back();
-        return res;
-    }
+    // Entities that never move, merged for drawing. Their geometry is
+    // built by prepareAssetsForUpload.
+    StaticBatches staticBatches;
+
+    // World bounds of renderable entities, as of the last update().
+    Bvh bvh;
 
     std::vector<CameraInfo> cameraInfos;
     std::unordered_map<std::string, entity_handle_t> namedEntityMap;
@@ -137,6 +151,8 @@ public:
     std::unordered_map<std::string, ParticleSystem *> particleSystems;
 
     uint64_t lastUpdateTime = 0;
+    // Current time in authored animation frames, and its integer part.
+    float currFrameTime = 0.0f;
     uint32_t currFrame = 0;
 
     // Skybox
@@ -147,16 +163,39 @@ public:
 
     void loadSkybox();
 
+    // Memory-lean mode: CPU copies of model and skybox data are freed
+    // once the renderer has uploaded them, and loaded again from assets
+    // the next time the renderer needs them (e.g. after context loss).
+    bool releaseAssetsAfterUpload = false;
+
+    // If set before loadFromFile, particles are spawned up front and
+    // moved by the renderer, which has to support it (GLES3); the world
+    // itself never updates them. loadFromFile clears it for scenes
+    // without a light, which the renderer draws them with.
+    bool gpuParticles = false;
+
+    // Renderers call these around uploading assets.
+    void prepareAssetsForUpload();
+
+    void onAssetsUploaded();
+
     // Benchmark stuff
     uint32_t totalFrames = 0;
     uint32_t lastFrame = 0;
     uint32_t framesShown = 0;
+    float targetRefreshHz = 60.0f;
     float fps = 0.0f;
     bool done = false;
 
 private:
+    void parseLine(TextScanner &scanner, int numObjects, uint32_t &gpuTextCount);
+
     void addRenderModel(const std::string &name);
 
+    // Simplifies models that are drawn on their own and have no levels
+    // of detail of their own into a chain of them.
+    void generateLods();
+
     void addEntity(entity_handle_t handle, const std::string &name = "");
 
     void addCameraInfo(entity_handle_t handle, bool isLight);
@@ -166,17 +205,23 @@ private:
                  float f5,
                  float f6, float f7, float f8, float f9, float f10, float f11, float f12);
 
+    std::vector<entity_handle_t> dyingEntities;
+
     uint64_t startTime;
+    uint64_t lastRefreshTick = 0;
 
-    void applyAnimFramesAt(uint32_t frame);
+    // Time spent keeping |bvh| up to date.
+    uint64_t bvhUpdateUs = 0;
 
-    struct EntityPose {
-        entity_handle_t eid;
-        vector4 pos;
-        vector4 fwd;
-        vector4 up;
-        vector4 scale;
-    };
+    void applyAnimFramesAt(float frameTime);
+
+    AnimationTracks animTracks;
+    std::string animStreamDirectory;
+
+    static void parseAnimChunk(const char *begin, const char *end,
+                               std::vector<AnimationTracks::Sample> &samples);
+
+    void loadAnimFrames(const char *begin, const char *end);
 
-    std::vector<std::vector<EntityPose> > animFrames;
+    void loadAnimBatch(const char *begin, const char *end);
 };
@@ -20,6 +20,7 @@
 
 #include "math.h"
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 
@@ -90,28 +91,8 @@ matrix4 scaling(float x, float y, float z) {
 }
 
 matrix4 rotation(float ax, float ay, float az, float angle) {
-    float x = ax * sinf(angle / 2);
-    float y = ay * sinf(angle / 2);
-    float z = az * sinf(angle / 2);
-    float w = cosf(angle / 2);
-
-    float _2x2 = 2 * x * x;
-    float _2y2 = 2 * y * y;
-    float _2z2 = 2 * z * z;
-
-    float _2xy = 2 * x * y;
-    float _2yz = 2 * y * z;
-    float _2xz = 2 * x * z;
-
-    float _2wx = 2 * w * x;
-    float _2wy = 2 * w * y;
-    float _2wz = 2 * w * z;
-
-    return makematrix4(
-            1.0f - _2y2 - _2z2, _2xy - _2wz, _2xz + _2wy, 0.0f,
-            _2xy + _2wz, 1.0f - _2x2 - _2z2, _2yz - _2wx, 0.0f,
-            _2xz - _2wy, _2yz + _2wx, 1.0f - _2x2 - _2y2, 0.0f,
-            0.0f, 0.0f, 0.0f, 1.0f);
+    float s = sinf(angle / 2);
+    return qrotation(makequaternion(ax * s, ay * s, az * s, cosf(angle / 2)));
 }
 
 vector4 vzero4() {
@@ -512,3 +493,131 @@ matrix4 makeInverseModelview(
 
     return trI * coordsI;
 }
+
+quaternion makequaternion(float x, float y, float z, float w) {
+    quaternion res;
+    res.x = x;
+    res.y = y;
+    res.z = z;
+    res.w = w;
+    return res;
+}
+
+quaternion qidentity() {
+    return makequaternion(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+float qdot(const quaternion &a, const quaternion &b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+quaternion qnormed(const quaternion &q) {
+    float l = sqrtf(qdot(q, q));
+    if (!l) return qidentity();
+    return makequaternion(q.x / l, q.y / l, q.z / l, q.w / l);
+}
+
+void qslerpweights(float cosAngle, float t, float *wa, float *wb) {
+    if (cosAngle > 0.9995f) {
+        *wa = 1.0f - t;
+        *wb = t;
+        return;
+    }
+    float angle = acosf(std::max(-1.0f, std::min(1.0f, cosAngle)));
+    float invSin = 1.0f / sinf(angle);
+    *wa = sinf((1.0f - t) * angle) * invSin;
+    *wb = sinf(t * angle) * invSin;
+}
+
+quaternion qslerp(const quaternion &a, const quaternion &b, float t) {
+    float cosAngle = qdot(a, b);
+    float sign = 1.0f;
+    if (cosAngle < 0.0f) {
+        cosAngle = -cosAngle;
+        sign = -1.0f;
+    }
+    float wa, wb;
+    qslerpweights(cosAngle, t, &wa, &wb);
+    wb *= sign;
+    return qnormed(makequaternion(
+            wa * a.x + wb * b.x,
+            wa * a.y + wb * b.y,
+            wa * a.z + wb * b.z,
+            wa * a.w + wb * b.w));
+}
+
+// Same orthonormalization as makeFrameChange, then the usual
+// rotation matrix to quaternion conversion.
+quaternion qfromframe(const vector4 &dir, const vector4 &up) {
+    vector4 coordB = v4normed(up);
+    vector4 coordC = -1.0f * v4normed(dir);
+    vector4 coordA = v4normed(v4cross(coordB, coordC));
+    coordB = v4cross(coordC, coordA);
+
+    float m00 = coordA.x, m01 = coordB.x, m02 = coordC.x;
+    float m10 = coordA.y, m11 = coordB.y, m12 = coordC.y;
+    float m20 = coordA.z, m21 = coordB.z, m22 = coordC.z;
+
+    float trace = m00 + m11 + m22;
+    quaternion res;
+    if (trace > 0.0f) {
+        float s = 2.0f * sqrtf(1.0f + trace);
+        res = makequaternion((m21 - m12) / s, (m02 - m20) / s, (m10 - m01) / s, 0.25f * s);
+    } else if (m00 > m11 && m00 > m22) {
+        float s = 2.0f * sqrtf(1.0f + m00 - m11 - m22);
+        res = makequaternion(0.25f * s, (m01 + m10) / s, (m02 + m20) / s, (m21 - m12) / s);
+    } else if (m11 > m22) {
+        float s = 2.0f * sqrtf(1.0f + m11 - m00 - m22);
+        res = makequaternion((m01 + m10) / s, 0.25f * s, (m12 + m21) / s, (m02 - m20) / s);
+    } else {
+        float s = 2.0f * sqrtf(1.0f + m22 - m00 - m11);
+        res = makequaternion((m02 + m20) / s, (m12 + m21) / s, 0.25f * s, (m10 - m01) / s);
+    }
+    return qnormed(res);
+}
+
+// -z axis of the rotated frame.
+vector4 qdir(const quaternion &q) {
+    return makevector4(
+            -2.0f * (q.x * q.z + q.w * q.y),
+            -2.0f * (q.y * q.z - q.w * q.x),
+            -1.0f + 2.0f * (q.x * q.x + q.y * q.y),
+            0.0f);
+}
+
+// +y axis of the rotated frame.
+vector4 qup(const quaternion &q) {
+    return makevector4(
+            2.0f * (q.x * q.y - q.w * q.z),
+            1.0f - 2.0f * (q.x * q.x + q.z * q.z),
+            2.0f * (q.y * q.z + q.w * q.x),
+            0.0f);
+}
+
+quaternion qmul(const quaternion &a, const quaternion &b) {
+    return makequaternion(
+            a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+matrix4 qrotation(const quaternion &q) {
+    float _2x2 = 2 * q.x * q.x;
+    float _2y2 = 2 * q.y * q.y;
+    float _2z2 = 2 * q.z * q.z;
+
+    float _2xy = 2 * q.x * q.y;
+    float _2yz = 2 * q.y * q.z;
+    float _2xz = 2 * q.x * q.z;
+
+    float _2wx = 2 * q.w * q.x;
+    float _2wy = 2 * q.w * q.y;
+    float _2wz = 2 * q.w * q.z;
+
+    return makematrix4(
+            1.0f - _2y2 - _2z2, _2xy - _2wz, _2xz + _2wy, 0.0f,
+            _2xy + _2wz, 1.0f - _2x2 - _2z2, _2yz - _2wx, 0.0f,
+            _2xz - _2wy, _2yz + _2wx, 1.0f - _2x2 - _2y2, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+}
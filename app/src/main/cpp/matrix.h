@@ -157,3 +157,39 @@ matrix4 makeInverseModelview(
         const vector4 &dir,
         const vector4 &up);
 
+// Unit quaternions for orientation. The frame conventions match
+// makeFrameChange: |dir| points down -z and |up| along +y.
+struct quaternion {
+    float x;
+    float y;
+    float z;
+    float w;
+};
+
+quaternion makequaternion(float x, float y, float z, float w);
+
+quaternion qidentity();
+
+float qdot(const quaternion &a, const quaternion &b);
+
+quaternion qnormed(const quaternion &q);
+
+// Weights for a and b in slerp(a, b, t), given cos of the angle
+// between them. Falls back to lerp weights when they are nearly equal.
+void qslerpweights(float cosAngle, float t, float *wa, float *wb);
+
+// Shortest-arc spherical interpolation between unit quaternions.
+quaternion qslerp(const quaternion &a, const quaternion &b, float t);
+
+quaternion qfromframe(const vector4 &dir, const vector4 &up);
+
+vector4 qdir(const quaternion &q);
+
+vector4 qup(const quaternion &q);
+
+// Rotation by |b| followed by rotation by |a|.
+quaternion qmul(const quaternion &a, const quaternion &b);
+
+// Rotation matrix of a unit quaternion: its columns are the frame's
+// +x, qup and -qdir.
+matrix4 qrotation(const quaternion &q);
@@ -20,6 +20,7 @@
 
 #include "FileLoader.h"
 #include "OBJParse.h"
+#include "Simulation.h"
 #include "TextureLoader.h"
 #include "WorldState.h"
 #include "GLES2Renderer.h"
@@ -30,10 +31,15 @@
 
 WorldState *sWorld = nullptr;
 GLES2Renderer *sRenderer = nullptr;
+Simulation *sSimulation = nullptr;
 
 JNIEnv *gEnv = nullptr;
 jobject glview;
 
+static std::string sAnimStreamDirectory;
+static bool sSimulationThread = true;
+static bool sGpuParticles = false;
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_registerGLView(JNIEnv *env, jobject view) {
@@ -41,6 +47,17 @@ Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_registe
     glview = view;
 }
 
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_setAnimationStreamDirectory(
+        JNIEnv *env,
+        jobject /* this */,
+        jstring dir) {
+    const char *chars = env->GetStringUTFChars(dir, nullptr);
+    sAnimStreamDirectory = chars;
+    env->ReleaseStringUTFChars(dir, chars);
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_initAssets(
@@ -55,8 +72,12 @@ Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_initAss
     TextureLoader *tl = TextureLoader::get();
 
     sWorld = new WorldState;
+    sWorld->setAnimationStreamDirectory(sAnimStreamDirectory);
+    sWorld->gpuParticles = sGpuParticles && glesApiLevel != 2;
     sWorld->loadFromFile("gpu_stress_test.esys", numObjects);
 
+    sSimulation = new Simulation(sWorld);
+
     if (glesApiLevel == 2) {
         sRenderer = new GLES2Renderer;
     } else {
@@ -71,9 +92,51 @@ Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_reinitG
         jobject /* this */,
         jint width, jint height) {
 
+    // The simulation thread must not run while the world is reset.
+    sSimulation->stop();
+
     sWorld->resetAspectRatio(width, height);
     sRenderer->reInit(sWorld, width, height);
 
+    if (sSimulationThread) {
+        sSimulation->start();
+    }
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_setRefreshRate(
+        JNIEnv *env,
+        jobject /* this */,
+        jfloat refreshRateHz) {
+    sWorld->setTargetRefreshRate(refreshRateHz);
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_setReleaseAssetsAfterUpload(
+        JNIEnv *env,
+        jobject /* this */,
+        jboolean release) {
+    sWorld->releaseAssetsAfterUpload = release;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_setSimulationThread(
+        JNIEnv *env,
+        jobject /* this */,
+        jboolean enabled) {
+    sSimulationThread = enabled;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_setGpuParticles(
+        JNIEnv *env,
+        jobject /* this */,
+        jboolean enabled) {
+    sGpuParticles = enabled;
 }
 
 static void sFinishWithFps(float fps) {
@@ -94,10 +157,16 @@ Java_com_android_gpu_1emulation_1stress_1test_GPUEmulationStressTestView_drawFra
         jint) {
     gEnv = env;
 
-    if (sWorld->update()) {
-        sRenderer->preDrawUpdate();
+    if (!sSimulation->running()) {
+        sSimulation->step();
+    }
+
+    const RenderSnapshot *snapshot = sSimulation->acquireLatest();
+    if (snapshot) {
+        sRenderer->preDrawUpdate(*snapshot);
         sRenderer->draw();
-    } else if (sWorld->done) {
+    } else if (sSimulation->done()) {
+        sRenderer->logLodHistogram();
         sFinishWithFps(sWorld->fps);
     }
 
@@ -0,0 +1,359 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+
+// Minimal 4-wide float vector for batch kernels over SoA data. Maps to
+// SSE on x86, NEON on ARM and plain floats elsewhere; every path does
+// IEEE division and square root so results match the scalar code.
+// uint4 holds four 32-bit integers for bit mixing, e.g. random numbers.
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD4_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD4_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct float4 {
+#if defined(SIMD4_SSE)
+    __m128 v;
+#elif defined(SIMD4_NEON)
+    float32x4_t v;
+#else
+    float v[4];
+#endif
+};
+
+// Per-lane results of comparisons, for f4select.
+struct mask4 {
+#if defined(SIMD4_SSE)
+    __m128 v;
+#elif defined(SIMD4_NEON)
+    uint32x4_t v;
+#else
+    bool v[4];
+#endif
+};
+
+struct uint4 {
+#if defined(SIMD4_SSE)
+    __m128i v;
+#elif defined(SIMD4_NEON)
+    uint32x4_t v;
+#else
+    uint32_t v[4];
+#endif
+};
+
+#if defined(SIMD4_SSE)
+
+static inline float4 f4load(const float *p) { return {_mm_loadu_ps(p)}; }
+
+static inline void f4store(float *p, float4 a) { _mm_storeu_ps(p, a.v); }
+
+static inline float4 f4splat(float x) { return {_mm_set1_ps(x)}; }
+
+static inline float4 operator+(float4 a, float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+
+static inline float4 operator-(float4 a, float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+
+static inline float4 operator*(float4 a, float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+
+static inline float4 operator/(float4 a, float4 b) { return {_mm_div_ps(a.v, b.v)}; }
+
+static inline float4 f4sqrt(float4 a) { return {_mm_sqrt_ps(a.v)}; }
+
+// Lanes of |a| where |b| is zero, |a| / |b| elsewhere.
+static inline float4 f4divNonzero(float4 a, float4 b) {
+    __m128 zero = _mm_cmpeq_ps(b.v, _mm_setzero_ps());
+    __m128 q = _mm_div_ps(a.v, b.v);
+    return {_mm_or_ps(_mm_and_ps(zero, a.v), _mm_andnot_ps(zero, q))};
+}
+
+static inline void f4transpose(float4 &a, float4 &b, float4 &c, float4 &d) {
+    _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+}
+
+static inline float4 f4min(float4 a, float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+
+static inline float4 f4max(float4 a, float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+
+static inline mask4 f4lessEqual(float4 a, float4 b) { return {_mm_cmple_ps(a.v, b.v)}; }
+
+static inline mask4 f4greaterEqual(float4 a, float4 b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+
+static inline mask4 m4and(mask4 a, mask4 b) { return {_mm_and_ps(a.v, b.v)}; }
+
+static inline bool m4any(mask4 a) { return _mm_movemask_ps(a.v) != 0; }
+
+// Lanes of |a| where |m| is set, of |b| elsewhere.
+static inline float4 f4select(mask4 m, float4 a, float4 b) {
+    return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+}
+
+static inline uint4 u4load(const uint32_t *p) { return {_mm_loadu_si128((const __m128i *) p)}; }
+
+static inline void u4store(uint32_t *p, uint4 a) { _mm_storeu_si128((__m128i *) p, a.v); }
+
+static inline uint4 operator+(uint4 a, uint4 b) { return {_mm_add_epi32(a.v, b.v)}; }
+
+static inline uint4 operator^(uint4 a, uint4 b) { return {_mm_xor_si128(a.v, b.v)}; }
+
+static inline uint4 operator|(uint4 a, uint4 b) { return {_mm_or_si128(a.v, b.v)}; }
+
+template<int kBits>
+static inline uint4 u4shl(uint4 a) { return {_mm_slli_epi32(a.v, kBits)}; }
+
+template<int kBits>
+static inline uint4 u4shr(uint4 a) { return {_mm_srli_epi32(a.v, kBits)}; }
+
+// The top 24 bits of each lane as a float in [0, 1).
+static inline float4 u4unitFloat(uint4 a) {
+    return {_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(a.v, 8)), _mm_set1_ps(1.0f / 16777216.0f))};
+}
+
+#elif defined(SIMD4_NEON)
+
+static inline float4 f4load(const float *p) { return {vld1q_f32(p)}; }
+
+static inline void f4store(float *p, float4 a) { vst1q_f32(p, a.v); }
+
+static inline float4 f4splat(float x) { return {vdupq_n_f32(x)}; }
+
+static inline float4 operator+(float4 a, float4 b) { return {vaddq_f32(a.v, b.v)}; }
+
+static inline float4 operator-(float4 a, float4 b) { return {vsubq_f32(a.v, b.v)}; }
+
+static inline float4 operator*(float4 a, float4 b) { return {vmulq_f32(a.v, b.v)}; }
+
+#if defined(__aarch64__)
+
+static inline float4 operator/(float4 a, float4 b) { return {vdivq_f32(a.v, b.v)}; }
+
+static inline float4 f4sqrt(float4 a) { return {vsqrtq_f32(a.v)}; }
+
+#else
+
+// ARMv7 NEON has no vector divide or square root; go through lanes
+// rather than estimates so results stay exact.
+static inline float4 operator/(float4 a, float4 b) {
+    float x[4], y[4];
+    vst1q_f32(x, a.v);
+    vst1q_f32(y, b.v);
+    for (int i = 0; i < 4; i++) x[i] /= y[i];
+    return {vld1q_f32(x)};
+}
+
+static inline float4 f4sqrt(float4 a) {
+    float x[4];
+    vst1q_f32(x, a.v);
+    for (int i = 0; i < 4; i++) x[i] = sqrtf(x[i]);
+    return {vld1q_f32(x)};
+}
+
+#endif
+
+static inline float4 f4divNonzero(float4 a, float4 b) {
+    uint32x4_t zero = vceqq_f32(b.v, vdupq_n_f32(0.0f));
+    return {vbslq_f32(zero, a.v, (a / b).v)};
+}
+
+static inline void f4transpose(float4 &a, float4 &b, float4 &c, float4 &d) {
+    float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+    float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+    a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+static inline float4 f4min(float4 a, float4 b) { return {vminq_f32(a.v, b.v)}; }
+
+static inline float4 f4max(float4 a, float4 b) { return {vmaxq_f32(a.v, b.v)}; }
+
+static inline mask4 f4lessEqual(float4 a, float4 b) { return {vcleq_f32(a.v, b.v)}; }
+
+static inline mask4 f4greaterEqual(float4 a, float4 b) { return {vcgeq_f32(a.v, b.v)}; }
+
+static inline mask4 m4and(mask4 a, mask4 b) { return {vandq_u32(a.v, b.v)}; }
+
+static inline bool m4any(mask4 a) {
+    uint32x2_t halves = vorr_u32(vget_low_u32(a.v), vget_high_u32(a.v));
+    return (vget_lane_u32(halves, 0) | vget_lane_u32(halves, 1)) != 0;
+}
+
+static inline float4 f4select(mask4 m, float4 a, float4 b) { return {vbslq_f32(m.v, a.v, b.v)}; }
+
+static inline uint4 u4load(const uint32_t *p) { return {vld1q_u32(p)}; }
+
+static inline void u4store(uint32_t *p, uint4 a) { vst1q_u32(p, a.v); }
+
+static inline uint4 operator+(uint4 a, uint4 b) { return {vaddq_u32(a.v, b.v)}; }
+
+static inline uint4 operator^(uint4 a, uint4 b) { return {veorq_u32(a.v, b.v)}; }
+
+static inline uint4 operator|(uint4 a, uint4 b) { return {vorrq_u32(a.v, b.v)}; }
+
+template<int kBits>
+static inline uint4 u4shl(uint4 a) { return {vshlq_n_u32(a.v, kBits)}; }
+
+template<int kBits>
+static inline uint4 u4shr(uint4 a) { return {vshrq_n_u32(a.v, kBits)}; }
+
+static inline float4 u4unitFloat(uint4 a) {
+    return {vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(a.v, 8)), vdupq_n_f32(1.0f / 16777216.0f))};
+}
+
+#else
+
+static inline float4 f4load(const float *p) { return {{p[0], p[1], p[2], p[3]}}; }
+
+static inline void f4store(float *p, float4 a) {
+    for (int i = 0; i < 4; i++) p[i] = a.v[i];
+}
+
+static inline float4 f4splat(float x) { return {{x, x, x, x}}; }
+
+#define SIMD4_LANEWISE(expr) \
+    float4 r; \
+    for (int i = 0; i < 4; i++) r.v[i] = (expr); \
+    return r;
+
+static inline float4 operator+(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] + b.v[i]) }
+
+static inline float4 operator-(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] - b.v[i]) }
+
+static inline float4 operator*(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] * b.v[i]) }
+
+static inline float4 operator/(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] / b.v[i]) }
+
+static inline float4 f4sqrt(float4 a) { SIMD4_LANEWISE(sqrtf(a.v[i])) }
+
+static inline float4 f4divNonzero(float4 a, float4 b) {
+    SIMD4_LANEWISE(b.v[i] ? a.v[i] / b.v[i] : a.v[i])
+}
+
+static inline float4 f4min(float4 a, float4 b) {
+    SIMD4_LANEWISE(b.v[i] < a.v[i] ? b.v[i] : a.v[i])
+}
+
+static inline float4 f4max(float4 a, float4 b) {
+    SIMD4_LANEWISE(b.v[i] > a.v[i] ? b.v[i] : a.v[i])
+}
+
+static inline float4 f4select(mask4 m, float4 a, float4 b) {
+    SIMD4_LANEWISE(m.v[i] ? a.v[i] : b.v[i])
+}
+
+#define MASK4_LANEWISE(expr) \
+    mask4 r; \
+    for (int i = 0; i < 4; i++) r.v[i] = (expr); \
+    return r;
+
+static inline mask4 f4lessEqual(float4 a, float4 b) { MASK4_LANEWISE(a.v[i] <= b.v[i]) }
+
+static inline mask4 f4greaterEqual(float4 a, float4 b) { MASK4_LANEWISE(a.v[i] >= b.v[i]) }
+
+static inline mask4 m4and(mask4 a, mask4 b) { MASK4_LANEWISE(a.v[i] && b.v[i]) }
+
+#undef MASK4_LANEWISE
+
+static inline bool m4any(mask4 a) { return a.v[0] || a.v[1] || a.v[2] || a.v[3]; }
+
+#undef SIMD4_LANEWISE
+
+static inline uint4 u4load(const uint32_t *p) { return {{p[0], p[1], p[2], p[3]}}; }
+
+static inline void u4store(uint32_t *p, uint4 a) {
+    for (int i = 0; i < 4; i++) p[i] = a.v[i];
+}
+
+#define UINT4_LANEWISE(expr) \
+    uint4 r; \
+    for (int i = 0; i < 4; i++) r.v[i] = (expr); \
+    return r;
+
+static inline uint4 operator+(uint4 a, uint4 b) { UINT4_LANEWISE(a.v[i] + b.v[i]) }
+
+static inline uint4 operator^(uint4 a, uint4 b) { UINT4_LANEWISE(a.v[i] ^ b.v[i]) }
+
+static inline uint4 operator|(uint4 a, uint4 b) { UINT4_LANEWISE(a.v[i] | b.v[i]) }
+
+template<int kBits>
+static inline uint4 u4shl(uint4 a) { UINT4_LANEWISE(a.v[i] << kBits) }
+
+template<int kBits>
+static inline uint4 u4shr(uint4 a) { UINT4_LANEWISE(a.v[i] >> kBits) }
+
+#undef UINT4_LANEWISE
+
+static inline float4 u4unitFloat(uint4 a) {
+    float4 r;
+    for (int i = 0; i < 4; i++) r.v[i] = (float) (a.v[i] >> 8) * (1.0f / 16777216.0f);
+    return r;
+}
+
+static inline void f4transpose(float4 &a, float4 &b, float4 &c, float4 &d) {
+    float4 t[4] = {a, b, c, d};
+    for (int i = 0; i < 4; i++) {
+        a.v[i] = t[i].v[0];
+        b.v[i] = t[i].v[1];
+        c.v[i] = t[i].v[2];
+        d.v[i] = t[i].v[3];
+    }
+}
+
+#endif
+
+template<int kBits>
+static inline uint4 u4rotl(uint4 a) { return u4shl<kBits>(a) | u4shr<32 - kBits>(a); }
+
+// Sine and cosine of each lane, to about 1e-6 for |x| up to a few
+// thousand: reduced to [-pi, pi], where the Taylor series to x^16 is
+// enough.
+static inline void f4sincos(float4 x, float4 *s, float4 *c) {
+    // Adding and taking away 1.5 * 2^23 rounds to an integer.
+    const float4 round = f4splat(12582912.0f);
+    float4 turns = (x * f4splat(0.159154943f) + round) - round;
+    // 2 pi in two parts, the first exact in few bits, so the reduction
+    // stays precise.
+    x = x - turns * f4splat(6.28125f) - turns * f4splat(1.93530718e-3f);
+
+    float4 x2 = x * x;
+    float4 sp = f4splat(-1.0f / 1307674368000.0f);
+    sp = sp * x2 + f4splat(1.0f / 6227020800.0f);
+    sp = sp * x2 + f4splat(-1.0f / 39916800.0f);
+    sp = sp * x2 + f4splat(1.0f / 362880.0f);
+    sp = sp * x2 + f4splat(-1.0f / 5040.0f);
+    sp = sp * x2 + f4splat(1.0f / 120.0f);
+    sp = sp * x2 + f4splat(-1.0f / 6.0f);
+    *s = x + x * x2 * sp;
+
+    float4 cp = f4splat(1.0f / 20922789888000.0f);
+    cp = cp * x2 + f4splat(-1.0f / 87178291200.0f);
+    cp = cp * x2 + f4splat(1.0f / 479001600.0f);
+    cp = cp * x2 + f4splat(-1.0f / 3628800.0f);
+    cp = cp * x2 + f4splat(1.0f / 40320.0f);
+    cp = cp * x2 + f4splat(-1.0f / 720.0f);
+    cp = cp * x2 + f4splat(1.0f / 24.0f);
+    cp = cp * x2 + f4splat(-0.5f);
+    *c = f4splat(1.0f) + x2 * cp;
+}
@@ -21,6 +21,7 @@ import android.content.Intent;
 import android.content.res.AssetManager;
 import android.os.Bundle;
 import android.view.View;
+import android.view.WindowManager;
 
 public class GPUEmulationStressTestActivity extends Activity {
     public static String TAG = "GPUEmulationStressTestActivity";
@@ -34,13 +35,30 @@ public class GPUEmulationStressTestActivity extends Activity {
         Intent intent = getIntent();
         int version = intent.getIntExtra("glesApiLevel", 2);
         int numObjects = intent.getIntExtra("numObjects", 1000);
+        // 60, 90, 120, 144, ... or 0 for unthrottled.
+        float refreshRate = intent.getFloatExtra("refreshRate", 60.0f);
+        // Keep animation on disk for long scenes on low-memory images.
+        boolean streamAnimation = intent.getBooleanExtra("streamAnimation", false);
+        // Drop CPU copies of uploaded assets; they are reloaded on context loss.
+        boolean releaseAssets = intent.getBooleanExtra("releaseAssets", false);
+        // Overlap simulation with rendering; false simulates on the GL thread.
+        boolean simulationThread = intent.getBooleanExtra("simulationThread", true);
+        // Move particles on the GPU; ignored for GLES2.
+        boolean gpuParticles = intent.getBooleanExtra("gpuParticles", false);
+
+        if (refreshRate > 0) {
+            WindowManager.LayoutParams params = getWindow().getAttributes();
+            params.preferredRefreshRate = refreshRate;
+            getWindow().setAttributes(params);
+        }
 
         getWindow().getDecorView().setSystemUiVisibility(
                 getWindow().getDecorView().getSystemUiVisibility() |
                         View.SYSTEM_UI_FLAG_HIDE_NAVIGATION |
                         View.SYSTEM_UI_FLAG_IMMERSIVE_STICKY);
 
-        mGPUEmulationStressTestView = new GPUEmulationStressTestView(this, mAssetManager, version, numObjects);
+        mGPUEmulationStressTestView = new GPUEmulationStressTestView(this, mAssetManager, version, numObjects,
+                refreshRate, streamAnimation, releaseAssets, simulationThread, gpuParticles);
         setContentView(mGPUEmulationStressTestView);
     }
 }
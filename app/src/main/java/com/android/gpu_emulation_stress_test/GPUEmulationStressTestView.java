@@ -20,6 +20,7 @@ import android.app.Activity;
 import android.content.Context;
 import android.content.Intent;
 import android.content.res.AssetManager;
+import android.opengl.EGL14;
 import android.opengl.GLSurfaceView;
 import android.os.Handler;
 import android.os.Looper;
@@ -41,6 +42,24 @@ public class GPUEmulationStressTestView extends GLSurfaceView {
 
     public static native void reinitGL(int width, int height);
 
+    // Stream animation from a scratch file in dir instead of keeping it
+    // resident. Call before initAssets.
+    public static native void setAnimationStreamDirectory(String dir);
+
+    // Target refresh rate in Hz, or 0 to render as fast as possible.
+    public static native void setRefreshRate(float refreshRateHz);
+
+    // Free CPU copies of models and textures once they are uploaded.
+    public static native void setReleaseAssetsAfterUpload(boolean release);
+
+    // Simulate on a thread of its own, overlapping draw submission,
+    // instead of on the GL thread before each draw.
+    public static native void setSimulationThread(boolean enabled);
+
+    // Move particles on the GPU with transform feedback; GLES3 only.
+    // Call before initAssets.
+    public static native void setGpuParticles(boolean enabled);
+
     public static native void drawFrame();
 
     public static native void registerGLView(GPUEmulationStressTestView view);
@@ -55,10 +74,14 @@ public class GPUEmulationStressTestView extends GLSurfaceView {
     private static Handler currHandler;
     private static int mGlesVersion;
     private static int mNumObjects;
+    private static float mRefreshRate;
     private static Intent mIntent;
 
     public GPUEmulationStressTestView(Context context, AssetManager assets,
-                                      int glesVersion, int numObjects) {
+                                      int glesVersion, int numObjects,
+                                      float refreshRate, boolean streamAnimation,
+                                      boolean releaseAssets, boolean simulationThread,
+                                      boolean gpuParticles) {
         super(context);
 
         currGLView = this;
@@ -66,11 +89,20 @@ public class GPUEmulationStressTestView extends GLSurfaceView {
 
         mNumObjects = numObjects;
         mGlesVersion = glesVersion;
+        mRefreshRate = refreshRate;
         mAssetManager = assets;
 
+        if (streamAnimation) {
+            setAnimationStreamDirectory(context.getCacheDir().getAbsolutePath());
+        }
+        setGpuParticles(gpuParticles);
+
         // Initialize assets and the world based on
         // GLES version and number of objects.
         initAssets(mAssetManager, mGlesVersion, mNumObjects);
+        setRefreshRate(mRefreshRate);
+        setReleaseAssetsAfterUpload(releaseAssets);
+        setSimulationThread(simulationThread);
 
         // Create an OpenGL ES 2 or 3 context based on
         // the input.
@@ -124,7 +156,10 @@ public class GPUEmulationStressTestView extends GLSurfaceView {
         }
 
         public void onSurfaceCreated(GL10 gl, EGLConfig config) {
-            // Do nothing.
+            // Unthrottled runs shouldn't wait for vsync either.
+            if (mRefreshRate == 0) {
+                EGL14.eglSwapInterval(EGL14.eglGetCurrentDisplay(), 0);
+            }
         }
     }
 
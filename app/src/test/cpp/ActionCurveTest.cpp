@@ -0,0 +1,160 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "ActionCurve.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+static int sFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            sFailures++; \
+        } \
+    } while (0)
+
+// Frames from well before the first key to well after the last one of
+// the curves below.
+static const int kFirstFrame = -50;
+static const int kLastFrame = 100;
+
+// A key at (|x|, |y|) with flat handles.
+static void sAddKey(ActionCurve &curve, float x, float y) {
+    curve.addKey(ActionCurve::CurveType::Bezier,
+                 ActionCurve::KeyHandleType::AutoClamped, ActionCurve::KeyHandleType::AutoClamped,
+                 x - 1.0f, y, x + 1.0f, y, x, y);
+}
+
+static ActionCurve sCurve(const std::vector<float> &xy) {
+    ActionCurve curve;
+    for (size_t i = 0; i + 1 < xy.size(); i += 2) {
+        sAddKey(curve, xy[i], xy[i + 1]);
+    }
+    return curve;
+}
+
+static void sCheckFinite(ActionCurve &curve) {
+    for (int frame = kFirstFrame; frame <= kLastFrame; frame++) {
+        CHECK(isfinite(curve.evalAtFrame(frame, false)));
+        CHECK(isfinite(curve.evalAtFrame(frame, true)));
+    }
+}
+
+// Keys added out of order evaluate as if added in order.
+static void testUnsortedKeys() {
+    ActionCurve sorted = sCurve({10.0f, 1.0f, 20.0f, 5.0f, 40.0f, 2.0f});
+    ActionCurve unsorted = sCurve({40.0f, 2.0f, 10.0f, 1.0f, 20.0f, 5.0f});
+    for (int frame = kFirstFrame; frame <= kLastFrame; frame++) {
+        CHECK(sorted.evalAtFrame(frame, false) == unsorted.evalAtFrame(frame, false));
+        CHECK(sorted.evalAtFrame(frame, true) == unsorted.evalAtFrame(frame, true));
+    }
+}
+
+// The curve passes through its keys and holds the first and last one
+// outside of them.
+static void testHoldsOutsideKeys() {
+    ActionCurve curve = sCurve({10.0f, 1.0f, 20.0f, 5.0f, 40.0f, 2.0f});
+    CHECK(curve.evalAtFrame(10, false) == 1.0f);
+    CHECK(curve.evalAtFrame(20, false) == 5.0f);
+    CHECK(curve.evalAtFrame(40, false) == 2.0f);
+
+    for (int frame = kFirstFrame; frame < 10; frame++) {
+        CHECK(curve.evalAtFrame(frame, false) == 1.0f);
+    }
+    for (int frame = 41; frame <= kLastFrame; frame++) {
+        CHECK(curve.evalAtFrame(frame, false) == 2.0f);
+    }
+    CHECK(curve.evalAtFrame(1000000, false) == 2.0f);
+
+    // Normalized, the lowest key is at 0 and the highest at 1.
+    CHECK(curve.evalAtFrame(kFirstFrame, true) == 0.0f);
+    CHECK(curve.evalAtFrame(20, true) == 1.0f);
+}
+
+// Keys sharing a frame jump to the later one, wherever they are.
+static void testDuplicateFrames() {
+    ActionCurve last = sCurve({0.0f, 0.0f, 10.0f, 3.0f, 10.0f, 7.0f});
+    sCheckFinite(last);
+    CHECK(last.evalAtFrame(10, false) == 7.0f);
+    CHECK(last.evalAtFrame(kLastFrame, false) == 7.0f);
+
+    ActionCurve first = sCurve({0.0f, 2.0f, 0.0f, 4.0f, 10.0f, 6.0f});
+    sCheckFinite(first);
+    CHECK(first.evalAtFrame(kFirstFrame, false) == 4.0f);
+    CHECK(first.evalAtFrame(0, false) == 4.0f);
+
+    ActionCurve middle = sCurve({0.0f, 0.0f, 5.0f, 1.0f, 5.0f, 9.0f, 10.0f, 2.0f});
+    sCheckFinite(middle);
+    CHECK(middle.evalAtFrame(5, false) == 9.0f);
+
+    ActionCurve all = sCurve({3.0f, 1.0f, 3.0f, 2.0f});
+    sCheckFinite(all);
+    CHECK(all.evalAtFrame(0, false) == 2.0f);
+}
+
+// A curve without range normalizes to 0 rather than 0 / 0.
+static void testFlatNormalized() {
+    ActionCurve curve = sCurve({0.0f, 3.0f, 10.0f, 3.0f, 20.0f, 3.0f});
+    sCheckFinite(curve);
+    CHECK(curve.evalAtFrame(5, true) == 0.0f);
+    CHECK(curve.evalAtFrame(10, false) == 3.0f);
+}
+
+// The batch evaluation gives what evaluating frame by frame does, for
+// frames in any order.
+static void testBatchMatchesScalar() {
+    std::vector<ActionCurve> curves;
+    curves.push_back(sCurve({40.0f, 2.0f, 10.0f, 1.0f, 20.0f, 5.0f}));
+    curves.push_back(sCurve({0.0f, 0.0f, 10.0f, 3.0f, 10.0f, 7.0f}));
+    curves.push_back(sCurve({0.0f, 3.0f, 10.0f, 3.0f}));
+    curves.push_back(sCurve({5.0f, 1.0f}));
+    curves.push_back(ActionCurve());
+
+    std::vector<int> frames;
+    for (int frame = kLastFrame; frame >= kFirstFrame; frame -= 3) {
+        frames.push_back(frame);
+        frames.push_back(frame * 7 % 61);
+    }
+
+    for (bool normalized : {false, true}) {
+        for (ActionCurve &curve : curves) {
+            std::vector<float> batch(frames.size());
+            curve.evalAtFrame(frames.data(), frames.size(), normalized, batch.data());
+            for (size_t i = 0; i < frames.size(); i++) {
+                CHECK(batch[i] == curve.evalAtFrame(frames[i], normalized));
+            }
+        }
+    }
+}
+
+int main() {
+    testUnsortedKeys();
+    testHoldsOutsideKeys();
+    testDuplicateFrames();
+    testFlatNormalized();
+    testBatchMatchesScalar();
+
+    if (sFailures) {
+        fprintf(stderr, "%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("ActionCurveTest passed\n");
+    return 0;
+}
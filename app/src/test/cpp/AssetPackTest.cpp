@@ -0,0 +1,139 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "AssetPack.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static int sFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            sFailures++; \
+        } \
+    } while (0)
+
+static const char kName[] = "a.txt";
+static const char kContents[] = "hello, pack";
+
+// A pack holding kContents, stored raw, as kName, laid out the way
+// tools/make_asset_pack.py writes it.
+static std::vector<unsigned char> sPack(AssetPack::Header &header, AssetPack::Entry &entry) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "GSAP", 4);
+    header.version = 1;
+    header.entryCount = 1;
+    header.namesSize = sizeof(kName) - 1;
+    header.alignment = 16;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.offset = 80;
+    entry.storedSize = sizeof(kContents) - 1;
+    entry.size = entry.storedSize;
+    entry.nameLength = header.namesSize;
+
+    std::vector<unsigned char> pack(entry.offset + entry.storedSize);
+    memcpy(&pack[0], &header, sizeof(header));
+    memcpy(&pack[sizeof(header)], &entry, sizeof(entry));
+    memcpy(&pack[sizeof(header) + sizeof(entry)], kName, header.namesSize);
+    memcpy(&pack[entry.offset], kContents, entry.storedSize);
+    return pack;
+}
+
+static bool sOpens(const AssetPack::Header &header, const AssetPack::Entry &entry,
+                   std::vector<unsigned char> pack) {
+    memcpy(&pack[0], &header, sizeof(header));
+    memcpy(&pack[sizeof(header)], &entry, sizeof(entry));
+    AssetPack opened;
+    return opened.open(pack.data(), pack.size());
+}
+
+static void testReadsEntry() {
+    AssetPack::Header header;
+    AssetPack::Entry entry;
+    std::vector<unsigned char> pack = sPack(header, entry);
+
+    AssetPack opened;
+    CHECK(opened.open(pack.data(), pack.size()));
+    CHECK(opened.entryCount() == 1);
+    std::vector<unsigned char> out;
+    CHECK(opened.read(kName, out));
+    CHECK(out.size() == sizeof(kContents));
+    CHECK(!memcmp(out.data(), kContents, sizeof(kContents)));
+    CHECK(!opened.read("b.txt", out));
+}
+
+// Offsets and sizes whose sums wrap around are out of bounds.
+static void testRejectsWrappingEntry() {
+    AssetPack::Header header;
+    AssetPack::Entry entry;
+    std::vector<unsigned char> pack = sPack(header, entry);
+
+    AssetPack::Entry bad = entry;
+    bad.offset = UINT64_MAX - 3;
+    CHECK(!sOpens(header, bad, pack));
+
+    bad = entry;
+    bad.offset = pack.size();
+    bad.storedSize = 1;
+    CHECK(!sOpens(header, bad, pack));
+
+    bad = entry;
+    bad.nameOffset = UINT32_MAX;
+    CHECK(!sOpens(header, bad, pack));
+
+    bad = entry;
+    bad.nameLength = header.namesSize + 1;
+    CHECK(!sOpens(header, bad, pack));
+}
+
+// Tables that don't fit the pack are rejected before they're read.
+static void testRejectsTruncatedTable() {
+    AssetPack::Header header;
+    AssetPack::Entry entry;
+    std::vector<unsigned char> pack = sPack(header, entry);
+
+    AssetPack::Header bad = header;
+    bad.entryCount = UINT32_MAX;
+    CHECK(!sOpens(bad, entry, pack));
+
+    bad = header;
+    bad.namesSize = UINT32_MAX;
+    CHECK(!sOpens(bad, entry, pack));
+
+    AssetPack opened;
+    CHECK(!opened.open(pack.data(), sizeof(header) + sizeof(entry) - 1));
+    CHECK(!opened.open(pack.data(), sizeof(header) - 1));
+    CHECK(!opened.isOpen());
+}
+
+int main() {
+    testReadsEntry();
+    testRejectsWrappingEntry();
+    testRejectsTruncatedTable();
+
+    if (sFailures) {
+        fprintf(stderr, "%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("AssetPackTest passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// Time per frame of what the simulation thread does with the BVH, by
+// the fraction of entities that moved: update() as WorldState runs it,
+// and the frustum query Simulation pre-culls each snapshot with.
+//
+//   BvhBenchmark [entities] [frames]
+
+#include "Bvh.h"
+#include "EntityStore.h"
+#include "RenderModel.h"
+#include "matrix.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+static double sNowUs() {
+    return std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Nudges |fraction| of the entities, spread over the store, and flags
+// only them dirty, as the simulation leaves things for update().
+static void sMove(EntityStore &entities, double fraction) {
+    for (size_t i = 0; i < entities.size(); i++) {
+        entities.flags[i] &= ~EntityStore::kDirty;
+    }
+    size_t moved = (size_t) (entities.size() * fraction);
+    for (size_t k = 0; k < moved; k++) {
+        size_t i = (k * 7919) % entities.size();
+        entity_handle_t handle = entities.handles[i];
+        vector4 pos = entities.pos(handle);
+        pos.x += 0.05f;
+        entities.setFrame(handle, pos, qidentity());
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t entityCount = argc > 1 ? (size_t) atol(argv[1]) : 20000;
+    int frames = argc > 2 ? atoi(argv[2]) : 100;
+
+    std::vector<RenderModel> models(1);
+    for (int c = 0; c < 3; c++) {
+        models[0].boundsMin[c] = -1.0f;
+        models[0].boundsMax[c] = 1.0f;
+    }
+
+    EntityStore entities;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> coord(-100.0f, 100.0f);
+    for (size_t i = 0; i < entityCount; i++) {
+        entity_handle_t handle = entities.spawn();
+        entities.setFrame(handle, makevector4(coord(rng), coord(rng), coord(rng), 1.0f),
+                          qidentity());
+        entities.setScale(handle, makevector4(0.1f, 0.1f, 0.1f, 1.0f));
+    }
+
+    Bvh bvh;
+    double start = sNowUs();
+    bvh.build(entities, models);
+    printf("%zu entities, build %.0f us\n", entityCount, sNowUs() - start);
+
+    // Sees a box of half a side of the scatter around the origin.
+    std::vector<entity_handle_t> visible;
+    matrix4 viewProj = identity4();
+    for (int i = 0; i < 15; i++) {
+        viewProj.vals[i] *= 0.02f;
+    }
+
+    static const double kFractions[] = {0.0, 0.01, 0.1, 1.0};
+    for (double fraction : kFractions) {
+        double updateUs = 0.0;
+        double queryUs = 0.0;
+        size_t inView = 0;
+        uint32_t rebuilds = bvh.rebuildCount();
+        for (int frame = 0; frame < frames; frame++) {
+            sMove(entities, fraction);
+            start = sNowUs();
+            bvh.update(entities, models);
+            updateUs += sNowUs() - start;
+
+            visible.clear();
+            start = sNowUs();
+            bvh.queryFrustum(viewProj, visible);
+            queryUs += sNowUs() - start;
+            inView += visible.size();
+        }
+        printf("moved %5.1f%%: update %7.1f us/frame, frustum query %7.1f us/frame "
+               "(%zu in view), %u rebuilds\n",
+               fraction * 100.0, updateUs / frames, queryUs / frames, inView / frames,
+               bvh.rebuildCount() - rebuilds);
+    }
+    return 0;
+}
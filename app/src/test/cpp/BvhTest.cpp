@@ -0,0 +1,182 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "Bvh.h"
+#include "EntityStore.h"
+#include "RenderModel.h"
+#include "matrix.h"
+
+#include <stdio.h>
+#include <vector>
+
+static int sFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            sFailures++; \
+        } \
+    } while (0)
+
+static std::vector<RenderModel> sUnitCubeModels() {
+    std::vector<RenderModel> models(1);
+    for (int c = 0; c < 3; c++) {
+        models[0].boundsMin[c] = -0.5f;
+        models[0].boundsMax[c] = 0.5f;
+    }
+    return models;
+}
+
+static void sSpawn(EntityStore &entities, int count) {
+    for (int n = 0; n < count; n++) {
+        entities.setScale(entities.spawn(), makevector4(1.0f, 1.0f, 1.0f, 0.0f));
+    }
+}
+
+// Places entity |i| in grid cell |cell|, with |spacing| between
+// neighboring cells.
+static void sPlace(EntityStore &entities, size_t i, size_t cell, float spacing) {
+    float x = (float) (cell % 16);
+    float y = (float) (cell / 16 % 16);
+    float z = (float) (cell / 256);
+    entities.setFrame(entities.handles[i], makevector4(x * spacing, y * spacing, z * spacing, 1.0f),
+                      qidentity());
+}
+
+// What the simulation does once a frame has been snapshotted.
+static void sClearDirty(EntityStore &entities) {
+    for (size_t i = 0; i < entities.size(); i++) {
+        entities.flags[i] &= ~EntityStore::kDirty;
+    }
+}
+
+// Entities trading places every frame make the refit tree loose enough
+// to rebuild every frame. The headroom each rebuild leaves must follow
+// the live slots, not what the last rebuild left.
+static void testRebuildHeadroomStaysBounded() {
+    std::vector<RenderModel> models = sUnitCubeModels();
+    EntityStore entities;
+    sSpawn(entities, 1000);
+    for (size_t i = 0; i < entities.size(); i++) {
+        sPlace(entities, i, i, 1.0f);
+    }
+
+    Bvh bvh;
+    bvh.build(entities, models);
+    size_t maxSlots = entities.slotCount() + entities.slotCount() / 2;
+    CHECK(bvh.slotCount() == maxSlots);
+
+    for (int frame = 0; frame < 100; frame++) {
+        sClearDirty(entities);
+        for (size_t i = 0; i < entities.size(); i++) {
+            sPlace(entities, i, (i * 7919 + frame * 131) % entities.size(), 1.0f);
+        }
+        bvh.update(entities, models);
+        CHECK(bvh.slotCount() <= maxSlots);
+    }
+    CHECK(bvh.rebuildCount() >= 50);
+    CHECK(bvh.slotCount() == maxSlots);
+}
+
+// Growing past the covered slots rebuilds with headroom over the new
+// slot count, and the tree still finds every entity.
+static void testGrowthRebuildsOverLiveSlots() {
+    std::vector<RenderModel> models = sUnitCubeModels();
+    EntityStore entities;
+    sSpawn(entities, 100);
+    for (size_t i = 0; i < entities.size(); i++) {
+        sPlace(entities, i, i, 2.0f);
+    }
+
+    Bvh bvh;
+    bvh.build(entities, models);
+
+    for (int frame = 0; frame < 20; frame++) {
+        sClearDirty(entities);
+        size_t first = entities.size();
+        sSpawn(entities, 50);
+        for (size_t i = first; i < entities.size(); i++) {
+            sPlace(entities, i, i, 2.0f);
+        }
+        bvh.update(entities, models);
+        CHECK(bvh.slotCount() >= entities.slotCount());
+        CHECK(bvh.slotCount() <= entities.slotCount() + entities.slotCount() / 2);
+    }
+
+    std::vector<entity_handle_t> found;
+    bvh.querySphere(makevector4(0.0f, 0.0f, 0.0f, 1.0f), 1000.0f, found);
+    CHECK(found.size() == entities.size());
+}
+
+// The query Simulation pre-culls snapshots with finds every entity a
+// brute force test of the same frustum keeps, after entities moved.
+static void testFrustumQueryKeepsEverythingInView() {
+    std::vector<RenderModel> models = sUnitCubeModels();
+    EntityStore entities;
+    sSpawn(entities, 1000);
+    for (size_t i = 0; i < entities.size(); i++) {
+        sPlace(entities, i, i, 1.0f);
+    }
+
+    Bvh bvh;
+    bvh.build(entities, models);
+    sClearDirty(entities);
+    for (size_t i = 0; i < entities.size(); i += 3) {
+        sPlace(entities, i, (i * 7919) % entities.size(), 1.0f);
+    }
+    bvh.update(entities, models);
+
+    // Sees x and y in [-4, 4] around the grid's middle, z in [-4, 4].
+    matrix4 viewProj = identity4();
+    for (int i = 0; i < 15; i++) {
+        viewProj.vals[i] *= 0.25f;
+    }
+    viewProj.vals[12] = -7.5f * 0.25f;
+    viewProj.vals[13] = -7.5f * 0.25f;
+
+    std::vector<entity_handle_t> found;
+    bvh.queryFrustum(viewProj, found);
+    std::vector<bool> isFound(entities.slotCount(), false);
+    for (entity_handle_t handle : found) {
+        isFound[EntityStore::slotOf(handle)] = true;
+    }
+
+    Frustum frustum(viewProj);
+    size_t inView = 0;
+    for (size_t i = 0; i < entities.size(); i++) {
+        entity_handle_t handle = entities.handles[i];
+        if (frustum.test(bvh.bounds(handle)) == kOutside) continue;
+        inView++;
+        CHECK(isFound[EntityStore::slotOf(handle)]);
+    }
+    CHECK(inView > 0);
+    CHECK(inView < entities.size());
+    CHECK(found.size() == inView);
+}
+
+int main() {
+    testRebuildHeadroomStaysBounded();
+    testGrowthRebuildsOverLiveSlots();
+    testFrustumQueryKeepsEverythingInView();
+
+    if (sFailures) {
+        fprintf(stderr, "%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("BvhTest passed\n");
+    return 0;
+}
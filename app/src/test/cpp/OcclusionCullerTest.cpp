@@ -0,0 +1,186 @@
+/*
+* Copyright (C) 2017 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "OcclusionCuller.h"
+#include "EntityStore.h"
+#include "RenderModel.h"
+#include "matrix.h"
+
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+static int sFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            sFailures++; \
+        } \
+    } while (0)
+
+// The camera sits at the origin looking down -z, seeing 90 degrees
+// across, so at distance d it sees x in [-d, d].
+static const float kAspect = (float) OcclusionCuller::kWidth / OcclusionCuller::kHeight;
+
+static matrix4 sViewProj() {
+    return makeCameraMatrix(makevector4(0.0f, 0.0f, 0.0f, 1.0f),
+                            makevector4(0.0f, 0.0f, -1.0f, 0.0f),
+                            makevector4(0.0f, 1.0f, 0.0f, 0.0f),
+                            90.0f, kAspect, 0.1f, 100.0f);
+}
+
+// World x seen at buffer column |column| (in pixels, not a pixel
+// center) at distance |distance|.
+static float sWorldX(float column, float distance) {
+    return (column / OcclusionCuller::kWidth * 2.0f - 1.0f) * distance;
+}
+
+// A model whose only mesh is the rectangle [x0, x1] x [y0, y1] at z = 0,
+// facing +z.
+static RenderModel sQuadModel(float x0, float x1, float y0, float y1) {
+    std::shared_ptr<OBJParse> quad = std::make_shared<OBJParse>();
+    const float corners[4][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    for (const auto &corner : corners) {
+        OBJParse::VertexAttributes vertex = {{corner[0], corner[1], 0.0f},
+                                             {0.0f, 0.0f, 1.0f},
+                                             {0.0f, 0.0f}};
+        quad->vertexData.push_back(vertex);
+    }
+    quad->indexData = {0, 1, 2, 0, 2, 3};
+
+    RenderModel model;
+    model.geometry = quad;
+    model.indexCount = 6;
+    model.boundsMin[0] = x0;
+    model.boundsMin[1] = y0;
+    model.boundsMax[0] = x1;
+    model.boundsMax[1] = y1;
+    // Big enough to be an occluder.
+    model.boundsRadius = 100.0f;
+    return model;
+}
+
+static Aabb sBox(float x0, float x1, float y0, float y1, float z0, float z1) {
+    return Aabb{{x0, y0, z0}, {x1, y1, z1}};
+}
+
+// Draws |model| at z = -|distance| as the only occluder of a frame.
+static void sDrawOccluder(OcclusionCuller &culler, const RenderModel &model, float distance) {
+    EntityStore entities;
+    std::vector<RenderModel> models(1, model);
+    culler.setOccluders(entities, models);
+    CHECK(culler.isOccluder(0));
+
+    culler.begin(sViewProj());
+    culler.addOccluder(0, translation(0.0f, 0.0f, -distance));
+    culler.finishOccluders();
+}
+
+// A wall filling the view hides what is behind it, and nothing in front
+// of it or reaching past the near plane.
+static void testFullScreenOccluder() {
+    OcclusionCuller culler;
+    sDrawOccluder(culler, sQuadModel(-50.0f, 50.0f, -50.0f, 50.0f), 10.0f);
+
+    CHECK(culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -21.0f, -19.0f)));
+    CHECK(culler.isOccluded(sBox(-30.0f, 30.0f, -15.0f, 15.0f, -40.0f, -35.0f)));
+
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -6.0f, -4.0f)));
+    // Straddling the wall.
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -11.0f, -9.0f)));
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -30.0f, 1.0f)));
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -30.0f, -0.05f)));
+}
+
+// Only what is behind the occluder on screen is hidden.
+static void testBoxBesideOccluder() {
+    OcclusionCuller culler;
+    sDrawOccluder(culler, sQuadModel(-2.0f, 2.0f, -2.0f, 2.0f), 10.0f);
+
+    CHECK(culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -21.0f, -19.0f)));
+    CHECK(!culler.isOccluded(sBox(6.0f, 8.0f, -1.0f, 1.0f, -21.0f, -19.0f)));
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, 6.0f, 8.0f, -21.0f, -19.0f)));
+    // Partly behind it.
+    CHECK(!culler.isOccluded(sBox(3.0f, 5.0f, -1.0f, 1.0f, -21.0f, -19.0f)));
+}
+
+// A box only just past an occluder's edge on screen is kept, wherever
+// the edge falls within a pixel, though coverage is only sampled at
+// pixel centers.
+static void testBoxPastOccluderEdge() {
+    const float distance = 10.0f;
+    const float behind = 20.0f;
+    const float column = OcclusionCuller::kWidth / 2.0f;
+    for (float edge = 0.05f; edge < 1.0f; edge += 0.1f) {
+        OcclusionCuller culler;
+        sDrawOccluder(culler,
+                      sQuadModel(-50.0f, sWorldX(column + edge, distance), -50.0f, 50.0f),
+                      distance);
+
+        // A tenth of a pixel wide, starting a twentieth past the edge.
+        float x0 = sWorldX(column + edge + 0.05f, behind);
+        float x1 = sWorldX(column + edge + 0.15f, behind);
+        CHECK(!culler.isOccluded(sBox(x0, x1, -1.0f, 1.0f, -behind - 0.01f, -behind)));
+
+        // The same box well inside the edge is hidden.
+        x0 = sWorldX(column + edge - 3.0f, behind);
+        x1 = sWorldX(column + edge - 2.9f, behind);
+        CHECK(culler.isOccluded(sBox(x0, x1, -1.0f, 1.0f, -behind - 0.01f, -behind)));
+    }
+}
+
+// Batched entities using an occluder model are drawn by begin().
+static void testStaticOccluder() {
+    EntityStore entities;
+    entity_handle_t wall = entities.spawn();
+    entities.setFrame(wall, makevector4(0.0f, 0.0f, -10.0f, 1.0f), qidentity());
+    entities.setScale(wall, makevector4(1.0f, 1.0f, 1.0f, 0.0f));
+    entities.flags[entities.indexOf(wall)] |= EntityStore::kRenderable | EntityStore::kBatched;
+    entities.renderModel[entities.indexOf(wall)] = 0;
+
+    OcclusionCuller culler;
+    std::vector<RenderModel> models(1, sQuadModel(-50.0f, 50.0f, -50.0f, 50.0f));
+    culler.setOccluders(entities, models);
+    culler.begin(sViewProj());
+    culler.finishOccluders();
+
+    CHECK(culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -21.0f, -19.0f)));
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, -6.0f, -4.0f)));
+
+    // Looking the other way, it hides nothing.
+    culler.begin(makeCameraMatrix(makevector4(0.0f, 0.0f, 0.0f, 1.0f),
+                                  makevector4(0.0f, 0.0f, 1.0f, 0.0f),
+                                  makevector4(0.0f, 1.0f, 0.0f, 0.0f),
+                                  90.0f, kAspect, 0.1f, 100.0f));
+    culler.finishOccluders();
+    CHECK(!culler.isOccluded(sBox(-1.0f, 1.0f, -1.0f, 1.0f, 19.0f, 21.0f)));
+}
+
+int main() {
+    testFullScreenOccluder();
+    testBoxBesideOccluder();
+    testBoxPastOccluderEdge();
+    testStaticOccluder();
+
+    if (sFailures) {
+        fprintf(stderr, "%d checks failed\n", sFailures);
+        return 1;
+    }
+    printf("OcclusionCullerTest passed\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2017 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Packs an asset directory into a single indexed archive.
+
+The layout matches app/src/main/cpp/AssetPack.h:
+
+  header   magic "GSAP", version, entry count, name table size, alignment
+  entries  offset, stored size, size, flags, name offset, name length
+  names    '/' separated paths relative to the asset directory
+  blobs    each starting at a multiple of the alignment
+
+With --lz4, entries are stored as raw LZ4 blocks when that makes them
+noticeably smaller. Already compressed formats (PNG) are left alone.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"GSAP"
+VERSION = 1
+ALIGNMENT = 4096
+
+HEADER = struct.Struct("<4sIIII12x")
+ENTRY = struct.Struct("<QIIIII4x")
+
+FLAG_LZ4 = 1
+
+# Only keep a compressed entry if it saves at least this fraction.
+MIN_SAVINGS = 0.1
+
+INCOMPRESSIBLE = (".png",)
+
+# LZ4 block format constraints.
+MIN_MATCH = 4
+LAST_LITERALS = 5
+MF_LIMIT = 12
+MAX_OFFSET = 65535
+
+
+def _lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _lz4_sequence(out, literals, offset, match_length):
+    lit_len = len(literals)
+    token_lit = min(lit_len, 15)
+    token_match = 0 if offset is None else min(match_length - MIN_MATCH, 15)
+    out.append((token_lit << 4) | token_match)
+    if lit_len >= 15:
+        _lz4_length(out, lit_len - 15)
+    out += literals
+    if offset is None:
+        return
+    out += struct.pack("<H", offset)
+    if match_length - MIN_MATCH >= 15:
+        _lz4_length(out, match_length - MIN_MATCH - 15)
+
+
+def lz4_compress(src):
+    """Greedy LZ4 block compression; slow but simple."""
+    n = len(src)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    limit = n - MF_LIMIT
+    while i < limit:
+        key = src[i:i + MIN_MATCH]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > MAX_OFFSET:
+            i += 1
+            continue
+
+        length = MIN_MATCH
+        max_length = n - LAST_LITERALS - i
+        step = 32
+        while length < max_length:
+            span = min(step, max_length - length)
+            if src[ref + length:ref + length + span] == src[i + length:i + length + span]:
+                length += span
+                continue
+            while src[ref + length] == src[i + length]:
+                length += 1
+            break
+
+        _lz4_sequence(out, src[anchor:i], i - ref, length)
+        i += length
+        anchor = i
+    _lz4_sequence(out, src[anchor:], None, 0)
+    return bytes(out)
+
+
+def collect(asset_dir, exclude):
+    files = []
+    for root, dirs, names in os.walk(asset_dir):
+        dirs.sort()
+        for name in sorted(names):
+            path = os.path.join(root, name)
+            rel = os.path.relpath(path, asset_dir).replace(os.sep, "/")
+            if rel in exclude or name.startswith("."):
+                continue
+            files.append((rel, path))
+    return files
+
+
+def align(value):
+    return (value + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("asset_dir")
+    parser.add_argument("output")
+    parser.add_argument("--lz4", action="store_true",
+                        help="compress entries with LZ4 where it helps")
+    args = parser.parse_args()
+
+    output_name = os.path.basename(args.output)
+    files = collect(args.asset_dir, {output_name})
+
+    blobs = []
+    for rel, path in files:
+        with open(path, "rb") as f:
+            data = f.read()
+        stored, flags = data, 0
+        if args.lz4 and not rel.lower().endswith(INCOMPRESSIBLE) and data:
+            packed = lz4_compress(data)
+            if len(packed) <= len(data) * (1.0 - MIN_SAVINGS):
+                stored, flags = packed, FLAG_LZ4
+        blobs.append((rel.encode("utf-8"), data, stored, flags))
+
+    names = bytearray()
+    name_offsets = []
+    for rel, _, _, _ in blobs:
+        name_offsets.append(len(names))
+        names += rel
+
+    offset = align(HEADER.size + ENTRY.size * len(blobs) + len(names))
+    entries = bytearray()
+    layout = []
+    for (rel, data, stored, flags), name_offset in zip(blobs, name_offsets):
+        entries += ENTRY.pack(offset, len(stored), len(data), flags, name_offset, len(rel))
+        layout.append(offset)
+        offset = align(offset + len(stored))
+
+    with open(args.output, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, len(blobs), len(names), ALIGNMENT))
+        f.write(entries)
+        f.write(names)
+        for (rel, data, stored, flags), blob_offset in zip(blobs, layout):
+            f.seek(blob_offset)
+            f.write(stored)
+        f.truncate(f.tell())
+
+    raw = sum(len(b[1]) for b in blobs)
+    packed = sum(len(b[2]) for b in blobs)
+    print("%s: %d entries, %d -> %d bytes stored" % (args.output, len(blobs), raw, packed))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())